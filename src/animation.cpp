@@ -0,0 +1,95 @@
+#include "animation.h"
+#include <algorithm>
+#include <unordered_set>
+
+Animation::Animation(int width, int height) {
+    frames_.push_back({nextId_++, LayerStack(width, height)});
+}
+
+int Animation::indexOf(int id) const {
+    for (int i = 0; i < count(); i++)
+        if (frames_[i].id == id) return i;
+    return -1;
+}
+
+int Animation::add(bool duplicate) {
+    // Flatten first so the copy shares the composite's tiles too, instead
+    // of blending an identical image of its own.
+    if (duplicate) layers().composite();
+    Frame f{nextId_++, duplicate ? layers() : LayerStack(width(), height())};
+    frames_.insert(frames_.begin() + current_ + 1, std::move(f));
+    return ++current_;
+}
+
+void Animation::remove(int index) {
+    if (count() <= 1 || index < 0 || index >= count()) return;
+    frames_.erase(frames_.begin() + index);
+    if (current_ > index || current_ == count()) current_--;
+}
+
+void Animation::move(int from, int to) {
+    to = std::max(0, std::min(to, count() - 1));
+    if (from == to || from < 0 || from >= count()) return;
+    Frame f = std::move(frames_[from]);
+    frames_.erase(frames_.begin() + from);
+    frames_.insert(frames_.begin() + to, std::move(f));
+    if (current_ == from) current_ = to;
+    else if (from < current_ && to >= current_) current_--;
+    else if (from > current_ && to <= current_) current_++;
+}
+
+void Animation::select(int index) {
+    current_ = std::max(0, std::min(index, count() - 1));
+}
+
+void Animation::applyDelta(const CanvasDelta& d, bool undo) {
+    int i = indexOf(d.frame);
+    if (i < 0) return;
+    current_ = i;
+    frames_[i].layers.applyDelta(d, undo);
+}
+
+void Animation::setFps(int fps) {
+    fps_ = std::max(1, std::min(fps, (int)MAX_FPS));
+}
+
+void Animation::play() {
+    playing_ = count() > 1;
+    clock_ = 0;
+}
+
+bool Animation::tick(double seconds) {
+    if (!playing_ || count() <= 1) return false;
+    clock_ += seconds;
+    double period = 1.0 / fps_;
+    if (clock_ < period) return false;
+
+    // A long stall skips frames rather than replaying them quickly.
+    int steps = (int)(clock_ / period);
+    clock_ -= steps * period;
+    current_ = (current_ + steps) % count();
+    return true;
+}
+
+double Animation::untilTick() const {
+    if (!playing_ || count() <= 1) return -1;
+    return std::max(0.0, 1.0 / fps_ - clock_);
+}
+
+size_t Animation::memoryUsage() const {
+    std::unordered_set<const Tile*> seen;
+    size_t bytes = 0;
+    for (auto& f : frames_) {
+        for (int i = 0; i < f.layers.count(); i++) {
+            const Canvas& c = f.layers.layer(i).canvas;
+            for (int ty = 0; ty < c.tilesY(); ty++) {
+                for (int tx = 0; tx < c.tilesX(); tx++) {
+                    const Tile* t = c.tileAt(tx, ty).get();
+                    if (seen.insert(t).second)
+                        bytes += sizeof(Tile) + t->px.size() * sizeof(Color) + t->idx.size();
+                }
+            }
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "layers.h"
+#include <cstddef>
+#include <vector>
+
+struct Frame {
+    int        id = 0;
+    LayerStack layers;
+};
+
+// A sequence of frames, each with its own layer stack, plus the playback
+// clock. Duplicating a frame copies only tile references, so frames that
+// differ in a few places share the rest of their pixels (and the texture
+// upload of the shared tiles, see CanvasTexture).
+class Animation {
+public:
+    Animation(int width, int height);
+
+    int width()  const { return frames_[0].layers.width(); }
+    int height() const { return frames_[0].layers.height(); }
+    int count()  const { return (int)frames_.size(); }
+    int current() const { return current_; }
+
+    Frame&       frame(int i)       { return frames_[i]; }
+    const Frame& frame(int i) const { return frames_[i]; }
+    int indexOf(int id) const;
+    // Id the next new frame gets; restored with saved frame ids.
+    int  nextId() const { return nextId_; }
+    void setNextId(int id) { nextId_ = id; }
+
+    LayerStack&       layers()       { return frames_[current_].layers; }
+    const LayerStack& layers() const { return frames_[current_].layers; }
+
+    // Insert a frame after the current one, either a copy of it or a
+    // single white layer, make it current and return its index.
+    int  add(bool duplicate);
+    void remove(int index);
+    void move(int from, int to);
+    void select(int index);
+
+    // Route a history delta to its frame and layer, and make that frame
+    // current so the change is visible.
+    void applyDelta(const CanvasDelta& d, bool undo);
+
+    int  fps() const { return fps_; }
+    void setFps(int fps);
+    bool playing() const { return playing_; }
+    void play();
+    void stop() { playing_ = false; }
+
+    // Advance playback by `seconds`; returns true if the frame changed.
+    bool tick(double seconds);
+    // Seconds until tick() would change the frame; negative if it never will.
+    double untilTick() const;
+
+    // Bytes of layer pixels held by all frames, counting shared tiles once.
+    size_t memoryUsage() const;
+
+    static const int MAX_FPS = 60;
+
+private:
+    std::vector<Frame> frames_;
+    int    current_ = 0;
+    int    nextId_  = 0;
+    int    fps_     = 12;
+    bool   playing_ = false;
+    double clock_   = 0;
+};
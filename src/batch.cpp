@@ -0,0 +1,373 @@
+#include "canvas.h"
+#include "deflate.h"
+#include "filter.h"
+#include "imageio.h"
+#include "ops.h"
+#include "parallel.h"
+#include "quantize.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Script {
+    std::string name;
+    std::string text;
+    std::string output;
+    std::string errors;
+    int  images = 0;
+    bool ok = true;
+};
+
+bool keepGoing = false;
+
+bool parseInt(const std::string& s, int& v) {
+    char* end = nullptr;
+    long n = strtol(s.c_str(), &end, 10);
+    if (s.empty() || *end) return false;
+    v = (int)n;
+    return true;
+}
+
+// #RRGGBB or #RRGGBBAA (the '#' is optional).
+bool parseColor(const std::string& s, Color& c) {
+    std::string hex = (!s.empty() && s[0] == '#') ? s.substr(1) : s;
+    if (hex.size() != 6 && hex.size() != 8) return false;
+    char* end = nullptr;
+    unsigned long v = strtoul(hex.c_str(), &end, 16);
+    if (*end) return false;
+    if (hex.size() == 6) v = (v << 8) | 0xFF;
+    c = {(uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v};
+    return true;
+}
+
+// FNV-1a over the size and pixels, for regression checks.
+uint64_t canvasHash(const Canvas& canvas) {
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&](const uint8_t* p, size_t n) {
+        for (size_t i = 0; i < n; i++) { h ^= p[i]; h *= 1099511628211ull; }
+    };
+    int w = canvas.getWidth(), ht = canvas.getHeight();
+    mix((const uint8_t*)&w, sizeof(w));
+    mix((const uint8_t*)&ht, sizeof(ht));
+    std::vector<Color> row(w);
+    for (int y = 0; y < ht; y++) {
+        canvas.readRegion({0, y, w, 1}, row.data(), w);
+        mix((const uint8_t*)row.data(), row.size() * sizeof(Color));
+    }
+    return h;
+}
+
+bool runCommand(Canvas& canvas, const std::vector<std::string>& a, Script& s, std::string& err) {
+    const std::string& cmd = a[0];
+    auto need = [&](size_t n) {
+        if (a.size() >= n) return true;
+        err = "'" + cmd + "' needs " + std::to_string(n - 1) + " arguments";
+        return false;
+    };
+    auto ints = [&](size_t from, size_t count, int* out) {
+        for (size_t i = 0; i < count; i++) {
+            if (!parseInt(a[from + i], out[i])) {
+                err = "bad number '" + a[from + i] + "'";
+                return false;
+            }
+        }
+        return true;
+    };
+    auto color = [&](size_t i, Color& c) {
+        if (parseColor(a[i], c)) return true;
+        err = "bad colour '" + a[i] + "'";
+        return false;
+    };
+
+    DrawOp op;
+    int v[4];
+    if (cmd == "new") {
+        if (!need(3) || !ints(1, 2, v)) return false;
+        if (v[0] < 1 || v[1] < 1 || v[0] > Canvas::MAX_SIZE || v[1] > Canvas::MAX_SIZE) {
+            err = "canvas size out of range";
+            return false;
+        }
+        Color c(255, 255, 255, 255);
+        if (a.size() > 3 && !color(3, c)) return false;
+        canvas = Canvas(v[0], v[1]);
+        canvas.clear(c);
+        return true;
+    } else if (cmd == "load") {
+        if (!need(2)) return false;
+        Image img;
+        if (!loadImage(a[1], img)) { err = "cannot load '" + a[1] + "'"; return false; }
+        loadIntoCanvas(img, canvas);
+        return true;
+    } else if (cmd == "quantize") {
+        QuantizeOptions q;
+        if (!need(2) || !ints(1, 1, &q.colors)) return false;
+        if (q.colors < 2 || q.colors > 256) {
+            err = "colour count out of range";
+            return false;
+        }
+        for (size_t i = 2; i < a.size(); i++) {
+            if (a[i] == "ordered") {
+                q.dither = Dither::Ordered;
+            } else if (a[i] == "diffuse") {
+                q.dither = Dither::Diffusion;
+            } else {
+                err = "unknown quantize option '" + a[i] + "'";
+                return false;
+            }
+        }
+        quantize(canvas, q);
+        return true;
+    } else if (cmd == "filter") {
+        // Filters separated by "+" run as one chain.
+        std::vector<Filter> chain;
+        for (size_t i = 1; i < a.size(); i++) {
+            size_t end = i;
+            while (end < a.size() && a[end] != "+") end++;
+            const std::string& name = a[i];
+            size_t args = end - i - 1;
+            Filter f;
+            int p[3] = {0, 0, 0};
+            auto numbers = [&](size_t min, size_t max) {
+                if (args < min || args > max) {
+                    err = "wrong arguments for filter '" + name + "'";
+                    return false;
+                }
+                return ints(i + 1, args, p);
+            };
+            if (name == "hue") {
+                f.type = FilterType::HueSaturation;
+                if (!numbers(1, 3)) return false;
+            } else if (name == "brightness") {
+                f.type = FilterType::BrightnessContrast;
+                if (!numbers(1, 2)) return false;
+            } else if (name == "replace") {
+                f.type = FilterType::ReplaceColor;
+                if (args < 2 || args > 3) {
+                    err = "'replace' needs two colours and an optional tolerance";
+                    return false;
+                }
+                if (!color(i + 1, f.from) || !color(i + 2, f.to)) return false;
+                if (args > 2 && !ints(i + 3, 1, p)) return false;
+            } else if (name == "invert" || name == "grayscale" || name == "swaprb") {
+                f.type = FilterType::Channels;
+                if (!numbers(0, 0)) return false;
+                p[0] = (int)(name == "invert" ? ChannelOp::Invert
+                             : name == "grayscale" ? ChannelOp::Grayscale : ChannelOp::SwapRB);
+            } else if (name == "extract") {
+                f.type = FilterType::Channels;
+                p[0] = (int)ChannelOp::Extract;
+                static const std::string CHANNELS = "rgba";
+                if (args != 1 || a[i + 1].size() != 1 || CHANNELS.find(a[i + 1]) == std::string::npos) {
+                    err = "'extract' needs a channel (r, g, b or a)";
+                    return false;
+                }
+                p[1] = (int)CHANNELS.find(a[i + 1]);
+            } else if (name == "blur" || name == "gaussian") {
+                f.type = name == "blur" ? FilterType::BoxBlur : FilterType::GaussianBlur;
+                if (!numbers(1, 1)) return false;
+            } else if (name == "outline") {
+                f.type = FilterType::Outline;
+                p[0] = 1;
+                if (args < 1) {
+                    err = "'outline' needs a colour";
+                    return false;
+                }
+                if (!color(i + 1, f.to)) return false;
+                if (args > 3 || (args > 2 && a[i + 3] != "diagonal")) {
+                    err = "wrong arguments for filter 'outline'";
+                    return false;
+                }
+                if (args > 1 && !ints(i + 2, 1, p)) return false;
+                p[1] = args > 2;
+            } else {
+                err = "unknown filter '" + name + "'";
+                return false;
+            }
+            f.a = p[0];
+            f.b = p[1];
+            f.c = p[2];
+            if (!f.pointwise() && (f.a < 1 || f.a > MAX_FILTER_RADIUS)) {
+                err = "radius out of range";
+                return false;
+            }
+            chain.push_back(f);
+            i = end;
+        }
+        if (chain.empty()) return need(2);
+        applyFilters(canvas, chain);
+        return true;
+    } else if (cmd == "save") {
+        if (!need(2)) return false;
+        PNGOptions png;
+        for (size_t i = 2; i < a.size(); i++) {
+            if (a[i] == "level" && i + 1 < a.size()) {
+                if (!parseInt(a[++i], png.level) || png.level < 0 || png.level > Deflater::MAX_LEVEL) {
+                    err = "bad level '" + a[i] + "'";
+                    return false;
+                }
+            } else if (a[i] == "truecolor") {
+                png.palette = false;
+            } else {
+                err = "unknown save option '" + a[i] + "'";
+                return false;
+            }
+        }
+        if (!saveImage(canvas, a[1], png)) { err = "cannot save '" + a[1] + "'"; return false; }
+        s.images++;
+        return true;
+    } else if (cmd == "hash") {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%016llx\n", (unsigned long long)canvasHash(canvas));
+        s.output += buf;
+        return true;
+    } else if (cmd == "expect-hash") {
+        if (!need(2)) return false;
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)canvasHash(canvas));
+        if (a[1] != buf) { err = std::string("hash mismatch, got ") + buf; return false; }
+        return true;
+    } else if (cmd == "clear") {
+        op.type = OpType::Clear;
+        op.color = Color(255, 255, 255, 255);
+        if (a.size() > 1 && !color(1, op.color)) return false;
+    } else if (cmd == "pixel") {
+        op.type = OpType::Pixel;
+        if (!need(4) || !ints(1, 2, v) || !color(3, op.color)) return false;
+        op.x0 = v[0]; op.y0 = v[1];
+    } else if (cmd == "line" || cmd == "rect") {
+        op.type = cmd == "line" ? OpType::Line : OpType::Rect;
+        if (!need(6) || !ints(1, 4, v) || !color(5, op.color)) return false;
+        op.x0 = v[0]; op.y0 = v[1]; op.x1 = v[2]; op.y1 = v[3];
+    } else if (cmd == "circle") {
+        op.type = OpType::Circle;
+        if (!need(5) || !ints(1, 3, v) || !color(4, op.color)) return false;
+        op.x0 = v[0]; op.y0 = v[1]; op.x1 = v[2];
+    } else if (cmd == "fill") {
+        op.type = OpType::Fill;
+        if (!need(4) || !ints(1, 2, v) || !color(3, op.color)) return false;
+        op.x0 = v[0]; op.y0 = v[1];
+        for (size_t i = 4; i < a.size(); i++) {
+            if (a[i] == "diagonal") {
+                op.fill.diagonal = true;
+            } else if (a[i] == "parallel") {
+                op.fill.parallel = true;
+            } else if (a[i] == "tolerance" && i + 1 < a.size() && parseInt(a[i + 1], v[2])) {
+                op.fill.tolerance = v[2];
+                i++;
+            } else {
+                err = "unknown fill option '" + a[i] + "'";
+                return false;
+            }
+        }
+    } else {
+        err = "unknown command '" + cmd + "'";
+        return false;
+    }
+    applyOp(canvas, op);
+    return true;
+}
+
+void runScript(Script& s) {
+    Canvas canvas(32, 32);
+    std::istringstream in(s.text);
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        std::istringstream words(line);
+        std::vector<std::string> args;
+        for (std::string w; words >> w;) args.push_back(w);
+        if (args.empty() || args[0][0] == '#') continue;
+
+        std::string err;
+        if (!runCommand(canvas, args, s, err)) {
+            s.errors += s.name + ":" + std::to_string(lineNo) + ": " + err + "\n";
+            s.ok = false;
+            if (!keepGoing) return;
+        }
+    }
+}
+
+void usage() {
+    fprintf(stderr,
+        "Usage: TinyCanvasBatch [-j] [-k] [script ...]\n"
+        "Runs drawing scripts against a Canvas without opening a window.\n"
+        "Reads stdin when no script (or '-') is given.\n"
+        "  -j  run scripts in parallel\n"
+        "  -k  keep going after a failing command\n"
+        "\n"
+        "Commands (one per line, '#' starts a comment line):\n"
+        "  new W H [COLOR]          load PATH\n"
+        "  save PATH [level N] [truecolor]\n"
+        "  clear [COLOR]            pixel X Y COLOR\n"
+        "  line X0 Y0 X1 Y1 COLOR   rect X0 Y0 X1 Y1 COLOR\n"
+        "  circle CX CY R COLOR\n"
+        "  fill X Y COLOR [tolerance N] [diagonal] [parallel]\n"
+        "  quantize N [ordered|diffuse]\n"
+        "  filter F [+ F ...]       F is one of hue H [S [L]], brightness B [C],\n"
+        "    replace COLOR COLOR [TOL], invert, grayscale, extract r|g|b|a, swaprb,\n"
+        "    blur R, gaussian R, outline COLOR [W [diagonal]]\n"
+        "  hash                     expect-hash HEX\n"
+        "COLOR is #RRGGBB or #RRGGBBAA. PATH ending in .png or .bmp picks the format.\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool parallel = false;
+    std::vector<Script> scripts;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j")) { parallel = true; continue; }
+        if (!strcmp(argv[i], "-k")) { keepGoing = true; continue; }
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) { usage(); return 0; }
+
+        Script s;
+        s.name = argv[i];
+        if (s.name == "-") {
+            s.text.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        } else {
+            std::vector<uint8_t> data;
+            if (!readFile(s.name, data)) {
+                fprintf(stderr, "Cannot read script: %s\n", s.name.c_str());
+                return 1;
+            }
+            s.text.assign(data.begin(), data.end());
+        }
+        scripts.push_back(std::move(s));
+    }
+    if (scripts.empty()) {
+        Script s;
+        s.name = "-";
+        s.text.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        scripts.push_back(std::move(s));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (parallel) {
+        parallelFor((int)scripts.size(), [&](int i) { runScript(scripts[i]); });
+    } else {
+        for (auto& s : scripts) runScript(s);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int images = 0, failed = 0;
+    for (auto& s : scripts) {
+        fputs(s.output.c_str(), stdout);
+        fputs(s.errors.c_str(), stderr);
+        images += s.images;
+        failed += !s.ok;
+    }
+    fflush(stdout);
+    fprintf(stderr, "%d script(s), %d image(s) saved in %.3fs, %d failed\n",
+            (int)scripts.size(), images, secs, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,544 @@
+#include "animation.h"
+#include "canvas.h"
+#include "filter.h"
+#include "imageio.h"
+#include "kernels.h"
+#include "layers.h"
+#include "mip_pyramid.h"
+#include "parallel.h"
+#include "project.h"
+#include "quantize.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every heap allocation made by the process goes through here so each
+// benchmark can report how many it performs per operation.
+static std::atomic<size_t> allocCount{0};
+static std::atomic<size_t> allocBytes{0};
+
+#if defined(_MSC_VER)
+#define TC_NOINLINE __declspec(noinline)
+#else
+#define TC_NOINLINE __attribute__((noinline))
+#endif
+
+// Out of line so GCC cannot see free() in the operator delete below and
+// warn that it does not match the new expression the pointer came from.
+TC_NOINLINE static void release(void* p) { std::free(p); }
+
+void* operator new(size_t n) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(n, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile size_t sink;
+
+struct Result {
+    std::string name;
+    int    size;
+    long   iters;
+    double nsPerOp;
+    double pixelsPerSec;
+    double allocsPerOp;
+    double bytesPerOp;
+};
+
+class Runner {
+public:
+    std::string filter;
+    double minTime = 0.2;
+    std::vector<Result> results;
+
+    bool wants(const char* name) const {
+        return filter.empty() || strstr(name, filter.c_str());
+    }
+
+    // Time `op` in batches, doubling the batch until it runs for at least
+    // minTime seconds, and report the last batch. `pixels` is the work one
+    // call does, used for the throughput column.
+    template <class Fn>
+    void run(const char* name, int size, double pixels, Fn op) {
+        if (!wants(name)) return;
+        op();
+        long iters = 1;
+        for (;;) {
+            size_t a0 = allocCount.load(), b0 = allocBytes.load();
+            auto t0 = Clock::now();
+            for (long i = 0; i < iters; i++) op();
+            double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+            size_t allocs = allocCount.load() - a0, bytes = allocBytes.load() - b0;
+            if (secs >= minTime || iters >= (1L << 30)) {
+                results.push_back({name, size, iters, secs * 1e9 / iters,
+                                   pixels * iters / secs, (double)allocs / iters,
+                                   (double)bytes / iters});
+                return;
+            }
+            iters = secs > 0 ? std::max(iters * 2, (long)(iters * minTime * 1.2 / secs)) : iters * 2;
+        }
+    }
+};
+
+// A canvas whose tiles all hold distinct pixels, so nothing is uniform.
+Canvas noiseCanvas(int n) {
+    Canvas c(n, n);
+    std::vector<Color> row(n);
+    uint32_t seed = 12345;
+    for (int y = 0; y < n; y++) {
+        for (auto& p : row) {
+            seed = seed * 1664525u + 1013904223u;
+            p = {(uint8_t)(seed >> 24), (uint8_t)(seed >> 16), (uint8_t)(seed >> 8), 255};
+        }
+        c.writeRegion({0, y, n, 1}, row.data(), n);
+    }
+    c.clearDirty();
+    return c;
+}
+
+// Stand-in for Editor::renderCanvas without a GPU: dirty regions are
+// split into 256x256 chunks and copied through a staging buffer, the way
+// CanvasTexture uploads them, into a plain pixel array.
+class FrameSim {
+public:
+    static const int CHUNK = 256;
+
+    FrameSim(int w, int h) : w_(w), gpu_((size_t)w * h) {}
+
+    void frame(Canvas& canvas, const Rect& view) {
+        if (!canvas.isDirty()) return;
+        Rect dirty = canvas.dirtyRect().intersected(view);
+        canvas.clearDirty();
+        if (dirty.empty()) return;
+        for (int cy = dirty.y / CHUNK; cy <= (dirty.bottom() - 1) / CHUNK; cy++) {
+            for (int cx = dirty.x / CHUNK; cx <= (dirty.right() - 1) / CHUNK; cx++) {
+                Rect r = dirty.intersected({cx * CHUNK, cy * CHUNK, CHUNK, CHUNK});
+                staging_.resize((size_t)r.w * r.h);
+                canvas.readRegion(r, staging_.data(), r.w);
+                for (int y = 0; y < r.h; y++)
+                    memcpy(&gpu_[(size_t)(r.y + y) * w_ + r.x], &staging_[(size_t)y * r.w],
+                           r.w * sizeof(Color));
+            }
+        }
+    }
+
+    // Upload whatever tiles differ from the ones last uploaded, the way
+    // CanvasTexture follows a switch to another canvas.
+    void sync(const Canvas& canvas) {
+        uploaded_.resize((size_t)canvas.tilesX() * canvas.tilesY());
+        for (int ty = 0; ty < canvas.tilesY(); ty++) {
+            for (int tx = 0; tx < canvas.tilesX(); tx++) {
+                TileRef& old = uploaded_[ty * canvas.tilesX() + tx];
+                if (old == canvas.tileAt(tx, ty)) continue;
+                old = canvas.tileAt(tx, ty);
+                Rect r = canvas.tileRect(tx, ty);
+                staging_.resize((size_t)r.w * r.h);
+                canvas.readRegion(r, staging_.data(), r.w);
+                for (int y = 0; y < r.h; y++)
+                    memcpy(&gpu_[(size_t)(r.y + y) * w_ + r.x], &staging_[(size_t)y * r.w],
+                           r.w * sizeof(Color));
+            }
+        }
+    }
+
+private:
+    int w_;
+    std::vector<Color> gpu_;
+    std::vector<Color> staging_;
+    std::vector<TileRef> uploaded_;
+};
+
+void benchShapes(Runner& r, int n) {
+    r.run("linePoints", n, n, [&] {
+        sink = sink + Canvas::linePoints(0, 0, n - 1, n - 1).size();
+    });
+    r.run("rectPoints", n, 4.0 * n, [&] {
+        sink = sink + Canvas::rectPoints(0, 0, n - 1, n - 1).size();
+    });
+    r.run("circlePoints", n, 3.14 * n, [&] {
+        sink = sink + Canvas::circlePoints(n / 2, n / 2, n / 2 - 1).size();
+    });
+
+    Canvas c(n, n);
+    const Color colors[2] = {{255, 0, 0, 255}, {0, 0, 255, 255}};
+    int k = 0;
+    r.run("drawLine", n, n, [&] {
+        c.drawLine(0, 0, n - 1, n - 1, colors[k++ & 1]);
+    });
+    r.run("drawRect", n, 4.0 * n, [&] {
+        c.drawRect(0, 0, n - 1, n - 1, colors[k++ & 1]);
+    });
+    r.run("drawCircle", n, 3.14 * n, [&] {
+        c.drawCircle(n / 2, n / 2, n / 2 - 1, colors[k++ & 1]);
+    });
+}
+
+void benchFill(Runner& r, int n) {
+    const Color colors[2] = {{255, 0, 0, 255}, {0, 0, 255, 255}};
+    Canvas c(n, n);
+    int k = 0;
+    r.run("floodFill", n, (double)n * n, [&] {
+        c.floodFill(0, 0, colors[k++ & 1]);
+    });
+
+    // Concentric rings leave many separate spans per row.
+    Canvas rings(n, n);
+    for (int rad = 2; rad < n / 2; rad += 4) rings.drawCircle(n / 2, n / 2, rad, {0, 0, 0, 255});
+    FillOptions opts;
+    opts.parallel = true;
+    r.run("floodFill_rings", n, (double)n * n, [&] {
+        rings.floodFill(0, 0, colors[k++ & 1], opts);
+    });
+}
+
+void benchSnapshot(Runner& r, int n) {
+    if (!r.wants("snapshot") && !r.wants("restore") && !r.wants("resize")) return;
+    Canvas c = noiseCanvas(n);
+    CanvasSnapshot snap = c.snapshot();
+    r.run("snapshot", n, (double)n * n, [&] {
+        CanvasSnapshot s = c.snapshot();
+        sink = sink + s.tiles.size();
+    });
+    r.run("restore", n, (double)n * n, [&] {
+        c.setPixel(0, 0, {1, 2, 3, 255});
+        c.restore(snap);
+    });
+    int k = 0;
+    r.run("resize", n, (double)n * n, [&] {
+        int s = (k++ & 1) ? n : n + Canvas::TILE_SIZE / 2;
+        c.resize(s, s);
+    });
+}
+
+void benchBMP(Runner& r, int n) {
+    if (!r.wants("bmpSave") && !r.wants("bmpLoad")) return;
+    Canvas c = noiseCanvas(n);
+    std::vector<uint8_t> file;
+    r.run("bmpSave", n, (double)n * n, [&] {
+        encodeBMP(c, file);
+    });
+    encodeBMP(c, file);
+    Canvas dst;
+    Image img;
+    r.run("bmpLoad", n, (double)n * n, [&] {
+        decodeBMP(file.data(), file.size(), img);
+        loadIntoCanvas(img, dst);
+    });
+}
+
+// Noise is the worst case for the compressor; the 16-colour "art" canvas,
+// flat runs with a few shapes, is what the editor usually saves.
+void benchPNG(Runner& r, int n) {
+    if (n > 2048 || (!r.wants("pngSave") && !r.wants("pngSaveArt") && !r.wants("pngLoad"))) return;
+    Canvas c = noiseCanvas(n);
+    std::vector<uint8_t> file;
+    r.run("pngSave", n, (double)n * n, [&] {
+        encodePNG(c, file);
+    });
+
+    Canvas art(n, n);
+    for (int i = 0; i < 64; i++) {
+        Color col((uint8_t)(i % 15 * 17), (uint8_t)(255 - i % 15 * 17), (uint8_t)(i % 15 * 40), 255);
+        int x = (i * 37) % n, y = (i * 91) % n, s = n / 8;
+        for (int row = y; row < std::min(y + s, n); row++) art.fillSpan(x, std::min(x + s, n - 1), row, col);
+        art.drawCircle(x, y, n / 6 + 1, {0, 0, 0, 255});
+    }
+    r.run("pngSaveArt", n, (double)n * n, [&] {
+        encodePNG(art, file);
+    });
+
+    encodePNG(c, file);
+    Image img;
+    r.run("pngLoad", n, (double)n * n, [&] {
+        decodePNG(file.data(), file.size(), img);
+    });
+}
+
+void benchRender(Runner& r, int n) {
+    if (!r.wants("renderFull") && !r.wants("renderStroke")) return;
+    // A 1280x720 window at 1:1 zoom.
+    Rect view(0, 0, std::min(n, 1280), std::min(n, 720));
+    FrameSim sim(n, n);
+    Canvas c = noiseCanvas(n);
+    int k = 0;
+    r.run("renderFull", n, (double)view.w * view.h, [&] {
+        c.markDirty(c.bounds());
+        sim.frame(c, view);
+    });
+    r.run("renderStroke", n, 1, [&] {
+        int i = k++;
+        c.setPixel(i % view.w, (i / view.w) % view.h, {0, 0, 0, 255});
+        sim.frame(c, view);
+    });
+}
+
+// A 50-layer stack where every layer covers the canvas with translucent
+// detail, so no tile can be skipped.
+void benchLayers(Runner& r, int n) {
+    if (n > 1024 || (!r.wants("layerComposite") && !r.wants("layerStroke"))) return;
+    const int LAYERS = 50;
+    LayerStack stack(n, n);
+    for (int i = 1; i < LAYERS; i++) {
+        Canvas& c = stack.layer(stack.add(i)).canvas;
+        c.clear({(uint8_t)(i * 5), 80, (uint8_t)(255 - i * 5), 24});
+        for (int k = 0; k < 8; k++)
+            c.drawCircle((i * 37 + k * 11) % n, (i * 53 + k * 7) % n, n / 4, {255, 255, 0, 200});
+        if (i % 3 == 0) stack.setBlend(i, BlendMode::Multiply);
+    }
+    stack.composite();
+
+    r.run("layerComposite", n, (double)n * n * LAYERS, [&] {
+        stack.invalidate({0, 0, n, n});
+        stack.composite();
+    });
+    int k = 0;
+    r.run("layerStroke", n, 16.0 * LAYERS, [&] {
+        int x = k++ % (n - 16);
+        stack.layer(LAYERS / 2).canvas.drawLine(x, n / 2, x + 15, n / 2, {0, 0, 0, 255});
+        stack.composite();
+    });
+}
+
+// Playback of 200 frames duplicated from a detailed first frame, each with
+// a small sprite moved, so consecutive frames differ in a few tiles.
+void benchAnimation(Runner& r, int n) {
+    if (n > 1024 || !r.wants("animationPlay")) return;
+    const int FRAMES = 200;
+    Animation anim(n, n);
+    anim.layers().layer(0).canvas = noiseCanvas(n);
+    for (int i = 1; i < FRAMES; i++) {
+        anim.add(true);
+        anim.layers().layer(0).canvas.drawCircle((i * 5) % n, n / 2, std::max(1, n / 32),
+                                                 {0, 0, 0, 255});
+    }
+    for (int i = 0; i < FRAMES; i++) anim.frame(i).layers.composite();
+    FrameSim sim(n, n);
+    int k = 0;
+    r.run("animationPlay", n, (double)n * n, [&] {
+        anim.select(k++ % FRAMES);
+        sim.sync(anim.layers().composite());
+    });
+}
+
+// Opening only reads tile tables, so projectOpen should stay flat as the
+// canvas grows while projectSave scales with the pixels written.
+void benchProject(Runner& r, int n) {
+    if (!r.wants("projectSave") && !r.wants("projectOpen")) return;
+    const char* path = "tinycanvas_bench.tcp";
+    Animation anim(n, n);
+    anim.layers().layer(0).canvas = noiseCanvas(n);
+    ProjectInfo info;
+    r.run("projectSave", n, (double)n * n, [&] {
+        saveProject(anim, info, path);
+    });
+    saveProject(anim, info, path);
+    r.run("projectOpen", n, (double)n * n, [&] {
+        Animation opened(1, 1);
+        loadProject(path, opened, info);
+    });
+    remove(path);
+}
+
+// A smooth gradient with noise on top, so the colours spread the way a
+// photo's do.
+Canvas noisyGradient(int n) {
+    Canvas photo(n, n);
+    std::vector<Color> row(n);
+    uint32_t seed = 12345;
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            seed = seed * 1664525u + 1013904223u;
+            int noise = (seed >> 24) & 15;
+            row[x] = {(uint8_t)(x * 240 / n + noise), (uint8_t)(y * 240 / n + noise),
+                      (uint8_t)((x + y) * 120 / n + noise), 255};
+        }
+        photo.writeRegion({0, y, n, 1}, row.data(), n);
+    }
+    return photo;
+}
+
+// Reduced to a full palette.
+void benchQuantize(Runner& r, int n) {
+    if (!r.wants("quantize")) return;
+    Canvas photo = noisyGradient(n);
+    for (Dither d : {Dither::None, Dither::Ordered, Dither::Diffusion}) {
+        std::string name = std::string("quantize/") + ditherName(d);
+        QuantizeOptions opts;
+        opts.dither = d;
+        r.run(name.c_str(), n, (double)n * n, [&] {
+            Canvas c = photo;
+            quantize(c, opts);
+        });
+    }
+}
+
+// Per-pixel filters alone, a blur alone, and a chain sharing one pass.
+void benchFilters(Runner& r, int n) {
+    if (!r.wants("filter")) return;
+    Canvas photo = noisyGradient(n);
+    Filter hue, contrast, blur, invert;
+    hue.type = FilterType::HueSaturation;
+    hue.a = 30;
+    hue.b = 20;
+    contrast.a = 10;
+    contrast.b = 25;
+    blur.type = FilterType::GaussianBlur;
+    blur.a = 4;
+    invert.type = FilterType::Channels;
+    invert.a = (int)ChannelOp::Invert;
+    const std::pair<const char*, std::vector<Filter>> cases[] = {
+        {"filter/adjust", {hue, contrast}},
+        {"filter/blur", {blur}},
+        {"filter/chain", {contrast, blur, invert}},
+    };
+    for (auto& c : cases) {
+        r.run(c.first, n, (double)n * n, [&] {
+            Canvas canvas = photo;
+            applyFilters(canvas, c.second);
+        });
+    }
+}
+
+// Building every level a 1280x720 view could need from scratch, then
+// keeping them current after a short stroke, which should cost the same
+// at any canvas size.
+void benchPyramid(Runner& r, int n) {
+    if (!r.wants("mipBuild") && !r.wants("mipStroke")) return;
+    Canvas c = noiseCanvas(n);
+    int top = MipPyramid::levelFor(std::min(1280.0f / n, 720.0f / n));
+    if (top == 0) return;
+    r.run("mipBuild", n, (double)n * n, [&] {
+        MipPyramid p;
+        p.level(c, top);
+    });
+    MipPyramid p;
+    p.level(c, top);
+    int k = 0;
+    r.run("mipStroke", n, 16, [&] {
+        int i = k++, x = i % (n - 16);
+        c.drawLine(x, n / 2, x + 15, n / 2, {(uint8_t)i, 0, 0, 255});
+        p.level(c, top);
+    });
+}
+
+// Each pixel kernel under every implementation this CPU supports.
+void benchKernels(Runner& r, int n) {
+    size_t count = (size_t)n * n;
+    std::vector<Color> a(count, {200, 100, 50, 128}), b(count, {10, 20, 30, 255});
+    const char* initial = pixelKernels();
+    for (const char* impl : {"scalar", "sse2", "avx2"}) {
+        if (!usePixelKernels(impl)) continue;
+        std::string tag = std::string("/") + impl;
+        r.run(("fillPixels" + tag).c_str(), n, (double)count, [&] {
+            fillPixels(b.data(), count, {10, 20, 30, 255});
+        });
+        r.run(("pixelsEqual" + tag).c_str(), n, (double)count, [&] {
+            sink = sink + pixelsEqual(b.data(), count, {10, 20, 30, 255});
+        });
+        r.run(("swapRedBlue" + tag).c_str(), n, (double)count, [&] {
+            swapRedBlue(b.data(), a.data(), count);
+        });
+        r.run(("premultiply" + tag).c_str(), n, (double)count, [&] {
+            premultiply(b.data(), a.data(), count);
+        });
+        r.run(("unpremultiply" + tag).c_str(), n, (double)count, [&] {
+            unpremultiply(b.data(), a.data(), count);
+        });
+        r.run(("blendOver" + tag).c_str(), n, (double)count, [&] {
+            blendOver(b.data(), a.data(), count);
+        });
+    }
+    usePixelKernels(initial);
+}
+
+void usage() {
+    fprintf(stderr,
+        "Usage: TinyCanvasBench [--filter NAME] [--sizes N,N,...] [--min-time SECONDS]\n"
+        "                       [--csv | --json]\n"
+        "Default sizes are 16,64,256,1024,4096 (square canvases).\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Runner r;
+    std::vector<int> sizes = {16, 64, 256, 1024, 4096};
+    enum { TABLE, CSV, JSON } format = TABLE;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--filter" && hasValue) {
+            r.filter = argv[++i];
+        } else if (a == "--min-time" && hasValue) {
+            r.minTime = atof(argv[++i]);
+        } else if (a == "--sizes" && hasValue) {
+            sizes.clear();
+            for (char* s = strtok(argv[++i], ","); s; s = strtok(nullptr, ","))
+                if (atoi(s) > 0) sizes.push_back(std::min(atoi(s), (int)Canvas::MAX_SIZE));
+        } else if (a == "--csv") {
+            format = CSV;
+        } else if (a == "--json") {
+            format = JSON;
+        } else {
+            usage();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    for (int n : sizes) {
+        benchShapes(r, n);
+        benchFill(r, n);
+        benchSnapshot(r, n);
+        benchBMP(r, n);
+        benchPNG(r, n);
+        benchRender(r, n);
+        benchLayers(r, n);
+        benchAnimation(r, n);
+        benchProject(r, n);
+        benchQuantize(r, n);
+        benchFilters(r, n);
+        benchPyramid(r, n);
+        benchKernels(r, n);
+        if (format == TABLE) fprintf(stderr, "  %dx%d done\n", n, n);
+    }
+
+    if (format == CSV) {
+        printf("name,size,iterations,ns_per_op,pixels_per_s,allocs_per_op,bytes_per_op\n");
+        for (auto& x : r.results)
+            printf("%s,%d,%ld,%.1f,%.0f,%.2f,%.0f\n", x.name.c_str(), x.size, x.iters,
+                   x.nsPerOp, x.pixelsPerSec, x.allocsPerOp, x.bytesPerOp);
+    } else if (format == JSON) {
+        printf("{\n  \"workers\": %d,\n  \"benchmarks\": [\n", workerCount());
+        for (size_t i = 0; i < r.results.size(); i++) {
+            auto& x = r.results[i];
+            printf("    {\"name\": \"%s\", \"size\": %d, \"iterations\": %ld, \"ns_per_op\": %.1f, "
+                   "\"pixels_per_s\": %.0f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.0f}%s\n",
+                   x.name.c_str(), x.size, x.iters, x.nsPerOp, x.pixelsPerSec, x.allocsPerOp,
+                   x.bytesPerOp, i + 1 < r.results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    } else {
+        printf("%-20s %6s %14s %14s %12s %14s\n", "benchmark", "size", "ns/op", "Mpixels/s",
+               "allocs/op", "bytes/op");
+        for (auto& x : r.results)
+            printf("%-20s %6d %14.1f %14.2f %12.2f %14.0f\n", x.name.c_str(), x.size, x.nsPerOp,
+                   x.pixelsPerSec / 1e6, x.allocsPerOp, x.bytesPerOp);
+    }
+    return 0;
+}
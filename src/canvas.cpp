@@ -1,144 +1,531 @@
 #include "canvas.h"
+#include "kernels.h"
 #include <algorithm>
 #include <cmath>
-#include <queue>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+
+const Color BLANK(255, 255, 255, 255);
+
+int tileCount(int pixels) {
+    return (pixels + Canvas::TILE_SIZE - 1) / Canvas::TILE_SIZE;
+}
+
+const size_t TILE_PIXELS = Canvas::TILE_SIZE * Canvas::TILE_SIZE;
+
+bool indicesEqual(const uint8_t* p, size_t n, uint8_t i) {
+    return std::find_if(p, p + n, [i](uint8_t v) { return v != i; }) == p + n;
+}
+
+// Both tiles belong to canvases of the same mode, `indexed` or not.
+bool sameContent(const Tile& a, const Tile& b, bool indexed) {
+    const Tile& u = a.uniform() ? a : b;
+    const Tile& m = a.uniform() ? b : a;
+    if (indexed) {
+        if (a.uniform() && b.uniform()) return a.index == b.index;
+        if (!a.uniform() && !b.uniform()) return a.idx == b.idx;
+        return indicesEqual(m.idx.data(), m.idx.size(), u.index);
+    }
+    if (a.uniform() && b.uniform()) return a.fill == b.fill;
+    if (!a.uniform() && !b.uniform()) return a.px == b.px;
+    return pixelsEqual(m.px.data(), m.px.size(), u.fill);
+}
+
+size_t tileBytes(const TileRef& t) {
+    return t ? t->px.size() * sizeof(Color) + t->idx.size() : 0;
+}
+
+size_t paletteBytes(const PaletteRef& p) {
+    return p ? sizeof(Palette) + p->size() * sizeof(Color) : 0;
+}
+
+} // namespace
+
+size_t CanvasDelta::bytes() const {
+    size_t n = sizeof(CanvasDelta);
+    if (oldPalette != newPalette) n += paletteBytes(oldPalette) + paletteBytes(newPalette);
+    for (auto& p : before) n += sizeof(TilePatch) + sizeof(Tile) + tileBytes(p.tile);
+    for (auto& p : after)  n += sizeof(TilePatch) + sizeof(Tile) + tileBytes(p.tile);
+    return n;
+}
 
 Canvas::Canvas(int width, int height)
-    : width_(width), height_(height), pixels_(width * height, Color(255, 255, 255, 255)) {}
+    : width_(width), height_(height),
+      tilesX_(tileCount(width)), tilesY_(tileCount(height)),
+      tiles_(tilesX_ * tilesY_, std::make_shared<Tile>(BLANK)),
+      dirty_(0, 0, width, height) {}
 
 bool Canvas::inBounds(int x, int y) const {
     return x >= 0 && x < width_ && y >= 0 && y < height_;
 }
 
+Rect Canvas::tileRect(int tx, int ty) const {
+    return Rect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE).intersected(bounds());
+}
+
+void Canvas::setTile(int tx, int ty, TileRef tile) {
+    tiles_[ty * tilesX_ + tx] = std::move(tile);
+    markDirty(tileRect(tx, ty));
+}
+
+Tile& Canvas::mutableTile(int tx, int ty) {
+    TileRef& ref = tiles_[ty * tilesX_ + tx];
+    if (ref.use_count() > 1)
+        ref = std::make_shared<Tile>(*ref);
+    // Every tile is allocated non-const; only unshared ones get here.
+    Tile& t = const_cast<Tile&>(*ref);
+    if (palette_) {
+        if (t.uniform())
+            t.idx.assign(TILE_PIXELS, t.index);
+        else
+            t.idx.detach();
+    } else {
+        if (t.uniform())
+            t.px.assign(TILE_PIXELS, t.fill);
+        else
+            t.px.detach();
+    }
+    return t;
+}
+
+uint8_t Canvas::ink(const Color& c) {
+    if (!palette_) return 0;
+    const Palette& p = *palette_;
+    for (size_t i = 0; i < p.size(); i++)
+        if (p[i] == c) return (uint8_t)i;
+    if (p.size() < 256) {
+        auto grown = std::make_shared<Palette>(p);
+        grown->push_back(c);
+        palette_ = std::move(grown);
+        return (uint8_t)(palette_->size() - 1);
+    }
+    int best = 0, bestDist = 1 << 30;
+    for (size_t i = 0; i < p.size(); i++) {
+        int dr = p[i].r - c.r, dg = p[i].g - c.g, db = p[i].b - c.b, da = p[i].a - c.a;
+        int d = dr * dr + dg * dg + db * db + da * da;
+        if (d < bestDist) {
+            bestDist = d;
+            best = (int)i;
+        }
+    }
+    return (uint8_t)best;
+}
+
+TileRef Canvas::uniformTile(const Color& c, uint8_t i) const {
+    return palette_ ? std::make_shared<Tile>(i) : std::make_shared<Tile>(c);
+}
+
 Color Canvas::getPixel(int x, int y) const {
     if (!inBounds(x, y)) return {0, 0, 0, 0};
-    return pixels_[y * width_ + x];
+    return at(x, y);
+}
+
+uint8_t Canvas::getIndex(int x, int y) const {
+    if (!palette_ || !inBounds(x, y)) return 0;
+    return indexAt(x, y);
 }
 
 void Canvas::setPixel(int x, int y, const Color& c) {
-    if (inBounds(x, y))
-        pixels_[y * width_ + x] = c;
+    if (!inBounds(x, y)) return;
+    uint8_t i = ink(c);
+    if (palette_ ? indexAt(x, y) == i : at(x, y) == c) return;
+    plot(x, y, c, i);
+    markDirty({x, y, 1, 1});
+}
+
+void Canvas::writeSpan(int x0, int x1, int y, const Color& c, uint8_t i) {
+    const TileRef* row = &tiles_[(y >> TILE_SHIFT) * tilesX_];
+    for (int x = x0; x <= x1;) {
+        int end = std::min(x1 + 1, ((x >> TILE_SHIFT) + 1) << TILE_SHIFT);
+        const Tile& t = *row[x >> TILE_SHIFT];
+        if (palette_) {
+            if (!(t.uniform() && t.index == i)) memset(mutableIndex(x, y), i, end - x);
+        } else if (!(t.uniform() && t.fill == c)) {
+            fillPixels(mutablePixel(x, y), end - x, c);
+        }
+        x = end;
+    }
+}
+
+void Canvas::clippedSpan(int x0, int x1, int y, const Color& c, uint8_t i) {
+    if (y < 0 || y >= height_) return;
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, width_ - 1);
+    if (x0 <= x1) writeSpan(x0, x1, y, c, i);
+}
+
+void Canvas::fillSpan(int x0, int x1, int y, const Color& c) {
+    if (x0 > x1) std::swap(x0, x1);
+    clippedSpan(x0, x1, y, c, ink(c));
+    markDirty({x0, y, x1 - x0 + 1, 1});
 }
 
 void Canvas::clear(const Color& c) {
-    std::fill(pixels_.begin(), pixels_.end(), c);
+    tiles_.assign(tiles_.size(), uniformTile(c, ink(c)));
+    markDirty(bounds());
+}
+
+bool Canvas::toIndexed() {
+    if (palette_) return true;
+    auto palette = std::make_shared<Palette>();
+    // Open addressing from colour to entry, a quarter full at most.
+    const uint32_t SLOTS = 1024;
+    int16_t slot[SLOTS];
+    std::fill(slot, slot + SLOTS, -1);
+    auto lookup = [&](const Color& c, uint8_t& i) {
+        uint32_t key;
+        memcpy(&key, &c, sizeof(key));
+        uint32_t h = (key * 2654435761u) >> 22;
+        for (; slot[h] >= 0; h = (h + 1) & (SLOTS - 1)) {
+            if ((*palette)[slot[h]] == c) {
+                i = (uint8_t)slot[h];
+                return true;
+            }
+        }
+        if (palette->size() == 256) return false;
+        slot[h] = (int16_t)palette->size();
+        palette->push_back(c);
+        i = (uint8_t)(palette->size() - 1);
+        return true;
+    };
+
+    std::vector<TileRef> tiles(tiles_.size());
+    TileRef uniform[256];
+    for (int ty = 0; ty < tilesY_; ty++) {
+        for (int tx = 0; tx < tilesX_; tx++) {
+            const Tile& t = *tileAt(tx, ty);
+            TileRef& out = tiles[ty * tilesX_ + tx];
+            uint8_t i = 0;
+            if (t.uniform()) {
+                if (!lookup(t.fill, i)) return false;
+                if (!uniform[i]) uniform[i] = std::make_shared<Tile>(i);
+                out = uniform[i];
+                continue;
+            }
+            // Only pixels inside the canvas count towards the palette.
+            auto tile = std::make_shared<Tile>((uint8_t)0);
+            tile->idx.assign(TILE_PIXELS, 0);
+            Rect r = tileRect(tx, ty);
+            Color last = t.px[offset(r.x, r.y)];
+            if (!lookup(last, i)) return false;
+            for (int y = r.y; y < r.bottom(); y++) {
+                for (int x = r.x; x < r.right(); x++) {
+                    const Color& c = t.px[offset(x, y)];
+                    if (c != last) {
+                        if (!lookup(c, i)) return false;
+                        last = c;
+                    }
+                    tile->idx[offset(x, y)] = i;
+                }
+            }
+            out = tile;
+        }
+    }
+    tiles_   = std::move(tiles);
+    palette_ = std::move(palette);
+    markDirty(bounds());
+    return true;
+}
+
+void Canvas::toIndexed(PaletteRef palette, const uint8_t* indices, int stride) {
+    TileRef uniform[256];
+    for (int ty = 0; ty < tilesY_; ty++) {
+        for (int tx = 0; tx < tilesX_; tx++) {
+            Rect r = tileRect(tx, ty);
+            const uint8_t* src = indices + (size_t)r.y * stride + r.x;
+            uint8_t first = src[0];
+            bool same = true;
+            for (int y = 0; same && y < r.h; y++) same = indicesEqual(src + (size_t)y * stride, r.w, first);
+            TileRef& out = tiles_[ty * tilesX_ + tx];
+            if (same) {
+                if (!uniform[first]) uniform[first] = std::make_shared<Tile>(first);
+                out = uniform[first];
+                continue;
+            }
+            auto tile = std::make_shared<Tile>((uint8_t)0);
+            tile->idx.assign(TILE_PIXELS, first);
+            for (int y = 0; y < r.h; y++)
+                memcpy(&tile->idx[offset(r.x, r.y + y)], src + (size_t)y * stride, r.w);
+            out = tile;
+        }
+    }
+    palette_ = std::move(palette);
+    markDirty(bounds());
 }
 
-std::vector<Color> Canvas::snapshot() const {
-    return pixels_;
+void Canvas::toRGBA() {
+    if (!palette_) return;
+    const Palette& pal = *palette_;
+    TileRef uniform[256];
+    for (TileRef& ref : tiles_) {
+        const Tile& t = *ref;
+        if (t.uniform()) {
+            if (!uniform[t.index]) uniform[t.index] = std::make_shared<Tile>(pal[t.index]);
+            ref = uniform[t.index];
+            continue;
+        }
+        auto tile = std::make_shared<Tile>(pal[t.idx[0]]);
+        tile->px.assign(TILE_PIXELS, Color());
+        for (size_t i = 0; i < TILE_PIXELS; i++) tile->px[i] = pal[t.idx[i]];
+        ref = tile;
+    }
+    palette_.reset();
+    markDirty(bounds());
+}
+
+void Canvas::setPalette(PaletteRef palette) {
+    if (!palette_ || !palette || palette->size() < palette_->size()) return;
+    palette_ = std::move(palette);
+    markDirty(bounds());
 }
 
-void Canvas::restore(const std::vector<Color>& snap) {
-    if ((int)snap.size() == width_ * height_)
-        pixels_ = snap;
+CanvasSnapshot Canvas::snapshot() const {
+    return {width_, height_, tiles_, palette_};
 }
 
-void Canvas::resize(int newW, int newH) {
-    std::vector<Color> newPixels(newW * newH, Color(255, 255, 255, 255));
-    int copyW = std::min(width_, newW);
-    int copyH = std::min(height_, newH);
-    for (int y = 0; y < copyH; y++)
-        for (int x = 0; x < copyW; x++)
-            newPixels[y * newW + x] = pixels_[y * width_ + x];
+void Canvas::restore(const CanvasSnapshot& snap) {
+    width_   = snap.width;
+    height_  = snap.height;
+    tilesX_  = tileCount(width_);
+    tilesY_  = tileCount(height_);
+    tiles_   = snap.tiles;
+    palette_ = snap.palette;
+    dirty_   = bounds();
+}
+
+void Canvas::resize(int newW, int newH, const Color& fill) {
+    int oldW = width_, oldH = height_;
+    int oldTX = tilesX_, oldTY = tilesY_;
+    int newTX = tileCount(newW), newTY = tileCount(newH);
+
+    uint8_t i = ink(fill);
+    TileRef blank = uniformTile(fill, i);
+    std::vector<TileRef> tiles(newTX * newTY, blank);
+    for (int ty = 0; ty < std::min(oldTY, newTY); ty++)
+        for (int tx = 0; tx < std::min(oldTX, newTX); tx++)
+            tiles[ty * newTX + tx] = tiles_[ty * oldTX + tx];
+
     width_  = newW;
     height_ = newH;
-    pixels_ = std::move(newPixels);
+    tilesX_ = newTX;
+    tilesY_ = newTY;
+    tiles_  = std::move(tiles);
+    dirty_  = bounds();
+
+    // Old edge tiles may now expose pixels that used to lie outside the canvas.
+    Rect kept(0, 0, oldW, oldH);
+    for (int ty = 0; ty < std::min(oldTY, newTY); ty++) {
+        for (int tx = 0; tx < std::min(oldTX, newTX); tx++) {
+            if (tx != oldTX - 1 && ty != oldTY - 1) continue;
+            Rect r = tileRect(tx, ty);
+            if (kept.intersected(r) == r) continue;
+            const Tile& t = *tileAt(tx, ty);
+            if (t.uniform() && (palette_ ? t.index == i : t.fill == fill)) continue;
+            for (int y = r.y; y < r.bottom(); y++)
+                for (int x = r.x; x < r.right(); x++)
+                    if (!kept.contains(x, y)) plot(x, y, fill, i);
+        }
+    }
+}
+
+void Canvas::readRegion(const Rect& r, Color* dst, int stride) const {
+    Rect c = r.intersected(bounds());
+    for (int y = c.y; y < c.bottom(); y++) {
+        Color* out = dst + (y - r.y) * stride + (c.x - r.x);
+        const TileRef* row = &tiles_[(y >> TILE_SHIFT) * tilesX_];
+        for (int x = c.x; x < c.right();) {
+            int end = std::min(c.right(), ((x >> TILE_SHIFT) + 1) << TILE_SHIFT);
+            const Tile& t = *row[x >> TILE_SHIFT];
+            if (t.uniform()) {
+                fillPixels(out, end - x, uniformColor(t));
+            } else if (palette_) {
+                const Color* pal = palette_->data();
+                const uint8_t* src = &t.idx[offset(x, y)];
+                for (int i = 0; i < end - x; i++) out[i] = pal[src[i]];
+            } else {
+                copyPixels(out, &t.px[offset(x, y)], end - x);
+            }
+            out += end - x;
+            x = end;
+        }
+    }
+}
+
+void Canvas::readIndices(const Rect& r, uint8_t* dst, int stride) const {
+    if (!palette_) return;
+    Rect c = r.intersected(bounds());
+    for (int y = c.y; y < c.bottom(); y++) {
+        uint8_t* out = dst + (y - r.y) * stride + (c.x - r.x);
+        const TileRef* row = &tiles_[(y >> TILE_SHIFT) * tilesX_];
+        for (int x = c.x; x < c.right();) {
+            int end = std::min(c.right(), ((x >> TILE_SHIFT) + 1) << TILE_SHIFT);
+            const Tile& t = *row[x >> TILE_SHIFT];
+            if (t.uniform())
+                memset(out, t.index, end - x);
+            else
+                memcpy(out, &t.idx[offset(x, y)], end - x);
+            out += end - x;
+            x = end;
+        }
+    }
+}
+
+void Canvas::writeRegion(const Rect& r, const Color* src, int stride) {
+    Rect c = r.intersected(bounds());
+    Color last;
+    uint8_t i = 0;
+    if (palette_ && !c.empty()) i = ink(last = src[(c.y - r.y) * stride + (c.x - r.x)]);
+    for (int y = c.y; y < c.bottom(); y++) {
+        const Color* in = src + (y - r.y) * stride + (c.x - r.x);
+        for (int x = c.x; x < c.right();) {
+            int end = std::min(c.right(), ((x >> TILE_SHIFT) + 1) << TILE_SHIFT);
+            if (palette_) {
+                uint8_t* out = mutableIndex(x, y);
+                for (int k = 0; k < end - x; k++) {
+                    if (in[k] != last) i = ink(last = in[k]);
+                    out[k] = i;
+                }
+            } else {
+                copyPixels(mutablePixel(x, y), in, end - x);
+            }
+            in += end - x;
+            x = end;
+        }
+    }
+    markDirty(c);
+}
+
+void Canvas::compact(const Rect& r) {
+    Rect c = r.intersected(bounds());
+    if (c.empty()) return;
+    for (int ty = c.y >> TILE_SHIFT; ty <= (c.bottom() - 1) >> TILE_SHIFT; ty++) {
+        for (int tx = c.x >> TILE_SHIFT; tx <= (c.right() - 1) >> TILE_SHIFT; tx++) {
+            TileRef& ref = tiles_[ty * tilesX_ + tx];
+            if (ref->uniform()) continue;
+            if (palette_) {
+                const uint8_t first = ref->idx[0];
+                if (indicesEqual(ref->idx.data(), ref->idx.size(), first))
+                    ref = std::make_shared<Tile>(first);
+                continue;
+            }
+            const Color first = ref->px[0];
+            if (pixelsEqual(ref->px.data(), ref->px.size(), first))
+                ref = std::make_shared<Tile>(first);
+        }
+    }
+}
+
+size_t Canvas::memoryUsage() const {
+    size_t n = tiles_.size() * sizeof(TileRef) + paletteBytes(palette_);
+    std::unordered_set<const Tile*> seen;
+    for (auto& t : tiles_)
+        if (seen.insert(t.get()).second)
+            n += sizeof(Tile) + tileBytes(t);
+    return n;
+}
+
+void Canvas::beginCapture() {
+    captureBase_ = tiles_;
+    captureW_ = width_;
+    captureH_ = height_;
+    capturePalette_ = palette_;
+    capturing_ = true;
+}
+
+CanvasDelta Canvas::endCapture() {
+    CanvasDelta d;
+    d.oldW = captureW_;
+    d.oldH = captureH_;
+    d.newW = width_;
+    d.newH = height_;
+    d.oldPalette = capturePalette_;
+    d.newPalette = palette_;
+
+    if (width_ != captureW_ || height_ != captureH_ || !capturePalette_ != !palette_) {
+        // Different geometry or mode: record both tile grids in full.
+        int oldTX = tileCount(captureW_);
+        for (size_t i = 0; i < captureBase_.size(); i++)
+            d.before.push_back({(int)i % oldTX, (int)i / oldTX, captureBase_[i]});
+        for (size_t i = 0; i < tiles_.size(); i++)
+            d.after.push_back({(int)i % tilesX_, (int)i / tilesX_, tiles_[i]});
+    } else {
+        for (size_t i = 0; i < tiles_.size(); i++) {
+            const TileRef& was = captureBase_[i];
+            const TileRef& now = tiles_[i];
+            if (was == now || sameContent(*was, *now, palette_ != nullptr)) continue;
+            int tx = (int)i % tilesX_, ty = (int)i / tilesX_;
+            d.before.push_back({tx, ty, was});
+            d.after.push_back({tx, ty, now});
+        }
+    }
+
+    captureBase_.clear();
+    capturePalette_.reset();
+    capturing_ = false;
+    return d;
+}
+
+void Canvas::applyDelta(const CanvasDelta& d, bool undo) {
+    int w = undo ? d.oldW : d.newW;
+    int h = undo ? d.oldH : d.newH;
+    if (w != width_ || h != height_) {
+        // A size change always comes with every tile of the target geometry.
+        width_  = w;
+        height_ = h;
+        tilesX_ = tileCount(w);
+        tilesY_ = tileCount(h);
+        tiles_.assign(tilesX_ * tilesY_, std::make_shared<Tile>(BLANK));
+        dirty_ = bounds();
+    }
+    const PaletteRef& palette = undo ? d.oldPalette : d.newPalette;
+    if (palette != palette_) {
+        palette_ = palette;
+        markDirty(bounds());
+    }
+    for (auto& p : undo ? d.before : d.after) {
+        if (p.tx >= tilesX_ || p.ty >= tilesY_) continue;
+        tiles_[p.ty * tilesX_ + p.tx] = p.tile;
+        markDirty(tileRect(p.tx, p.ty));
+    }
 }
 
 std::vector<Point> Canvas::linePoints(int x0, int y0, int x1, int y1) {
     std::vector<Point> pts;
-    int dx = std::abs(x1 - x0), dy = std::abs(y1 - y0);
-    int sx = x0 < x1 ? 1 : -1;
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx - dy;
-    while (true) {
-        pts.push_back({x0, y0});
-        if (x0 == x1 && y0 == y1) break;
-        int e2 = 2 * err;
-        if (e2 > -dy) { err -= dy; x0 += sx; }
-        if (e2 <  dx) { err += dx; y0 += sy; }
-    }
+    visitLine(x0, y0, x1, y1, [&](int x, int y) { pts.push_back({x, y}); });
     return pts;
 }
 
 void Canvas::drawLine(int x0, int y0, int x1, int y1, const Color& c) {
-    for (auto& p : linePoints(x0, y0, x1, y1))
-        setPixel(p.x, p.y, c);
+    uint8_t i = ink(c);
+    visitLine(x0, y0, x1, y1, [&](int x, int y) { plot(x, y, c, i); });
+    markDirty(Rect::fromCorners(x0, y0, x1, y1));
 }
 
 std::vector<Point> Canvas::rectPoints(int x0, int y0, int x1, int y1) {
     std::vector<Point> pts;
-    if (x0 > x1) std::swap(x0, x1);
-    if (y0 > y1) std::swap(y0, y1);
-    for (int x = x0; x <= x1; x++) {
-        pts.push_back({x, y0});
-        pts.push_back({x, y1});
-    }
-    for (int y = y0 + 1; y < y1; y++) {
-        pts.push_back({x0, y});
-        pts.push_back({x1, y});
-    }
+    visitRectSpans(x0, y0, x1, y1, [&](int sx0, int sx1, int y) {
+        for (int x = sx0; x <= sx1; x++) pts.push_back({x, y});
+    });
     return pts;
 }
 
 void Canvas::drawRect(int x0, int y0, int x1, int y1, const Color& c) {
-    for (auto& p : rectPoints(x0, y0, x1, y1))
-        setPixel(p.x, p.y, c);
+    uint8_t i = ink(c);
+    visitRectSpans(x0, y0, x1, y1, [&](int sx0, int sx1, int y) { clippedSpan(sx0, sx1, y, c, i); });
+    markDirty(Rect::fromCorners(x0, y0, x1, y1));
 }
 
 std::vector<Point> Canvas::circlePoints(int cx, int cy, int radius) {
     std::vector<Point> pts;
-    if (radius <= 0) {
-        pts.push_back({cx, cy});
-        return pts;
-    }
-    int x = radius, y = 0;
-    int err = 1 - radius;
-    while (x >= y) {
-        pts.push_back({cx + x, cy + y});
-        pts.push_back({cx - x, cy + y});
-        pts.push_back({cx + x, cy - y});
-        pts.push_back({cx - x, cy - y});
-        pts.push_back({cx + y, cy + x});
-        pts.push_back({cx - y, cy + x});
-        pts.push_back({cx + y, cy - x});
-        pts.push_back({cx - y, cy - x});
-        y++;
-        if (err < 0) {
-            err += 2 * y + 1;
-        } else {
-            x--;
-            err += 2 * (y - x) + 1;
-        }
-    }
+    visitCircle(cx, cy, radius, [&](int x, int y) { pts.push_back({x, y}); });
     return pts;
 }
 
 void Canvas::drawCircle(int cx, int cy, int radius, const Color& c) {
-    for (auto& p : circlePoints(cx, cy, radius))
-        setPixel(p.x, p.y, c);
-}
-
-void Canvas::floodFill(int x, int y, const Color& newColor) {
-    if (!inBounds(x, y)) return;
-    Color target = getPixel(x, y);
-    if (target == newColor) return;
-
-    std::queue<Point> q;
-    q.push({x, y});
-    setPixel(x, y, newColor);
-
-    const int dx[] = {0, 0, 1, -1};
-    const int dy[] = {1, -1, 0, 0};
-
-    while (!q.empty()) {
-        Point p = q.front(); q.pop();
-        for (int i = 0; i < 4; i++) {
-            int nx = p.x + dx[i], ny = p.y + dy[i];
-            if (inBounds(nx, ny) && getPixel(nx, ny) == target) {
-                setPixel(nx, ny, newColor);
-                q.push({nx, ny});
-            }
-        }
-    }
+    uint8_t i = ink(c);
+    visitCircle(cx, cy, radius, [&](int x, int y) { plot(x, y, c, i); });
+    int r = std::max(radius, 0);
+    markDirty({cx - r, cy - r, 2 * r + 1, 2 * r + 1});
 }
@@ -1,7 +1,133 @@
 #pragma once
 #include "types.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
 #include <vector>
 
+// Pixels of a tile, either owned or borrowed read-only from a mapped
+// project file (see project.h) that `source` keeps alive. Only owned
+// pixels may be written; Canvas detaches borrowed ones before writing.
+template <class T>
+class TileBuffer {
+public:
+    TileBuffer() = default;
+    TileBuffer(const T* mapped, size_t n, std::shared_ptr<const void> source)
+        : data_(const_cast<T*>(mapped)), size_(n), source_(std::move(source)) {}
+    TileBuffer(const TileBuffer& o) { *this = o; }
+    TileBuffer& operator=(const TileBuffer& o) {
+        if (this == &o) return *this;
+        own_    = o.own_;
+        source_ = o.source_;
+        size_   = o.size_;
+        data_   = source_ ? o.data_ : own_.data();
+        return *this;
+    }
+
+    bool   empty() const { return size_ == 0; }
+    size_t size()  const { return size_; }
+    bool   borrowed() const { return source_ != nullptr; }
+
+    const T* data() const { return data_; }
+    T*       data()       { return data_; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    T&       operator[](size_t i)       { return data_[i]; }
+
+    void assign(size_t n, const T& c) {
+        own_.assign(n, c);
+        own();
+    }
+    // Copy borrowed pixels into owned storage.
+    void detach() {
+        if (!source_) return;
+        own_.assign(data_, data_ + size_);
+        own();
+    }
+
+    bool operator==(const TileBuffer& o) const {
+        return size_ == o.size_ && std::equal(data_, data_ + size_, o.data_);
+    }
+
+private:
+    std::vector<T> own_;
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    std::shared_ptr<const void> source_;
+
+    void own() {
+        source_.reset();
+        data_ = own_.data();
+        size_ = own_.size();
+    }
+};
+
+using TilePixels  = TileBuffer<Color>;
+using TileIndices = TileBuffer<uint8_t>;
+
+// Colours of an indexed canvas. Shared between canvases, snapshots and
+// history entries like tiles, and replaced rather than modified.
+using Palette    = std::vector<Color>;
+using PaletteRef = std::shared_ptr<const Palette>;
+
+// A TILE_SIZE x TILE_SIZE block of pixels. Tiles are shared between canvases,
+// snapshots and history entries and are copied on the first write to a
+// shared one. A tile with no pixel storage is uniformly `fill`. Tiles of an
+// indexed canvas store palette indices in `idx` instead, and `index` when
+// uniform; their `fill` is not used.
+struct Tile {
+    Color fill;
+    TilePixels px;
+    uint8_t index = 0;
+    TileIndices idx;
+
+    explicit Tile(const Color& c = Color(255, 255, 255, 255)) : fill(c) {}
+    explicit Tile(uint8_t i) : index(i) {}
+    bool uniform() const { return px.empty() && idx.empty(); }
+};
+
+using TileRef = std::shared_ptr<const Tile>;
+
+struct TilePatch {
+    int tx, ty;
+    TileRef tile;
+};
+
+// The tiles an edit replaced, before and after, plus the canvas size and
+// palette on either side so resizes, loads and palette edits can be
+// reverted as well.
+struct CanvasDelta {
+    int  frame  = 0;     // id of the animation frame it belongs to
+    int  layer  = 0;     // id of the layer it belongs to, in a LayerStack
+    bool joined = false; // undone and redone together with the previous delta
+    int oldW = 0, oldH = 0;
+    int newW = 0, newH = 0;
+    PaletteRef oldPalette, newPalette; // null for RGBA
+    std::vector<TilePatch> before;
+    std::vector<TilePatch> after;
+
+    bool   empty() const {
+        return before.empty() && after.empty() && oldW == newW && oldH == newH &&
+               oldPalette == newPalette;
+    }
+    size_t bytes() const;
+};
+
+struct FillOptions {
+    int  tolerance = 0;     // max per-channel difference from the seed colour
+                            // (on an indexed canvas, between palette entries)
+    bool diagonal  = false; // 8-connected instead of 4-connected
+    bool parallel  = false; // label and paint big regions of big canvases in parallel bands
+};
+
+// Immutable view of a canvas at one point in time. Taking one only copies
+// the tile table; the pixels stay shared until either side is written.
+struct CanvasSnapshot {
+    int width = 0, height = 0;
+    std::vector<TileRef> tiles;
+    PaletteRef palette;
+};
+
 class Canvas {
 public:
     Canvas(int width = 32, int height = 32);
@@ -12,26 +138,197 @@ public:
     Color getPixel(int x, int y) const;
     void  setPixel(int x, int y, const Color& c);
     bool  inBounds(int x, int y) const;
+    Rect  bounds() const { return {0, 0, width_, height_}; }
 
     void drawLine(int x0, int y0, int x1, int y1, const Color& c);
     void drawRect(int x0, int y0, int x1, int y1, const Color& c);
     void drawCircle(int cx, int cy, int radius, const Color& c);
-    void floodFill(int x, int y, const Color& newColor);
+    void floodFill(int x, int y, const Color& newColor, const FillOptions& opts = FillOptions());
+    void fillSpan(int x0, int x1, int y, const Color& c);
 
     void clear(const Color& c = {255, 255, 255, 255});
 
-    std::vector<Color> snapshot() const;
-    void restore(const std::vector<Color>& snap);
+    // Indexed mode stores each pixel as an 8-bit index into palette(), a
+    // quarter of the memory of RGBA. Colours drawn are looked up in the
+    // palette, added to it while it has room, or else replaced by the
+    // nearest entry.
+    bool indexed() const { return palette_ != nullptr; }
+    const PaletteRef& palette() const { return palette_; }
+    // Switch to indexed mode with the canvas colours as the palette, in the
+    // order they are met. False, leaving the canvas as it was, if there
+    // are more than 256.
+    bool toIndexed();
+    // Switch to indexed mode with `palette`, each pixel taking its index
+    // from `indices` (row-major, `stride` apart), all of them in range.
+    void toIndexed(PaletteRef palette, const uint8_t* indices, int stride);
+    void toRGBA();
+    // Replace the palette of an indexed canvas. Pixels keep their indices,
+    // so each takes on its entry's new colour; only the palette is copied.
+    // `palette` must have at least as many entries as the current one.
+    void setPalette(PaletteRef palette);
+    uint8_t getIndex(int x, int y) const;
+    // Palette indices of a region, as readRegion(); indexed canvases only.
+    void readIndices(const Rect& r, uint8_t* dst, int stride) const;
+    // The colour a uniform tile of this canvas shows.
+    const Color& uniformColor(const Tile& t) const { return palette_ ? (*palette_)[t.index] : t.fill; }
+
+    CanvasSnapshot snapshot() const;
+    void restore(const CanvasSnapshot& snap);
+
+    // Grown areas are set to `fill`.
+    void resize(int newW, int newH, const Color& fill = {255, 255, 255, 255});
+
+    // Copy a region out of / into the canvas; `stride` is in pixels.
+    // The region is clipped to the canvas bounds.
+    void readRegion(const Rect& r, Color* dst, int stride) const;
+    void writeRegion(const Rect& r, const Color* src, int stride);
+
+    // Bounding box of every pixel changed since the last clearDirty().
+    // A fresh, cleared, restored or resized canvas is dirty everywhere.
+    const Rect& dirtyRect() const { return dirty_; }
+    bool isDirty() const { return !dirty_.empty(); }
+    void markDirty(const Rect& r) { dirty_ = dirty_.united(r.intersected(bounds())); }
+    void clearDirty() { dirty_ = {}; }
+
+    // While capturing, the tile table at beginCapture() is kept alive so
+    // endCapture() can report which tiles were replaced by copy-on-write.
+    void beginCapture();
+    CanvasDelta endCapture();
+    bool capturing() const { return capturing_; }
+    void applyDelta(const CanvasDelta& d, bool undo);
 
-    void resize(int newW, int newH);
+    // Collapse tiles in `r` whose pixels are all one colour.
+    void compact(const Rect& r);
 
-    const std::vector<Color>& pixels() const { return pixels_; }
+    // Bytes of pixel storage referenced by this canvas (shared tiles counted once).
+    size_t memoryUsage() const;
+
+    static const int MAX_SIZE = 16384;
+    static const int PARALLEL_FILL_MIN_AREA   = 1 << 20; // canvas pixels
+    static const int PARALLEL_FILL_MIN_PIXELS = 1 << 16; // filled before labelling takes over
+
+    static const int TILE_SHIFT = 6;
+    static const int TILE_SIZE  = 1 << TILE_SHIFT;
+    static const int TILE_MASK  = TILE_SIZE - 1;
+
+    int  tilesX() const { return tilesX_; }
+    int  tilesY() const { return tilesY_; }
+    Rect tileRect(int tx, int ty) const;
+    const TileRef& tileAt(int tx, int ty) const { return tiles_[ty * tilesX_ + tx]; }
+    // Put in a tile built elsewhere, of the same kind (RGBA or indexed).
+    void setTile(int tx, int ty, TileRef tile);
+
+    // Walk a shape outline without allocating. Lines and circles call
+    // fn(x, y) for each point; rectangles call fn(x0, x1, y) for each
+    // horizontal run. Points are not clipped to any canvas.
+    template <class Fn> static void visitLine(int x0, int y0, int x1, int y1, Fn&& fn);
+    template <class Fn> static void visitRectSpans(int x0, int y0, int x1, int y1, Fn&& fn);
+    template <class Fn> static void visitCircle(int cx, int cy, int radius, Fn&& fn);
 
     static std::vector<Point> linePoints(int x0, int y0, int x1, int y1);
     static std::vector<Point> rectPoints(int x0, int y0, int x1, int y1);
     static std::vector<Point> circlePoints(int cx, int cy, int radius);
 
 private:
+    friend class FloodFill;
+
     int width_, height_;
-    std::vector<Color> pixels_;
+    int tilesX_, tilesY_;
+    std::vector<TileRef> tiles_;
+    PaletteRef palette_;
+    Rect dirty_;
+
+    bool capturing_ = false;
+    int  captureW_ = 0, captureH_ = 0;
+    std::vector<TileRef> captureBase_;
+    PaletteRef capturePalette_;
+
+    const Tile& tileOf(int x, int y) const {
+        return *tiles_[(y >> TILE_SHIFT) * tilesX_ + (x >> TILE_SHIFT)];
+    }
+    static int offset(int x, int y) { return ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK); }
+    uint8_t indexAt(int x, int y) const {
+        const Tile& t = tileOf(x, y);
+        return t.uniform() ? t.index : t.idx[offset(x, y)];
+    }
+    const Color& at(int x, int y) const {
+        if (palette_) return (*palette_)[indexAt(x, y)];
+        const Tile& t = tileOf(x, y);
+        return t.uniform() ? t.fill : t.px[offset(x, y)];
+    }
+    // Palette entry to draw `c` with on an indexed canvas, added if there
+    // is room; 0 otherwise. The drawing helpers below take both.
+    uint8_t ink(const Color& c);
+    TileRef uniformTile(const Color& c, uint8_t i) const;
+    void writeSpan(int x0, int x1, int y, const Color& c, uint8_t i);
+    void clippedSpan(int x0, int x1, int y, const Color& c, uint8_t i);
+    void plot(int x, int y, const Color& c, uint8_t i) {
+        if (x < 0 || y < 0 || x >= width_ || y >= height_) return;
+        if (palette_) {
+            if (indexAt(x, y) != i) *mutableIndex(x, y) = i;
+        } else if (at(x, y) != c) {
+            *mutablePixel(x, y) = c;
+        }
+    }
+    Tile& mutableTile(int tx, int ty);
+    Color* mutablePixel(int x, int y) {
+        return &mutableTile(x >> TILE_SHIFT, y >> TILE_SHIFT).px[offset(x, y)];
+    }
+    uint8_t* mutableIndex(int x, int y) {
+        return &mutableTile(x >> TILE_SHIFT, y >> TILE_SHIFT).idx[offset(x, y)];
+    }
 };
+
+template <class Fn>
+void Canvas::visitLine(int x0, int y0, int x1, int y1, Fn&& fn) {
+    int dx = x1 > x0 ? x1 - x0 : x0 - x1, dy = y1 > y0 ? y1 - y0 : y0 - y1;
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx - dy;
+    while (true) {
+        fn(x0, y0);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 > -dy) { err -= dy; x0 += sx; }
+        if (e2 <  dx) { err += dx; y0 += sy; }
+    }
+}
+
+template <class Fn>
+void Canvas::visitRectSpans(int x0, int y0, int x1, int y1, Fn&& fn) {
+    if (x0 > x1) std::swap(x0, x1);
+    if (y0 > y1) std::swap(y0, y1);
+    fn(x0, x1, y0);
+    for (int y = y0 + 1; y < y1; y++) {
+        fn(x0, x0, y);
+        if (x1 != x0) fn(x1, x1, y);
+    }
+    if (y1 != y0) fn(x0, x1, y1);
+}
+
+template <class Fn>
+void Canvas::visitCircle(int cx, int cy, int radius, Fn&& fn) {
+    if (radius <= 0) {
+        fn(cx, cy);
+        return;
+    }
+    int x = radius, y = 0;
+    int err = 1 - radius;
+    while (x >= y) {
+        fn(cx + x, cy + y);
+        fn(cx - x, cy + y);
+        fn(cx + x, cy - y);
+        fn(cx - x, cy - y);
+        fn(cx + y, cy + x);
+        fn(cx - y, cy + x);
+        fn(cx + y, cy - x);
+        fn(cx - y, cy - x);
+        y++;
+        if (err < 0) {
+            err += 2 * y + 1;
+        } else {
+            x--;
+            err += 2 * (y - x) + 1;
+        }
+    }
+}
@@ -0,0 +1,180 @@
+#include "canvas_texture.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+CanvasTexture::~CanvasTexture() {
+    release();
+}
+
+void CanvasTexture::init(SDL_Renderer* renderer) {
+    release();
+    renderer_ = renderer;
+
+    // The checkerboard is the same for every chunk because chunk origins
+    // are even, so one chunk-sized texture serves the whole canvas.
+    checker_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_RGBA32,
+                                 SDL_TEXTUREACCESS_STATIC, CHUNK_SIZE, CHUNK_SIZE);
+    if (!checker_) {
+        fprintf(stderr, "Checker texture creation failed: %s\n", SDL_GetError());
+        return;
+    }
+    std::vector<Color> px(CHUNK_SIZE * CHUNK_SIZE);
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            uint8_t v = ((x + y) % 2 == 0) ? 200 : 240;
+            px[y * CHUNK_SIZE + x] = {v, v, v, 255};
+        }
+    }
+    SDL_UpdateTexture(checker_, nullptr, px.data(), CHUNK_SIZE * (int)sizeof(Color));
+    SDL_SetTextureBlendMode(checker_, SDL_BLENDMODE_NONE);
+}
+
+void CanvasTexture::release() {
+    for (auto& c : chunks_)
+        if (c.tex) SDL_DestroyTexture(c.tex);
+    chunks_.clear();
+    uploaded_.clear();
+    palette_.reset();
+    if (checker_) SDL_DestroyTexture(checker_);
+    checker_ = nullptr;
+    width_ = height_ = chunksX_ = chunksY_ = tilesX_ = tilesY_ = live_ = 0;
+}
+
+void CanvasTexture::reset(int w, int h) {
+    for (auto& c : chunks_)
+        if (c.tex) SDL_DestroyTexture(c.tex);
+    width_   = w;
+    height_  = h;
+    chunksX_ = (w + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    chunksY_ = (h + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    chunks_.assign(chunksX_ * chunksY_, Chunk());
+    tilesX_  = (w + Canvas::TILE_SIZE - 1) >> Canvas::TILE_SHIFT;
+    tilesY_  = (h + Canvas::TILE_SIZE - 1) >> Canvas::TILE_SHIFT;
+    uploaded_.assign((size_t)tilesX_ * tilesY_, nullptr);
+    live_ = 0;
+}
+
+// Mark the tiles of a chunk that are no longer the ones last uploaded.
+void CanvasTexture::sync(const Canvas& canvas, int cx, int cy) {
+    Chunk& ch = chunks_[cy * chunksX_ + cx];
+    if (!ch.tex) return;
+    int tx1 = std::min(tilesX_, (cx + 1) * CHUNK_TILES);
+    int ty1 = std::min(tilesY_, (cy + 1) * CHUNK_TILES);
+    for (int ty = cy * CHUNK_TILES; ty < ty1; ty++) {
+        for (int tx = cx * CHUNK_TILES; tx < tx1; tx++) {
+            const TileRef& cur = canvas.tileAt(tx, ty);
+            const TileRef& old = uploaded_[ty * tilesX_ + tx];
+            if (cur == old || (old && cur->uniform() && old->uniform() &&
+                               canvas.uniformColor(*cur) == canvas.uniformColor(*old)))
+                continue;
+            Rect local(tx * Canvas::TILE_SIZE - cx * CHUNK_SIZE, ty * Canvas::TILE_SIZE - cy * CHUNK_SIZE,
+                       Canvas::TILE_SIZE, Canvas::TILE_SIZE);
+            ch.stale = ch.stale.united(local);
+        }
+    }
+}
+
+void CanvasTexture::invalidate(const Rect& r) {
+    Rect c = r.intersected({0, 0, width_, height_});
+    if (c.empty()) return;
+    for (int cy = c.y / CHUNK_SIZE; cy <= (c.bottom() - 1) / CHUNK_SIZE; cy++) {
+        for (int cx = c.x / CHUNK_SIZE; cx <= (c.right() - 1) / CHUNK_SIZE; cx++) {
+            Chunk& ch = chunks_[cy * chunksX_ + cx];
+            if (!ch.tex) continue;
+            Rect local(c.x - cx * CHUNK_SIZE, c.y - cy * CHUNK_SIZE, c.w, c.h);
+            ch.stale = ch.stale.united(local.intersected({0, 0, CHUNK_SIZE, CHUNK_SIZE}));
+        }
+    }
+}
+
+bool CanvasTexture::prepare(const Canvas& canvas, int cx, int cy) {
+    Chunk& ch = chunks_[cy * chunksX_ + cx];
+    if (!ch.tex) {
+        ch.tex = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_RGBA32,
+                                   SDL_TEXTUREACCESS_STREAMING, CHUNK_SIZE, CHUNK_SIZE);
+        if (!ch.tex) return false;
+        SDL_SetTextureBlendMode(ch.tex, SDL_BLENDMODE_BLEND);
+        ch.stale = {0, 0, CHUNK_SIZE, CHUNK_SIZE};
+        live_++;
+    }
+    ch.lastUsed = frame_;
+
+    Rect area(cx * CHUNK_SIZE, cy * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE);
+    Rect r = Rect(area.x + ch.stale.x, area.y + ch.stale.y, ch.stale.w, ch.stale.h)
+                 .intersected(canvas.bounds());
+    if (!r.empty()) {
+        staging_.resize((size_t)r.w * r.h);
+        canvas.readRegion(r, staging_.data(), r.w);
+        SDL_Rect dst = {r.x - area.x, r.y - area.y, r.w, r.h};
+        SDL_UpdateTexture(ch.tex, &dst, staging_.data(), r.w * (int)sizeof(Color));
+    }
+    ch.stale = {};
+
+    for (int ty = cy * CHUNK_TILES; ty < std::min(tilesY_, (cy + 1) * CHUNK_TILES); ty++)
+        for (int tx = cx * CHUNK_TILES; tx < std::min(tilesX_, (cx + 1) * CHUNK_TILES); tx++)
+            uploaded_[ty * tilesX_ + tx] = canvas.tileAt(tx, ty);
+    return true;
+}
+
+void CanvasTexture::evict() {
+    while (live_ > MAX_CHUNKS) {
+        Chunk* oldest = nullptr;
+        for (auto& c : chunks_)
+            if (c.tex && c.lastUsed != frame_ && (!oldest || c.lastUsed < oldest->lastUsed))
+                oldest = &c;
+        if (!oldest) return;
+        SDL_DestroyTexture(oldest->tex);
+        *oldest = Chunk();
+        live_--;
+
+        // Drop the tile references too, so their memory can be reclaimed.
+        int idx = (int)(oldest - chunks_.data());
+        int cx = idx % chunksX_, cy = idx / chunksX_;
+        for (int ty = cy * CHUNK_TILES; ty < std::min(tilesY_, (cy + 1) * CHUNK_TILES); ty++)
+            for (int tx = cx * CHUNK_TILES; tx < std::min(tilesX_, (cx + 1) * CHUNK_TILES); tx++)
+                uploaded_[ty * tilesX_ + tx] = nullptr;
+    }
+}
+
+void CanvasTexture::draw(const Canvas& canvas, float ox, float oy, float zoom, const SDL_Rect& clip,
+                         uint8_t alpha) {
+    if (!renderer_) return;
+    if (canvas.getWidth() != width_ || canvas.getHeight() != height_)
+        reset(canvas.getWidth(), canvas.getHeight());
+    // The same index tiles show other colours under another palette.
+    if (canvas.palette() != palette_) {
+        std::fill(uploaded_.begin(), uploaded_.end(), nullptr);
+        palette_ = canvas.palette();
+    }
+    frame_++;
+
+    // Canvas pixel range covered by the clip rectangle.
+    int x0 = std::max(0, (int)std::floor((clip.x - ox) / zoom));
+    int y0 = std::max(0, (int)std::floor((clip.y - oy) / zoom));
+    int x1 = std::min(width_,  (int)std::ceil((clip.x + clip.w - ox) / zoom));
+    int y1 = std::min(height_, (int)std::ceil((clip.y + clip.h - oy) / zoom));
+    if (x0 >= x1 || y0 >= y1) return;
+
+    SDL_RenderSetClipRect(renderer_, &clip);
+    for (int cy = y0 / CHUNK_SIZE; cy <= (y1 - 1) / CHUNK_SIZE; cy++) {
+        for (int cx = x0 / CHUNK_SIZE; cx <= (x1 - 1) / CHUNK_SIZE; cx++) {
+            sync(canvas, cx, cy);
+            if (!prepare(canvas, cx, cy)) continue;
+            Rect area = Rect(cx * CHUNK_SIZE, cy * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE)
+                            .intersected(canvas.bounds());
+            int sx  = (int)(ox + area.x * zoom);
+            int sy  = (int)(oy + area.y * zoom);
+            int sx1 = (int)(ox + area.right() * zoom);
+            int sy1 = (int)(oy + area.bottom() * zoom);
+            SDL_Rect src = {0, 0, area.w, area.h};
+            SDL_Rect dst = {sx, sy, sx1 - sx, sy1 - sy};
+            SDL_Texture* tex = chunks_[cy * chunksX_ + cx].tex;
+            if (checker_ && alpha == 255) SDL_RenderCopy(renderer_, checker_, &src, &dst);
+            SDL_SetTextureAlphaMod(tex, alpha);
+            SDL_RenderCopy(renderer_, tex, &src, &dst);
+        }
+    }
+    SDL_RenderSetClipRect(renderer_, nullptr);
+    evict();
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "canvas.h"
+#include <SDL2/SDL.h>
+#include <vector>
+
+// Mirrors a Canvas into a grid of CHUNK_SIZE x CHUNK_SIZE streaming textures.
+// Chunks are created and uploaded only once they scroll into view, and the
+// least recently drawn ones are released when more than MAX_CHUNKS are alive.
+// The texture keeps a reference to every tile it uploaded; since shared
+// tiles are never written in place, a tile that is still the same object
+// needs no upload, unless the canvas is indexed and its palette was
+// replaced. Switching between canvases that share tiles (animation
+// frames, say) therefore only uploads the tiles that really differ. This keeps
+// both upload and draw cost proportional to the visible area, so canvases
+// far larger than the renderer's maximum texture size can be displayed.
+class CanvasTexture {
+public:
+    CanvasTexture() = default;
+    ~CanvasTexture();
+    CanvasTexture(const CanvasTexture&) = delete;
+    CanvasTexture& operator=(const CanvasTexture&) = delete;
+
+    void init(SDL_Renderer* renderer);
+    void release();
+
+    // Force a canvas region to be uploaded again.
+    void invalidate(const Rect& r);
+
+    // Draw the part of `canvas` that falls inside `clip`, with the canvas
+    // origin at (ox, oy) and `zoom` screen pixels per canvas pixel. Below
+    // full `alpha` the canvas is drawn translucent without the checkerboard.
+    void draw(const Canvas& canvas, float ox, float oy, float zoom, const SDL_Rect& clip,
+              uint8_t alpha = 255);
+
+    static const int CHUNK_SIZE  = 256;
+    static const int CHUNK_TILES = CHUNK_SIZE / Canvas::TILE_SIZE;
+    static const int MAX_CHUNKS  = 256;
+
+private:
+    struct Chunk {
+        SDL_Texture* tex = nullptr;
+        Rect   stale;
+        Uint32 lastUsed = 0;
+    };
+
+    SDL_Renderer* renderer_ = nullptr;
+    SDL_Texture*  checker_  = nullptr;
+    int width_ = 0, height_ = 0;
+    int chunksX_ = 0, chunksY_ = 0;
+    int tilesX_ = 0, tilesY_ = 0;
+    int live_ = 0;
+    Uint32 frame_ = 0;
+    std::vector<Chunk> chunks_;
+    std::vector<Color> staging_;
+    std::vector<TileRef> uploaded_;
+    PaletteRef palette_; // of the canvas the uploaded tiles came from
+
+    void reset(int w, int h);
+    void sync(const Canvas& canvas, int cx, int cy);
+    bool prepare(const Canvas& canvas, int cx, int cy);
+    void evict();
+};
@@ -0,0 +1,709 @@
+#include "deflate.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const int WSIZE     = 1 << 15;
+const int WMASK     = WSIZE - 1;
+const int HASH_BITS = 15;
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+const int BLOCK     = 1 << 16; // input bytes per block
+const int TOO_FAR   = 4096;    // a 3-byte match further back than this costs more than literals
+
+const uint16_t LEN_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                               31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LEN_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                               2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DIST_BASE[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const uint8_t CL_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// The same trade-offs zlib makes per level. Levels 1-3 take the first
+// match found and only hash the positions inside matches up to `lazy`
+// long; the others look one byte ahead for a longer match unless the
+// current one reaches `lazy`, searching less hard once it reaches `good`.
+struct LevelConfig {
+    int good, lazy, nice, chain;
+};
+
+const LevelConfig LEVELS[10] = {
+    {0, 0, 0, 0},      {4, 4, 8, 4},       {4, 5, 16, 8},      {4, 6, 32, 32},
+    {4, 4, 16, 16},    {8, 16, 32, 32},    {8, 16, 128, 128},  {8, 32, 128, 256},
+    {32, 128, 258, 1024}, {32, 258, 258, 4096},
+};
+
+struct Tables {
+    uint32_t crc[4][256];   // slicing-by-4: crc[k] advances a byte k positions further
+    uint8_t  lenCode[256];  // match length - 3 -> length code
+    uint8_t  distCode[512]; // see distCodeOf
+    uint8_t  fixedLit[288];
+    uint8_t  fixedDist[30];
+
+    Tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc[0][i] = c;
+        }
+        for (int k = 1; k < 4; k++)
+            for (int i = 0; i < 256; i++) crc[k][i] = crc[0][crc[k - 1][i] & 0xFF] ^ (crc[k - 1][i] >> 8);
+        for (int code = 0; code < 29; code++)
+            for (int len = LEN_BASE[code]; len < (code == 28 ? 259 : LEN_BASE[code + 1]); len++)
+                lenCode[len - 3] = (uint8_t)code;
+        for (int code = 0; code < 30; code++) {
+            for (int d = DIST_BASE[code]; d < DIST_BASE[code] + (1 << DIST_EXTRA[code]); d++) {
+                if (d <= 256) distCode[d - 1] = (uint8_t)code;
+                else distCode[256 + ((d - 1) >> 7)] = (uint8_t)code;
+            }
+        }
+        for (int i = 0; i < 288; i++) fixedLit[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        for (int i = 0; i < 30; i++) fixedDist[i] = 5;
+    }
+};
+
+const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+inline int distCodeOf(const Tables& t, int dist) {
+    return dist <= 256 ? t.distCode[dist - 1] : t.distCode[256 + ((dist - 1) >> 7)];
+}
+
+inline uint32_t hash3(const uint8_t* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+inline uint32_t reverseBits(uint32_t code, int len) {
+    uint32_t r = 0;
+    for (int i = 0; i < len; i++, code >>= 1) r = (r << 1) | (code & 1);
+    return r;
+}
+
+// Huffman code lengths for `freq`, no longer than `maxBits`. Unused
+// symbols get length 0; at least two symbols get a code so the code is
+// complete.
+void buildLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lens) {
+    memset(lens, 0, n);
+    std::vector<std::pair<uint32_t, int>> leaves;
+    for (int i = 0; i < n; i++)
+        if (freq[i]) leaves.push_back({freq[i], i});
+    if (leaves.size() < 2) {
+        int used = leaves.empty() ? 0 : leaves[0].second;
+        lens[used] = 1;
+        lens[used == 0 ? 1 : 0] = 1;
+        return;
+    }
+    std::sort(leaves.begin(), leaves.end());
+
+    // Leaves are sorted and merged nodes come out in order, so two queues
+    // stand in for a heap.
+    size_t nl = leaves.size();
+    std::vector<uint64_t> weight(2 * nl);
+    std::vector<size_t>   parent(2 * nl);
+    for (size_t i = 0; i < nl; i++) weight[i] = leaves[i].first;
+    size_t li = 0, ni = nl, next = nl;
+    auto pick = [&]() {
+        if (li < nl && (ni >= next || weight[li] <= weight[ni])) return li++;
+        return ni++;
+    };
+    for (size_t k = 0; k + 1 < nl; k++) {
+        size_t a = pick(), b = pick();
+        weight[next] = weight[a] + weight[b];
+        parent[a] = parent[b] = next;
+        next++;
+    }
+    std::vector<int> depth(next, 0);
+    for (size_t i = next - 1; i-- > 0;) depth[i] = depth[parent[i]] + 1;
+
+    // Fold over-long codes back to maxBits and rebalance the Kraft sum.
+    std::vector<int> count(std::max<size_t>(nl, maxBits + 1), 0);
+    for (size_t i = 0; i < nl; i++) count[std::min(depth[i], maxBits)]++;
+    uint32_t total = 0;
+    for (int i = 1; i <= maxBits; i++) total += (uint32_t)count[i] << (maxBits - i);
+    while (total > (1u << maxBits)) {
+        count[maxBits]--;
+        for (int i = maxBits - 1; i > 0; i--) {
+            if (count[i]) {
+                count[i]--;
+                count[i + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // Least frequent symbols get the longest codes.
+    size_t idx = 0;
+    for (int len = maxBits; len > 0; len--)
+        for (int k = 0; k < count[len]; k++) lens[leaves[idx++].second] = (uint8_t)len;
+}
+
+void canonicalCodes(const uint8_t* lens, int n, uint16_t* codes) {
+    int count[16] = {0}, next[16] = {0};
+    for (int i = 0; i < n; i++) count[lens[i]]++;
+    count[0] = 0;
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (int i = 0; i < n; i++)
+        codes[i] = lens[i] ? (uint16_t)reverseBits(next[lens[i]]++, lens[i]) : 0;
+}
+
+} // namespace
+
+uint32_t crc32(uint32_t crc, const uint8_t* p, size_t n) {
+    const Tables& t = tables();
+    crc = ~crc;
+    for (; n >= 4; n -= 4, p += 4) {
+        crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        crc = t.crc[3][crc & 0xFF] ^ t.crc[2][(crc >> 8) & 0xFF] ^ t.crc[1][(crc >> 16) & 0xFF] ^
+              t.crc[0][crc >> 24];
+    }
+    for (; n; n--, p++) crc = t.crc[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t adler32(uint32_t adler, const uint8_t* p, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n) {
+        // 5552 bytes is the most that can be summed before b overflows.
+        size_t k = std::min<size_t>(n, 5552);
+        n -= k;
+        for (size_t i = 0; i < k; i++) {
+            a += p[i];
+            b += a;
+        }
+        p += k;
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+Deflater::Deflater(std::vector<uint8_t>& out, int level)
+    : out_(out), level_(std::max(0, std::min(level, (int)MAX_LEVEL))) {
+    good_  = LEVELS[level_].good;
+    lazy_  = LEVELS[level_].lazy;
+    nice_  = LEVELS[level_].nice;
+    chain_ = LEVELS[level_].chain;
+    if (level_ > 0) {
+        head_.assign(1 << HASH_BITS, 0);
+        prev_.assign(WSIZE, 0);
+    }
+    // CMF: deflate with a 32K window; FLG: level hint, header checksum.
+    uint8_t flevel = level_ <= 1 ? 0 : level_ <= 5 ? 1 : level_ == 6 ? 2 : 3;
+    uint16_t header = 0x7800 | (flevel << 6);
+    header += 31 - header % 31;
+    out_.push_back(header >> 8);
+    out_.push_back(header & 0xFF);
+}
+
+void Deflater::write(const uint8_t* data, size_t n) {
+    if (finished_ || !n) return;
+    adler_ = adler32(adler_, data, n);
+    // Take big writes a block at a time so the buffer stays small.
+    while (n) {
+        size_t k = std::min<size_t>(n, BLOCK);
+        buf_.insert(buf_.end(), data, data + k);
+        data += k;
+        n -= k;
+        while (base_ + buf_.size() - pos_ >= (size_t)BLOCK + MAX_MATCH)
+            compressBlock(pos_ + BLOCK, false);
+    }
+}
+
+void Deflater::finish() {
+    if (finished_) return;
+    compressBlock(base_ + (uint32_t)buf_.size(), true);
+    alignByte();
+    for (int i = 3; i >= 0; i--) out_.push_back((adler_ >> (i * 8)) & 0xFF);
+    finished_ = true;
+    buf_.clear();
+    buf_.shrink_to_fit();
+}
+
+// Add position `p` to its hash chain; returns the previous chain head.
+uint32_t Deflater::insert(uint32_t p) {
+    size_t r = p - base_;
+    if (r + MIN_MATCH > buf_.size()) return 0;
+    uint32_t& h = head_[hash3(&buf_[r])];
+    if (h == p + 1) return prev_[p & WMASK]; // already inserted by the previous block
+    uint32_t old = h;
+    prev_[p & WMASK] = old;
+    h = p + 1;
+    return old;
+}
+
+Deflater::Match Deflater::findMatch(uint32_t p, uint32_t chain, int tries) {
+    Match best;
+    size_t r = p - base_;
+    int maxLen = (int)std::min<size_t>(MAX_MATCH, buf_.size() - r);
+    if (maxLen < MIN_MATCH) return best;
+    const uint8_t* cur = &buf_[r];
+
+    for (; chain && tries > 0; tries--) {
+        uint32_t cand = chain - 1;
+        if (cand >= p || p - cand > (uint32_t)WSIZE || cand < base_) break;
+        const uint8_t* m = &buf_[cand - base_];
+        if (m[best.len] == cur[best.len] && m[0] == cur[0] && m[1] == cur[1]) {
+            int len = 2;
+            uint64_t a, b;
+            while (len + 8 <= maxLen) {
+                memcpy(&a, m + len, 8);
+                memcpy(&b, cur + len, 8);
+                if (a != b) break;
+                len += 8;
+            }
+            while (len < maxLen && m[len] == cur[len]) len++;
+            if (len > best.len) {
+                best.len  = len;
+                best.dist = (int)(p - cand);
+                if (len >= nice_ || len >= maxLen) break;
+            }
+        }
+        uint32_t next = prev_[cand & WMASK];
+        if (next >= chain) break; // slot reused by a newer position
+        chain = next;
+    }
+    if (best.len < MIN_MATCH || (best.len == MIN_MATCH && best.dist > TOO_FAR)) best.len = 0;
+    return best;
+}
+
+void Deflater::compressBlock(uint32_t limit, bool final) {
+    syms_.clear();
+    memset(litFreq_, 0, sizeof(litFreq_));
+    memset(distFreq_, 0, sizeof(distFreq_));
+    uint32_t start = pos_;
+    const Tables& t = tables();
+
+    auto literal = [&](uint32_t p) {
+        uint8_t c = buf_[p - base_];
+        syms_.push_back(c);
+        litFreq_[c]++;
+    };
+    auto match = [&](const Match& m) {
+        syms_.push_back(0x80000000u | ((uint32_t)m.len << 16) | (uint32_t)m.dist);
+        litFreq_[257 + t.lenCode[m.len - MIN_MATCH]]++;
+        distFreq_[distCodeOf(t, m.dist)]++;
+    };
+
+    uint32_t p = pos_;
+    if (level_ == 0) {
+        p = limit;
+    } else {
+        // Lazy matching: a match is only taken if the next position does
+        // not start a longer one.
+        bool lazy = level_ >= 4;
+        Match pending;
+        bool havePending = false;
+        while (p < limit) {
+            Match m;
+            if (havePending) {
+                m = pending;
+                havePending = false;
+            } else {
+                m = findMatch(p, insert(p), chain_);
+            }
+            if (lazy && m.len && m.len < lazy_ && p + 1 < limit) {
+                int tries = m.len >= good_ ? chain_ >> 2 : chain_;
+                Match n = findMatch(p + 1, insert(p + 1), tries);
+                if (n.len > m.len) {
+                    literal(p++);
+                    pending = n;
+                    havePending = true;
+                    continue;
+                }
+                match(m);
+                for (uint32_t q = p + 2; q < p + m.len; q++) insert(q);
+                p += m.len;
+            } else if (m.len) {
+                // The fast levels skip hashing inside long matches, which
+                // also keeps the chains short enough to reach far matches.
+                match(m);
+                if (lazy || m.len <= lazy_)
+                    for (uint32_t q = p + 1; q < p + m.len; q++) insert(q);
+                p += m.len;
+            } else {
+                literal(p++);
+            }
+        }
+    }
+    pos_ = p;
+    emitBlock(start, p, final);
+
+    // Keep one window of history in front of whatever is still pending.
+    if (pos_ - base_ > (uint32_t)WSIZE * 2) {
+        uint32_t drop = pos_ - WSIZE - base_;
+        buf_.erase(buf_.begin(), buf_.begin() + drop);
+        base_ += drop;
+    }
+}
+
+void Deflater::putBits(uint32_t v, int n) {
+    bits_ |= (uint64_t)v << nbits_;
+    nbits_ += n;
+    if (nbits_ >= 32) {
+        for (int i = 0; i < 4; i++) out_.push_back((uint8_t)(bits_ >> (i * 8)));
+        bits_ >>= 32;
+        nbits_ -= 32;
+    }
+}
+
+void Deflater::alignByte() {
+    nbits_ = (nbits_ + 7) & ~7;
+    while (nbits_ > 0) {
+        out_.push_back((uint8_t)bits_);
+        bits_ >>= 8;
+        nbits_ -= 8;
+    }
+    bits_ = 0;
+}
+
+void Deflater::emitBlock(uint32_t start, uint32_t end, bool final) {
+    const Tables& t = tables();
+    litFreq_[256]++;
+
+    uint8_t litLens[286], distLens[30];
+    buildLengths(litFreq_, 286, 15, litLens);
+    buildLengths(distFreq_, 30, 15, distLens);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && !litLens[hlit - 1]) hlit--;
+    while (hdist > 1 && !distLens[hdist - 1]) hdist--;
+
+    // Run-length code the two length tables as one sequence.
+    uint8_t all[286 + 30];
+    memcpy(all, litLens, hlit);
+    memcpy(all + hlit, distLens, hdist);
+    std::vector<uint16_t> cl; // symbol | extra bits << 8
+    uint32_t clFreq[19] = {0};
+    auto pushCL = [&](int sym, int extra) {
+        cl.push_back((uint16_t)(sym | (extra << 8)));
+        clFreq[sym]++;
+    };
+    int total = hlit + hdist;
+    for (int i = 0; i < total;) {
+        uint8_t v = all[i];
+        int run = 1;
+        while (i + run < total && all[i + run] == v) run++;
+        i += run;
+        if (v == 0) {
+            while (run >= 11) {
+                int r = std::min(run, 138);
+                pushCL(18, r - 11);
+                run -= r;
+            }
+            if (run >= 3) {
+                pushCL(17, run - 3);
+                run = 0;
+            }
+        } else {
+            pushCL(v, 0);
+            run--;
+            while (run >= 3) {
+                int r = std::min(run, 6);
+                pushCL(16, r - 3);
+                run -= r;
+            }
+        }
+        while (run-- > 0) pushCL(v, 0);
+    }
+    uint8_t clLens[19];
+    buildLengths(clFreq, 19, 7, clLens);
+    int hclen = 19;
+    while (hclen > 4 && !clLens[CL_ORDER[hclen - 1]]) hclen--;
+
+    // Pick whichever of dynamic, fixed or stored comes out smallest.
+    auto dataBits = [&](const uint8_t* ll, const uint8_t* dl) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 286; i++) bits += (uint64_t)litFreq_[i] * ll[i];
+        for (int i = 0; i < 29; i++) bits += (uint64_t)litFreq_[257 + i] * LEN_EXTRA[i];
+        for (int i = 0; i < 30; i++) bits += (uint64_t)distFreq_[i] * (dl[i] + DIST_EXTRA[i]);
+        return bits;
+    };
+    uint64_t dynBits = 3 + 14 + 3 * hclen + dataBits(litLens, distLens);
+    for (int i = 0; i < 19; i++) dynBits += (uint64_t)clFreq[i] * clLens[i];
+    dynBits += (uint64_t)clFreq[16] * 2 + clFreq[17] * 3 + clFreq[18] * 7;
+    uint64_t fixBits = 3 + dataBits(t.fixedLit, t.fixedDist);
+    uint32_t raw = end - start;
+    uint64_t storedBits = (uint64_t)std::max<uint32_t>(1, (raw + 65534) / 65535) * 40 + 8ull * raw;
+
+    if (level_ == 0 || (storedBits <= dynBits && storedBits <= fixBits)) {
+        uint32_t p = start;
+        do {
+            uint32_t n = std::min<uint32_t>(end - p, 65535);
+            bool last = p + n == end;
+            putBits(final && last, 1);
+            putBits(0, 2);
+            alignByte();
+            out_.push_back(n & 0xFF);
+            out_.push_back(n >> 8);
+            out_.push_back(~n & 0xFF);
+            out_.push_back((~n >> 8) & 0xFF);
+            out_.insert(out_.end(), buf_.begin() + (p - base_), buf_.begin() + (p - base_ + n));
+            p += n;
+        } while (p < end);
+        return;
+    }
+
+    bool dynamic = dynBits < fixBits;
+    const uint8_t* ll = dynamic ? litLens : t.fixedLit;
+    const uint8_t* dl = dynamic ? distLens : t.fixedDist;
+    uint16_t litCodes[288], distCodes[30];
+    canonicalCodes(ll, dynamic ? 286 : 288, litCodes);
+    canonicalCodes(dl, 30, distCodes);
+
+    putBits(final, 1);
+    putBits(dynamic ? 2 : 1, 2);
+    if (dynamic) {
+        uint16_t clCodes[19];
+        canonicalCodes(clLens, 19, clCodes);
+        putBits(hlit - 257, 5);
+        putBits(hdist - 1, 5);
+        putBits(hclen - 4, 4);
+        for (int i = 0; i < hclen; i++) putBits(clLens[CL_ORDER[i]], 3);
+        for (uint16_t s : cl) {
+            int sym = s & 0xFF, extra = s >> 8;
+            putBits(clCodes[sym], clLens[sym]);
+            if (sym == 16) putBits(extra, 2);
+            else if (sym == 17) putBits(extra, 3);
+            else if (sym == 18) putBits(extra, 7);
+        }
+    }
+    for (uint32_t s : syms_) {
+        if (!(s & 0x80000000u)) {
+            putBits(litCodes[s], ll[s]);
+            continue;
+        }
+        int len = (s >> 16) & 0x1FF, dist = s & 0xFFFF;
+        int lc = t.lenCode[len - MIN_MATCH];
+        putBits(litCodes[257 + lc], ll[257 + lc]);
+        if (LEN_EXTRA[lc]) putBits(len - LEN_BASE[lc], LEN_EXTRA[lc]);
+        int dc = distCodeOf(t, dist);
+        putBits(distCodes[dc], dl[dc]);
+        if (DIST_EXTRA[dc]) putBits(dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+    }
+    putBits(litCodes[256], ll[256]);
+}
+
+namespace {
+
+class BitReader {
+public:
+    BitReader(const uint8_t* p, const uint8_t* end) : p_(p), end_(end) {}
+
+    uint32_t bits(int n) {
+        if (cnt_ < n) refill();
+        uint32_t v = (uint32_t)(buf_ & ((1ull << n) - 1));
+        buf_ >>= n;
+        cnt_ -= n;
+        return v;
+    }
+    uint32_t peek(int n) {
+        if (cnt_ < n) refill();
+        return (uint32_t)(buf_ & ((1ull << n) - 1));
+    }
+    void consume(int n) {
+        buf_ >>= n;
+        cnt_ -= n;
+    }
+    void align() { consume(cnt_ & 7); }
+
+    // True if more bits were read than the input holds.
+    bool overrun() const { return pad_ * 8 > cnt_; }
+
+    // Raw bytes after align().
+    bool copy(uint8_t* dst, size_t n) {
+        size_t inBuf = std::max(0, cnt_ / 8 - pad_);
+        if (n > inBuf + (size_t)(end_ - p_)) return false;
+        for (; n && cnt_ >= 8; n--, dst++) *dst = (uint8_t)bits(8);
+        memcpy(dst, p_, n);
+        p_ += n;
+        return true;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    uint64_t buf_ = 0;
+    int      cnt_ = 0;
+    int      pad_ = 0; // zero bytes fed in past the end
+
+    void refill() {
+        while (cnt_ <= 56) {
+            uint64_t b = 0;
+            if (p_ < end_) b = *p_++;
+            else pad_++;
+            buf_ |= b << cnt_;
+            cnt_ += 8;
+        }
+    }
+};
+
+class Huffman {
+public:
+    static const int FAST = 10;
+
+    bool build(const uint8_t* lens, int n) {
+        memset(count_, 0, sizeof(count_));
+        for (int i = 0; i < n; i++) count_[lens[i]]++;
+        count_[0] = 0;
+        int left = 1;
+        for (int len = 1; len < 16; len++) {
+            left = (left << 1) - count_[len];
+            if (left < 0) return false;
+        }
+        uint16_t offs[16] = {0};
+        for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + count_[len];
+        for (int i = 0; i < n; i++)
+            if (lens[i]) symbol_[offs[lens[i]]++] = (uint16_t)i;
+
+        memset(fast_, 0, sizeof(fast_));
+        uint16_t codes[288];
+        canonicalCodes(lens, n, codes);
+        for (int i = 0; i < n; i++) {
+            if (!lens[i] || lens[i] > FAST) continue;
+            for (int j = codes[i]; j < (1 << FAST); j += 1 << lens[i])
+                fast_[j] = (uint16_t)((i << 4) | lens[i]);
+        }
+        return true;
+    }
+
+    int decode(BitReader& br) const {
+        uint16_t e = fast_[br.peek(FAST)];
+        if (e) {
+            br.consume(e & 15);
+            return e >> 4;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; len++) {
+            code |= (int)br.bits(1);
+            int c = count_[len];
+            if (code - c < first) return symbol_[index + (code - first)];
+            index += c;
+            first = (first + c) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+private:
+    uint16_t fast_[1 << FAST];
+    uint16_t count_[16];
+    uint16_t symbol_[288];
+};
+
+} // namespace
+
+bool inflateZlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out, size_t sizeHint,
+                 size_t maxSize) {
+    if (size < 6) return false;
+    uint8_t cmf = data[0], flg = data[1];
+    if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 || (flg & 0x20)) return false;
+
+    const Tables& t = tables();
+    BitReader br(data + 2, data + size);
+    size_t start = out.size(), o = start;
+    size_t limit = start + maxSize < start ? SIZE_MAX : start + maxSize;
+    out.resize(start + std::min(std::max<size_t>(sizeHint, 1 << 16), maxSize));
+    // Room for the output to reach `end` bytes, within the limit.
+    auto grow = [&](size_t end) {
+        if (end <= out.size()) return true;
+        if (end > limit) return false;
+        out.resize(std::min(std::max(out.size() * 2, end), limit));
+        return true;
+    };
+
+    Huffman lit, dist;
+    bool final = false;
+    while (!final) {
+        final = br.bits(1);
+        int type = br.bits(2);
+        if (type == 0) {
+            br.align();
+            uint32_t len = br.bits(16), nlen = br.bits(16);
+            if ((len ^ 0xFFFF) != nlen) return false;
+            if (!grow(o + len) || !br.copy(out.data() + o, len)) return false;
+            o += len;
+            continue;
+        }
+        if (type == 1) {
+            lit.build(t.fixedLit, 288);
+            dist.build(t.fixedDist, 30);
+        } else if (type == 2) {
+            int hlit = br.bits(5) + 257, hdist = br.bits(5) + 1, hclen = br.bits(4) + 4;
+            if (hlit > 286 || hdist > 30) return false;
+            uint8_t clLens[19] = {0};
+            for (int i = 0; i < hclen; i++) clLens[CL_ORDER[i]] = (uint8_t)br.bits(3);
+            Huffman cl;
+            if (!cl.build(clLens, 19)) return false;
+            uint8_t lens[286 + 30];
+            for (int i = 0; i < hlit + hdist;) {
+                int sym = cl.decode(br);
+                if (sym < 0) return false;
+                if (sym < 16) {
+                    lens[i++] = (uint8_t)sym;
+                    continue;
+                }
+                int rep, val = 0;
+                if (sym == 16) {
+                    if (i == 0) return false;
+                    val = lens[i - 1];
+                    rep = 3 + br.bits(2);
+                } else if (sym == 17) {
+                    rep = 3 + br.bits(3);
+                } else {
+                    rep = 11 + br.bits(7);
+                }
+                if (i + rep > hlit + hdist) return false;
+                while (rep--) lens[i++] = (uint8_t)val;
+            }
+            if (!lit.build(lens, hlit) || !dist.build(lens + hlit, hdist)) return false;
+        } else {
+            return false;
+        }
+
+        for (;;) {
+            int sym = lit.decode(br);
+            if (sym < 256) {
+                if (sym < 0) return false;
+                if (o == out.size() && (br.overrun() || !grow(o + 1))) return false;
+                out[o++] = (uint8_t)sym;
+                continue;
+            }
+            if (sym == 256) break;
+            sym -= 257;
+            if (sym >= 29) return false;
+            int len = LEN_BASE[sym] + br.bits(LEN_EXTRA[sym]);
+            int dc = dist.decode(br);
+            if (dc < 0 || dc >= 30) return false;
+            size_t d = DIST_BASE[dc] + br.bits(DIST_EXTRA[dc]);
+            if (d > o - start || br.overrun()) return false;
+            if (!grow(o + len)) return false;
+            uint8_t* dst = &out[o];
+            const uint8_t* src = dst - d;
+            if (d >= (size_t)len) {
+                memcpy(dst, src, len);
+            } else {
+                for (int i = 0; i < len; i++) dst[i] = src[i];
+            }
+            o += len;
+        }
+        if (br.overrun()) return false;
+    }
+
+    br.align();
+    uint32_t check = 0;
+    for (int i = 0; i < 4; i++) check = (check << 8) | br.bits(8);
+    if (br.overrun()) return false;
+    out.resize(o);
+    return check == adler32(1, out.data() + start, o - start);
+}
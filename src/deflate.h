@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Checksums used by zlib streams and PNG chunks. Pass the previous result
+// to continue a running checksum; crc32 starts from 0 and adler32 from 1.
+uint32_t crc32(uint32_t crc, const uint8_t* p, size_t n);
+uint32_t adler32(uint32_t adler, const uint8_t* p, size_t n);
+
+// Incremental zlib (RFC 1950/1951) compressor. Input is buffered and
+// compressed a block at a time; compressed bytes are appended to `out` as
+// each block completes, so the caller may move them elsewhere and clear
+// `out` between writes. Level 0 stores, 1-9 trade speed for size.
+class Deflater {
+public:
+    explicit Deflater(std::vector<uint8_t>& out, int level = 6);
+
+    void write(const uint8_t* data, size_t n);
+    void finish();
+
+    static const int MAX_LEVEL = 9;
+
+private:
+    struct Match { int len = 0, dist = 0; };
+
+    std::vector<uint8_t>& out_;
+    int level_;
+    int good_, lazy_, nice_, chain_; // search effort, see LEVELS
+
+    std::vector<uint8_t>  buf_;     // window history plus pending input
+    uint32_t              base_ = 0; // stream position of buf_[0]
+    uint32_t              pos_  = 0; // stream position of the next byte to encode
+    std::vector<uint32_t> head_;    // hash -> most recent position + 1
+    std::vector<uint32_t> prev_;    // position & WMASK -> previous position + 1
+    std::vector<uint32_t> syms_;    // literals and matches of the current block
+    uint32_t litFreq_[286];
+    uint32_t distFreq_[30];
+
+    uint64_t bits_  = 0;
+    int      nbits_ = 0;
+    uint32_t adler_ = 1;
+    bool     finished_ = false;
+
+    uint32_t insert(uint32_t p);
+    Match findMatch(uint32_t p, uint32_t chain, int tries);
+    void compressBlock(uint32_t limit, bool final);
+    void emitBlock(uint32_t start, uint32_t end, bool final);
+    void putBits(uint32_t v, int n);
+    void alignByte();
+};
+
+// Decompress a complete zlib stream, appending to `out`. `sizeHint` is
+// the expected output size, if known, to avoid regrowing the buffer.
+// Fails once the output would pass `maxSize` bytes.
+bool inflateZlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out, size_t sizeHint = 0,
+                 size_t maxSize = SIZE_MAX);
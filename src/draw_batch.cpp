@@ -0,0 +1,211 @@
+#include "draw_batch.h"
+#include "canvas.h"
+#include "font.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+DrawBatch::~DrawBatch() {
+    release();
+}
+
+void DrawBatch::init(SDL_Renderer* renderer) {
+    release();
+    renderer_ = renderer;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    buildAtlas();
+#endif
+}
+
+void DrawBatch::release() {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (atlas_) SDL_DestroyTexture(atlas_);
+    atlas_ = nullptr;
+    runs_.clear();
+#endif
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+namespace {
+
+const int GLYPHS = 95;
+
+// Top of the band holding the font at `scale`, one row of glyphs each,
+// with a pixel between bands and between glyphs.
+int bandY(int scale) {
+    int y = 0;
+    for (int s = 1; s < scale; s++) y += FONT_GLYPH_H * s + 1;
+    return y;
+}
+
+int glyphIndex(char ch) {
+    int g = (int)(unsigned char)ch;
+    return g < 32 || g > 126 ? '?' - 32 : g - 32;
+}
+
+void pushQuad(std::vector<SDL_Vertex>& v, float x0, float y0, float x1, float y1,
+              float u0, float v0, float u1, float v1, const SDL_Color& col) {
+    SDL_Vertex a = {{x0, y0}, col, {u0, v0}}, b = {{x1, y0}, col, {u1, v0}};
+    SDL_Vertex c = {{x1, y1}, col, {u1, v1}}, d = {{x0, y1}, col, {u0, v1}};
+    v.insert(v.end(), {a, b, c, a, c, d});
+}
+
+} // namespace
+
+void DrawBatch::buildAtlas() {
+    // The white block sits after the glyphs of the first band.
+    int solidX = GLYPHS * (FONT_GLYPH_W + 1);
+    atlasW_ = std::max(solidX + 2, GLYPHS * (FONT_GLYPH_W * ATLAS_SCALES + 1));
+    atlasH_ = bandY(ATLAS_SCALES + 1);
+    std::vector<Color> px((size_t)atlasW_ * atlasH_, Color{0, 0, 0, 0});
+    const Color white = {255, 255, 255, 255};
+    for (int s = 1; s <= ATLAS_SCALES; s++) {
+        for (int g = 0; g < GLYPHS; g++) {
+            int gx = g * (FONT_GLYPH_W * s + 1), gy = bandY(s);
+            for (int row = 0; row < FONT_GLYPH_H; row++)
+                for (int col = 0; col < FONT_GLYPH_W; col++) {
+                    if (!(FONT_5X7[g][row] & (1 << (4 - col)))) continue;
+                    for (int y = 0; y < s; y++)
+                        std::fill_n(&px[(size_t)(gy + row * s + y) * atlasW_ + gx + col * s], s, white);
+                }
+        }
+    }
+    for (int y = 0; y < 2; y++) std::fill_n(&px[(size_t)y * atlasW_ + solidX], 2, white);
+    solidU_ = (solidX + 1.0f) / atlasW_;
+    solidV_ = 1.0f / atlasH_;
+
+    atlas_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
+                               atlasW_, atlasH_);
+    if (!atlas_) {
+        fprintf(stderr, "Font atlas: %s\n", SDL_GetError());
+        return;
+    }
+    SDL_UpdateTexture(atlas_, nullptr, px.data(), atlasW_ * (int)sizeof(Color));
+    SDL_SetTextureBlendMode(atlas_, SDL_BLENDMODE_BLEND);
+}
+
+void DrawBatch::layout(const char* text, const SDL_Color& col, int scale,
+                       std::vector<SDL_Vertex>& out) const {
+    int s = scale <= ATLAS_SCALES ? scale : 1;
+    float v0 = (float)bandY(s) / atlasH_, v1 = (float)(bandY(s) + FONT_GLYPH_H * s) / atlasH_;
+    for (int i = 0; text[i]; i++) {
+        int g = glyphIndex(text[i]);
+        if (g == 0) continue; // space
+        int gx = g * (FONT_GLYPH_W * s + 1);
+        float x0 = (float)(i * FONT_CHAR_W * scale);
+        pushQuad(out, x0, 0, x0 + FONT_GLYPH_W * scale, (float)(FONT_GLYPH_H * scale),
+                 (float)gx / atlasW_, v0, (float)(gx + FONT_GLYPH_W * s) / atlasW_, v1, col);
+    }
+}
+#endif
+
+void DrawBatch::fillRect(int x, int y, int w, int h, const Color& c) {
+    if (w <= 0 || h <= 0 || c.a == 0) return;
+    x -= originX_;
+    y -= originY_;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    pushQuad(vertices_, (float)x, (float)y, (float)(x + w), (float)(y + h),
+             solidU_, solidV_, solidU_, solidV_, {c.r, c.g, c.b, c.a});
+#else
+    rects_.push_back({x, y, w, h});
+    colors_.push_back(c);
+#endif
+}
+
+void DrawBatch::outlineRect(int x, int y, int w, int h, const Color& c) {
+    if (w <= 0 || h <= 0) return;
+    fillRect(x, y, w, 1, c);
+    if (h > 1) fillRect(x, y + h - 1, w, 1, c);
+    fillRect(x, y + 1, 1, h - 2, c);
+    if (w > 1) fillRect(x + w - 1, y + 1, 1, h - 2, c);
+}
+
+void DrawBatch::line(int x0, int y0, int x1, int y1, const Color& c) {
+    if (x0 == x1 || y0 == y1) {
+        fillRect(std::min(x0, x1), std::min(y0, y1), std::abs(x1 - x0) + 1, std::abs(y1 - y0) + 1, c);
+        return;
+    }
+    // Consecutive points on a row merge into one rectangle.
+    int rx = x0, ry = y0, rw = 0;
+    Canvas::visitLine(x0, y0, x1, y1, [&](int x, int y) {
+        if (y == ry && x == rx + rw) {
+            rw++;
+        } else if (y == ry && x == rx - 1) {
+            rx = x;
+            rw++;
+        } else {
+            fillRect(rx, ry, rw, 1, c);
+            rx = x;
+            ry = y;
+            rw = 1;
+        }
+    });
+    fillRect(rx, ry, rw, 1, c);
+}
+
+void DrawBatch::text(int x, int y, const char* text, const Color& c, int scale) {
+    if (c.a == 0 || scale <= 0) return;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (!atlas_) {
+        textRects(x, y, text, c, scale);
+        return;
+    }
+    key_.assign(text);
+    key_ += '\0';
+    key_ += {(char)scale, (char)c.r, (char)c.g, (char)c.b, (char)c.a};
+    auto it = runs_.find(key_);
+    if (it == runs_.end()) {
+        if ((int)runs_.size() >= MAX_RUNS) runs_.clear();
+        it = runs_.emplace(key_, std::vector<SDL_Vertex>()).first;
+        layout(text, {c.r, c.g, c.b, c.a}, scale, it->second);
+    }
+    size_t base = vertices_.size();
+    vertices_.insert(vertices_.end(), it->second.begin(), it->second.end());
+    for (size_t i = base; i < vertices_.size(); i++) {
+        vertices_[i].position.x += (float)(x - originX_);
+        vertices_[i].position.y += (float)(y - originY_);
+    }
+#else
+    textRects(x, y, text, c, scale);
+#endif
+}
+
+void DrawBatch::textRects(int x, int y, const char* text, const Color& c, int scale) {
+    for (const char* p = text; *p; p++) {
+        int ch = (int)(unsigned char)*p;
+        if (ch < 32 || ch > 126) ch = '?';
+        const uint8_t* glyph = FONT_5X7[ch - 32];
+        for (int row = 0; row < FONT_GLYPH_H; row++) {
+            uint8_t bits = glyph[row];
+            // One rectangle per run of lit pixels in the row.
+            for (int col = 0; col < FONT_GLYPH_W;) {
+                if (!(bits & (1 << (4 - col)))) {
+                    col++;
+                    continue;
+                }
+                int end = col;
+                while (end < FONT_GLYPH_W && (bits & (1 << (4 - end)))) end++;
+                fillRect(x + col * scale, y + row * scale, (end - col) * scale, scale, c);
+                col = end;
+            }
+        }
+        x += FONT_CHAR_W * scale;
+    }
+}
+
+void DrawBatch::flush() {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (vertices_.empty()) return;
+    SDL_RenderGeometry(renderer_, atlas_, vertices_.data(), (int)vertices_.size(), nullptr, 0);
+    vertices_.clear();
+#else
+    for (size_t i = 0, j; i < rects_.size(); i = j) {
+        const Color& c = colors_[i];
+        for (j = i + 1; j < rects_.size() && colors_[j] == c; j++) {}
+        SDL_SetRenderDrawColor(renderer_, c.r, c.g, c.b, c.a);
+        SDL_RenderFillRects(renderer_, &rects_[i], (int)(j - i));
+    }
+    rects_.clear();
+    colors_.clear();
+#endif
+}
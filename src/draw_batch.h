@@ -0,0 +1,67 @@
+#pragma once
+#include "types.h"
+#include <SDL2/SDL.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Collects what the UI of a frame is drawn with (solid rectangles, grid
+// lines, text in the 5x7 font) and submits it together. With
+// SDL_RenderGeometry everything samples one atlas texture, holding the font
+// at each scale and a white block for solid fills, so all of it goes out in
+// a single call. The quads of a line of text are kept by string, colour and
+// scale, and a label that has not changed since it was last drawn is copied
+// in whole rather than laid out again. Older SDL versions get one
+// SDL_RenderFillRects call per run of same-coloured rectangles, text
+// included. Either way things are drawn in the order they were queued, so
+// anything else drawn in between (textures) must be preceded by flush().
+class DrawBatch {
+public:
+    DrawBatch() = default;
+    ~DrawBatch();
+    DrawBatch(const DrawBatch&) = delete;
+    DrawBatch& operator=(const DrawBatch&) = delete;
+
+    void init(SDL_Renderer* renderer);
+    void release();
+
+    void fillRect(int x, int y, int w, int h, const Color& c);
+    // The same pixels SDL_RenderDrawRect would set.
+    void outlineRect(int x, int y, int w, int h, const Color& c);
+    // The same pixels SDL_RenderDrawLine would set, one rectangle per run.
+    void line(int x0, int y0, int x1, int y1, const Color& c);
+    // Glyphs FONT_CHAR_W * scale apart, the top left one at (x, y).
+    void text(int x, int y, const char* text, const Color& c, int scale = 1);
+
+    void flush();
+
+    // Window position that lands at the top left of the render target.
+    void setOrigin(int x, int y) {
+        originX_ = x;
+        originY_ = y;
+    }
+
+    // Font scales the atlas holds; larger ones stretch the smallest.
+    static const int ATLAS_SCALES = 2;
+    // Text runs kept at most; past this the cache starts over.
+    static const int MAX_RUNS = 512;
+
+private:
+    SDL_Renderer* renderer_ = nullptr;
+    int originX_ = 0, originY_ = 0;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    SDL_Texture* atlas_ = nullptr;
+    int   atlasW_ = 0, atlasH_ = 0;
+    float solidU_ = 0, solidV_ = 0;     // centre of the white block
+    std::vector<SDL_Vertex> vertices_;  // six per quad, no index buffer
+    std::unordered_map<std::string, std::vector<SDL_Vertex>> runs_; // at the origin
+    std::string key_;
+
+    void buildAtlas();
+    void layout(const char* text, const SDL_Color& col, int scale, std::vector<SDL_Vertex>& out) const;
+#else
+    std::vector<SDL_Rect>   rects_;
+    std::vector<Color>      colors_;
+#endif
+    void textRects(int x, int y, const char* text, const Color& c, int scale);
+};
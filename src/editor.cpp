@@ -1,14 +1,43 @@
 #include "editor.h"
 #include "font.h"
+#include "imageio.h"
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
+#include <type_traits>
+
+namespace {
+
+// The bytes of each value, to compare what a panel is drawn from between
+// frames.
+template <class... T>
+std::string panelKey(const T&... v) {
+    static_assert((std::is_trivially_copyable<T>::value && ...), "plain values only");
+    std::string key;
+    (key.append(reinterpret_cast<const char*>(&v), sizeof v), ...);
+    return key;
+}
+
+} // namespace
 
-Editor::Editor(int canvasW, int canvasH) : canvas_(canvasW, canvasH) {}
+Editor::Editor(int canvasW, int canvasH) : anim_(canvasW, canvasH) {
+    fillOpts_.parallel = true;
+}
 
 Editor::~Editor() {
-    if (canvasTex_) SDL_DestroyTexture(canvasTex_);
+    // A clean exit leaves nothing to recover; pending checkpoints are
+    // written first so none lands after the journal is gone.
+    saver_.wait();
+    if (journal_) journal_->discard();
+    canvasTex_.release();
+    onionPrev_.release();
+    onionNext_.release();
+    lodTex_.release();
+    navTex_.release();
+    for (PanelCache* p : panels())
+        p->release();
+    batch_.release();
     if (renderer_)  SDL_DestroyRenderer(renderer_);
     if (window_)    SDL_DestroyWindow(window_);
     SDL_Quit();
@@ -40,8 +69,18 @@ bool Editor::init() {
     SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
 
     SDL_SetHint(SDL_HINT_MOUSE_FOCUS_CLICKTHROUGH, "1");
-
-    canvas_.clear({255, 255, 255, 255});
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    batch_.init(renderer_);
+    canvasTex_.init(renderer_);
+    onionPrev_.init(renderer_);
+    onionNext_.init(renderer_);
+    lodTex_.init(renderer_);
+    navTex_.init(renderer_);
+    for (PanelCache* p : panels())
+        p->init(renderer_, &batch_);
+
+    canvas().clear({255, 255, 255, 255});
+    recover();
     fitCanvasInView();
 
     lastFrameTime_ = SDL_GetPerformanceCounter();
@@ -51,15 +90,23 @@ bool Editor::init() {
 
 void Editor::run() {
     bool running = true;
+    bool presented = false;
     while (running) {
+        // Nothing changes on its own unless zoom or playback is under way,
+        // so an idle editor sleeps until an event or the next timer. So
+        // does one whose last frame presented nothing, say between frames
+        // of a slow playback, as vsync did not hold it back.
+        SDL_Event e;
+        bool idle = !animating();
+        bool waited = (idle || !presented) && SDL_WaitEventTimeout(&e, idleTimeout());
 
         Uint64 now = SDL_GetPerformanceCounter();
-        deltaTime_ = (float)(now - lastFrameTime_) / SDL_GetPerformanceFrequency();
-        deltaTime_ = std::min(deltaTime_, 0.05f);
+        float elapsed = (float)(now - lastFrameTime_) / SDL_GetPerformanceFrequency();
+        // Time spent asleep is no part of an animation starting now.
+        deltaTime_ = std::min(elapsed, idle ? 1.0f / 60 : 0.05f);
         lastFrameTime_ = now;
 
-        SDL_Event e;
-        while (SDL_PollEvent(&e)) {
+        for (; waited || SDL_PollEvent(&e); waited = false) {
             if (e.type == SDL_QUIT) { running = false; break; }
             handleEvent(e);
         }
@@ -68,12 +115,36 @@ void Editor::run() {
 
         updateSmoothZoom();
 
+        // Frames only advance between strokes, so an edit stays on one frame.
+        // Playback keeps time across its own sleeps between frames.
+        if (!lmbDown_ && anim_.tick(idle ? deltaTime_ : elapsed))
+            activeLayer_ = std::min(activeLayer_, layers().count() - 1);
+
         updateHover(mouseX_, mouseY_);
 
-        render();
+        pollSaves();
+        autosave();
+        // Keeps replay after a crash short.
+        if (!lmbDown_ && checkpoints_.empty() && journal_->segmentBytes() >= CHECKPOINT_BYTES)
+            checkpoint(true);
+        presented = render();
     }
 }
 
+int Editor::idleTimeout() const {
+    Uint32 now = SDL_GetTicks(), since = now - lastAutosave_;
+    Uint32 wait = since < AUTOSAVE_MS ? AUTOSAVE_MS - since : 0;
+    if (!statusMsg_.empty() && now < statusUntil_) wait = std::min(wait, statusUntil_ - now);
+    // Saves run in the background and report progress on the status bar.
+    if (saver_.pending()) wait = std::min(wait, (Uint32)100);
+    // An autosave held back by a stroke is retried without spinning.
+    int timeout = (int)std::max(wait, (Uint32)10);
+    if (zoom_ != targetZoom_) timeout = std::min(timeout, 16);
+    double tick = anim_.untilTick();
+    if (tick >= 0) timeout = std::min(timeout, (int)std::ceil(tick * 1000));
+    return timeout;
+}
+
 
 void Editor::handleEvent(const SDL_Event& e) {
     switch (e.type) {
@@ -101,6 +172,11 @@ void Editor::handleEvent(const SDL_Event& e) {
     case SDL_WINDOWEVENT:
         handleWindowEvent(e.window);
         break;
+    case SDL_RENDER_TARGETS_RESET:
+        for (PanelCache* p : panels())
+            p->invalidate();
+        redraw_ = true;
+        break;
     }
 }
 
@@ -112,6 +188,9 @@ void Editor::handleWindowEvent(const SDL_WindowEvent& we) {
         winW_ = we.data1;
         winH_ = we.data2;
         break;
+    case SDL_WINDOWEVENT_EXPOSED:
+        redraw_ = true;
+        break;
     }
 }
 
@@ -126,21 +205,61 @@ void Editor::handleKeyDown(const SDL_KeyboardEvent& key) {
             if (shift) redo(); else undo();
             return;
         case SDLK_s:
-            saveFile();
+            saveProject();
             return;
         case SDLK_o:
-            loadFile();
+            openProject();
+            return;
+        case SDLK_e:
+            if (shift) saveFile("artwork.bmp"); else saveFile();
+            return;
+        case SDLK_i:
+            if (shift) loadFile("artwork.bmp"); else loadFile();
             return;
-        case SDLK_n:
-            pushUndo();
-            canvas_.clear({255, 255, 255, 255});
+        case SDLK_n: {
+            JournalRecord r = record(JournalOp::Clear);
+            r.color = activeLayer_ == 0 ? Color(255, 255, 255, 255) : Color(0, 0, 0, 0);
+            draw(r);
             return;
+        }
         case SDLK_0:
             fitCanvasInView();
             return;
         }
     }
 
+    if (shift) {
+        switch (key.keysym.sym) {
+        case SDLK_a:      addFrame(false); return;
+        case SDLK_DELETE: removeFrame();   return;
+        case SDLK_LEFT:   moveFrame(-1);   return;
+        case SDLK_RIGHT:  moveFrame(1);    return;
+        case SDLK_m: {
+            // Halves the colours of an indexed layer each time.
+            const PaletteRef& pal = canvas().palette();
+            quantizeLayer(pal ? std::max(2, (int)pal->size() / 2) : 256, Dither::Diffusion);
+            return;
+        }
+        case SDLK_i: case SDLK_g: case SDLK_h: case SDLK_b: case SDLK_o: {
+            Filter f;
+            switch (key.keysym.sym) {
+            case SDLK_i: f.type = FilterType::Channels;      f.a = (int)ChannelOp::Invert;    break;
+            case SDLK_g: f.type = FilterType::Channels;      f.a = (int)ChannelOp::Grayscale; break;
+            case SDLK_h: f.type = FilterType::HueSaturation; f.a = 30;                        break;
+            case SDLK_b: f.type = FilterType::GaussianBlur;  f.a = 2;                         break;
+            default:
+                f.type = FilterType::Outline;
+                f.a = 1;
+                f.b = fillOpts_.diagonal;
+                f.to = fgColor_;
+                break;
+            }
+            filterLayer({f});
+            return;
+        }
+        }
+    }
+
     switch (key.keysym.sym) {
     case SDLK_p: currentTool_ = Tool::Pencil;      break;
     case SDLK_e: currentTool_ = Tool::Eraser;       break;
@@ -150,17 +269,63 @@ void Editor::handleKeyDown(const SDL_KeyboardEvent& key) {
     case SDLK_f: currentTool_ = Tool::Fill;         break;
     case SDLK_i: currentTool_ = Tool::ColorPicker;  break;
     case SDLK_g: showGrid_ = !showGrid_;            break;
+    case SDLK_v: showNavigator_ = !showNavigator_;  break;
     case SDLK_x: std::swap(fgColor_, bgColor_);     break;
+    case SDLK_d: fillOpts_.diagonal = !fillOpts_.diagonal; break;
+    case SDLK_n: addLayer();                        break;
+    case SDLK_a: addFrame(true);                    break;
+    case SDLK_o: onionSkin_ = !onionSkin_;          break;
+    case SDLK_m: setIndexed(!canvas().indexed());   break;
+    case SDLK_LEFT:  selectFrame(anim_.current() - 1); break;
+    case SDLK_RIGHT: selectFrame(anim_.current() + 1); break;
+    case SDLK_SEMICOLON: setFps(anim_.fps() - 1); break;
+    case SDLK_QUOTE:     setFps(anim_.fps() + 1); break;
+    case SDLK_DELETE:
+    case SDLK_BACKSPACE:
+        removeLayer();
+        break;
+    case SDLK_PAGEUP:
+        if (shift) moveLayer(1); else selectLayer(activeLayer_ + 1);
+        break;
+    case SDLK_PAGEDOWN:
+        if (shift) moveLayer(-1); else selectLayer(activeLayer_ - 1);
+        break;
+    case SDLK_h: {
+        const Layer& l = layers().layer(activeLayer_);
+        setLayerProps(!l.visible, l.blend, l.opacity);
+        break;
+    }
+    case SDLK_b: {
+        const Layer& l = layers().layer(activeLayer_);
+        setLayerProps(l.visible, (BlendMode)(((int)l.blend + 1) % (int)BlendMode::COUNT), l.opacity);
+        break;
+    }
+    case SDLK_COMMA: {
+        const Layer& l = layers().layer(activeLayer_);
+        setLayerProps(l.visible, l.blend, l.opacity - 16);
+        break;
+    }
+    case SDLK_PERIOD: {
+        const Layer& l = layers().layer(activeLayer_);
+        setLayerProps(l.visible, l.blend, l.opacity + 16);
+        break;
+    }
+    case SDLK_LEFTBRACKET:
+        fillOpts_.tolerance = std::max(fillOpts_.tolerance - 8, 0);
+        break;
+    case SDLK_RIGHTBRACKET:
+        fillOpts_.tolerance = std::min(fillOpts_.tolerance + 8, 255);
+        break;
     case SDLK_EQUALS: case SDLK_PLUS:
         targetZoom_ = std::min(targetZoom_ * 1.25f, 128.0f);
         break;
     case SDLK_MINUS:
-        targetZoom_ = std::max(targetZoom_ / 1.25f, 1.0f);
+        targetZoom_ = std::max(targetZoom_ / 1.25f, MIN_ZOOM);
         break;
     case SDLK_F11:
     case SDLK_RETURN:
-        if (key.keysym.sym == SDLK_RETURN && !mod) break;
-        toggleFullscreen();
+        if (key.keysym.sym == SDLK_RETURN && !mod) togglePlayback();
+        else toggleFullscreen();
         break;
     case SDLK_SPACE:
         fitCanvasInView();
@@ -170,8 +335,8 @@ void Editor::handleKeyDown(const SDL_KeyboardEvent& key) {
 
 void Editor::canvasOrigin(float& ox, float& oy) const {
     int areaH = canvasAreaHeight();
-    ox = panX_ + (winW_ - canvas_.getWidth() * zoom_) / 2.0f;
-    oy = panY_ + TOOLBAR_H + (areaH - canvas_.getHeight() * zoom_) / 2.0f;
+    ox = panX_ + (winW_ - layers().width() * zoom_) / 2.0f;
+    oy = panY_ + TOOLBAR_H + (areaH - layers().height() * zoom_) / 2.0f;
 }
 
 Point Editor::screenToCanvas(int sx, int sy) const {
@@ -187,6 +352,12 @@ void Editor::handleMouseDown(int x, int y, uint8_t button) {
         // Try UI areas first
         if (handleToolbarClick(x, y, button)) return;
         if (handlePaletteClick(x, y, button)) return;
+        if (handleTimelineClick(x, y, button)) return;
+        if (overNavigator(x, y)) {
+            navDrag_ = true;
+            panToNavigator(x, y);
+            return;
+        }
         if (inCanvasArea(y)) {
             lmbDown_ = true;
             Point cp = screenToCanvas(x, y);
@@ -195,7 +366,6 @@ void Editor::handleMouseDown(int x, int y, uint8_t button) {
                 currentTool_ == Tool::Rectangle ||
                 currentTool_ == Tool::Circle)
             {
-                pushUndo();
                 dragStart_ = cp;
                 dragging_  = true;
             } else {
@@ -228,8 +398,10 @@ void Editor::handleMouseUp(int x, int y, uint8_t button) {
             finishShape(cp.x, cp.y);
             dragging_ = false;
         }
+        if (strokeActive_) commitEdit();
         lmbDown_ = false;
         strokeActive_ = false;
+        navDrag_ = false;
     } else if (button == SDL_BUTTON_MIDDLE) {
         mmbDown_ = false;
         SDL_SetCursor(SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW));
@@ -240,7 +412,11 @@ void Editor::handleMouseUp(int x, int y, uint8_t button) {
 }
 
 void Editor::handleMouseMotion(int x, int y) {
-    if (inCanvasArea(y)) {
+    if (navDrag_) {
+        panToNavigator(x, y);
+        return;
+    }
+    if (inCanvasArea(y) && !overNavigator(x, y)) {
         Point cp = screenToCanvas(x, y);
         cursorCX_ = cp.x;
         cursorCY_ = cp.y;
@@ -256,9 +432,8 @@ void Editor::handleMouseMotion(int x, int y) {
     }
     if (lmbDown_ && strokeActive_) {
         Point cp = screenToCanvas(x, y);
-        auto pts = Canvas::linePoints(lastDraw_.x, lastDraw_.y, cp.x, cp.y);
-        for (auto& p : pts)
-            applyTool(p.x, p.y, false);
+        Canvas::visitLine(lastDraw_.x, lastDraw_.y, cp.x, cp.y,
+                          [&](int px, int py) { applyTool(px, py, false); });
         lastDraw_ = cp;
     }
 }
@@ -269,7 +444,7 @@ void Editor::handleMouseWheel(int scrollY, int mouseX, int mouseY) {
     }
     float factor = (scrollY > 0) ? 1.15f : 1.0f / 1.15f;
     float newTarget = targetZoom_ * factor;
-    newTarget = std::max(1.0f, std::min(newTarget, 128.0f));
+    newTarget = std::max(MIN_ZOOM, std::min(newTarget, 128.0f));
     float ox, oy;
     canvasOrigin(ox, oy);
     float cx = (mouseX - ox) / zoom_;
@@ -279,14 +454,14 @@ void Editor::handleMouseWheel(int scrollY, int mouseX, int mouseY) {
     float newOx = mouseX - cx * targetZoom_;
     float newOy = mouseY - cy * targetZoom_;
     int areaH = canvasAreaHeight();
-    float defOx = (winW_ - canvas_.getWidth() * targetZoom_) / 2.0f;
-    float defOy = TOOLBAR_H + (areaH - canvas_.getHeight() * targetZoom_) / 2.0f;
+    float defOx = (winW_ - layers().width() * targetZoom_) / 2.0f;
+    float defOy = TOOLBAR_H + (areaH - layers().height() * targetZoom_) / 2.0f;
     panX_ = newOx - defOx;
     panY_ = newOy - defOy;
 }
 
 void Editor::updateSmoothZoom() {
-    if (std::abs(zoom_ - targetZoom_) < 0.01f) {
+    if (std::abs(zoom_ - targetZoom_) < 0.01f * std::min(targetZoom_, 1.0f)) {
         zoom_ = targetZoom_;
         return;
     }
@@ -297,10 +472,12 @@ void Editor::updateSmoothZoom() {
 
 void Editor::fitCanvasInView() {
     int areaH = canvasAreaHeight();
-    float zx = (float)(winW_ - 40) / canvas_.getWidth();
-    float zy = (float)(areaH - 20) / canvas_.getHeight();
-    targetZoom_ = std::floor(std::min(zx, zy));
-    targetZoom_ = std::max(2.0f, std::min(targetZoom_, 64.0f));
+    float zx = (float)(winW_ - 40) / layers().width();
+    float zy = (float)(areaH - 20) / layers().height();
+    // Canvases too big for the window at 1x fit exactly.
+    float fit = std::min(zx, zy);
+    if (fit < 1.0f) targetZoom_ = std::max(fit, MIN_ZOOM);
+    else            targetZoom_ = std::max(2.0f, std::min(std::floor(fit), 64.0f));
     zoom_ = targetZoom_;
     panX_ = panY_ = 0;
 }
@@ -322,6 +499,7 @@ void Editor::centerCanvas() {
 void Editor::updateHover(int x, int y) {
     hoverToolIdx_   = -1;
     hoverSwatchIdx_ = -1;
+    hoverEntryIdx_  = -1;
     hoverGrid_      = false;
     hoverFgBg_      = false;
     if (y >= 0 && y < TOOLBAR_H) {
@@ -360,7 +538,62 @@ void Editor::updateHover(int x, int y) {
                 return;
             }
         }
+        hoverEntryIdx_ = paletteEntryAt(x, y);
+    }
+}
+
+// The active layer's palette fills the space right of the FG/BG labels,
+// its swatches shrunk until every entry fits.
+bool Editor::paletteEntryRect(int i, SDL_Rect& r) const {
+    const PaletteRef& pal = layers().layer(activeLayer_).canvas.palette();
+    if (!pal || i < 0 || i >= (int)pal->size()) return false;
+    int n = (int)pal->size();
+    int x0 = SWATCH_PAD + 12 * (SWATCH_SIZE + SWATCH_PAD) + 90;
+    int y0 = winH_ - PALETTE_H - STATUS_H + SWATCH_PAD + 2;
+    int cell = SWATCH_SIZE + SWATCH_PAD, cols = 1;
+    for (; cell > 4; cell--) {
+        cols = std::max(1, (winW_ - x0) / cell);
+        if ((n + cols - 1) / cols * cell <= PALETTE_H - SWATCH_PAD * 2) break;
     }
+    r = {x0 + i % cols * cell, y0 + i / cols * cell, cell - 1, cell - 1};
+    return r.x + r.w <= winW_ && r.y + r.h <= winH_ - STATUS_H;
+}
+
+int Editor::paletteEntryAt(int x, int y) const {
+    SDL_Rect r;
+    for (int i = 0; paletteEntryRect(i, r); i++)
+        if (x >= r.x && x < r.x + r.w && y >= r.y && y < r.y + r.h) return i;
+    return -1;
+}
+
+bool Editor::navigatorRect(SDL_Rect& r, float& scale) const {
+    int cw = layers().width(), ch = layers().height();
+    if (!showNavigator_ || (cw * zoom_ <= winW_ && ch * zoom_ <= canvasAreaHeight())) return false;
+    scale = std::min((float)NAV_SIZE / cw, (float)NAV_SIZE / ch);
+    r.w = std::max(1, (int)std::lround(cw * scale));
+    r.h = std::max(1, (int)std::lround(ch * scale));
+    r.x = winW_ - NAV_MARGIN - NAV_BORDER - r.w;
+    r.y = canvasAreaBottom() - NAV_MARGIN - NAV_BORDER - r.h;
+    return true;
+}
+
+bool Editor::overNavigator(int x, int y) const {
+    SDL_Rect r;
+    float scale;
+    return navigatorRect(r, scale) &&
+           x >= r.x - NAV_BORDER && x < r.x + r.w + NAV_BORDER &&
+           y >= r.y - NAV_BORDER && y < r.y + r.h + NAV_BORDER;
+}
+
+void Editor::panToNavigator(int x, int y) {
+    SDL_Rect r;
+    float scale;
+    if (!navigatorRect(r, scale)) return;
+    int cw = layers().width(), ch = layers().height();
+    float cx = std::clamp((x - r.x) / scale, 0.0f, (float)cw);
+    float cy = std::clamp((y - r.y) / scale, 0.0f, (float)ch);
+    panX_ = (cw / 2.0f - cx) * zoom_;
+    panY_ = (ch / 2.0f - cy) * zoom_;
 }
 
 bool Editor::handleToolbarClick(int x, int y, uint8_t button) {
@@ -410,27 +643,55 @@ bool Editor::handlePaletteClick(int x, int y, uint8_t button) {
             return true;
         }
     }
-    return false;
+    // Shift sets the entry instead of picking it, recolouring every pixel
+    // that uses it.
+    int e = paletteEntryAt(x, y);
+    if (e < 0) return false;
+    if (button != SDL_BUTTON_LEFT && button != SDL_BUTTON_RIGHT) return true;
+    Color& picked = button == SDL_BUTTON_LEFT ? fgColor_ : bgColor_;
+    if (SDL_GetModState() & KMOD_SHIFT) setPaletteEntry(e, picked);
+    else picked = (*canvas().palette())[e];
+    return true;
+}
+
+bool Editor::handleTimelineClick(int x, int y, uint8_t button) {
+    int timelineY = canvasAreaBottom();
+    if (y < timelineY || y >= timelineY + TIMELINE_H) return false;
+
+    int visible = (winW_ - 120) / FRAME_CELL_W;
+    int first = std::max(0, anim_.current() - visible + 1);
+    int cell = (x - 4) / FRAME_CELL_W;
+    if (x >= 4 && cell < visible && first + cell < anim_.count() && button == SDL_BUTTON_LEFT)
+        selectFrame(first + cell);
+    return true;
 }
 
 void Editor::applyTool(int cx, int cy, bool newStroke) {
-    if (!canvas_.inBounds(cx, cy)) return;
+    if (!canvas().inBounds(cx, cy)) return;
 
     switch (currentTool_) {
     case Tool::Pencil:
-        if (newStroke) pushUndo();
-        canvas_.setPixel(cx, cy, fgColor_);
-        break;
     case Tool::Eraser:
-        if (newStroke) pushUndo();
-        canvas_.setPixel(cx, cy, bgColor_);
+        // A stroke cut off by a layer or frame change goes on as a new one.
+        if (newStroke || !canvas().capturing()) {
+            beginEdit();
+            strokeColor_ = currentTool_ == Tool::Pencil ? fgColor_ : bgColor_;
+        }
+        canvas().setPixel(cx, cy, strokeColor_);
+        stroke_.push_back({cx, cy});
         break;
-    case Tool::Fill:
-        pushUndo();
-        canvas_.floodFill(cx, cy, fgColor_);
+    case Tool::Fill: {
+        JournalRecord r = record(JournalOp::Fill);
+        r.color = fgColor_;
+        r.a = cx;
+        r.b = cy;
+        r.c = fillOpts_.tolerance;
+        r.d = fillOpts_.diagonal;
+        draw(r);
         break;
+    }
     case Tool::ColorPicker:
-        fgColor_ = canvas_.getPixel(cx, cy);
+        fgColor_ = layers().composite().getPixel(cx, cy);
         break;
     default:
         break;
@@ -438,117 +699,481 @@ void Editor::applyTool(int cx, int cy, bool newStroke) {
 }
 
 void Editor::finishShape(int cx, int cy) {
+    JournalRecord r = record(JournalOp::Line);
+    r.color = fgColor_;
+    r.a = dragStart_.x;
+    r.b = dragStart_.y;
+    r.c = cx;
+    r.d = cy;
     switch (currentTool_) {
     case Tool::Line:
-        canvas_.drawLine(dragStart_.x, dragStart_.y, cx, cy, fgColor_);
         break;
     case Tool::Rectangle:
-        canvas_.drawRect(dragStart_.x, dragStart_.y, cx, cy, fgColor_);
+        r.op = JournalOp::Rect;
         break;
     case Tool::Circle: {
         int dx = cx - dragStart_.x;
         int dy = cy - dragStart_.y;
-        int radius = (int)std::round(std::sqrt(dx * dx + dy * dy));
-        canvas_.drawCircle(dragStart_.x, dragStart_.y, radius, fgColor_);
+        r.op = JournalOp::Circle;
+        r.c = (int)std::round(std::sqrt(dx * dx + dy * dy));
+        r.d = 0;
         break;
     }
+    default:
+        return;
+    }
+    draw(r);
+}
+
+void Editor::draw(const JournalRecord& r) {
+    beginEdit();
+    Canvas& c = canvas();
+    switch (r.op) {
+    case JournalOp::Stroke:
+        for (const Point& p : r.points) c.setPixel(p.x, p.y, r.color);
+        break;
+    case JournalOp::Line:   c.drawLine(r.a, r.b, r.c, r.d, r.color); break;
+    case JournalOp::Rect:   c.drawRect(r.a, r.b, r.c, r.d, r.color); break;
+    case JournalOp::Circle: c.drawCircle(r.a, r.b, r.c, r.color);    break;
+    case JournalOp::Fill: {
+        FillOptions opts = fillOpts_;
+        opts.tolerance = r.c;
+        opts.diagonal  = r.d != 0;
+        c.floodFill(r.a, r.b, r.color, opts);
+        break;
+    }
+    case JournalOp::Clear:  c.clear(r.color); break;
     default:
         break;
     }
+    commitEdit();
+    log(r);
+}
+
+void Editor::addLayer() {
+    commitEdit();
+    log(record(JournalOp::AddLayer));
+    activeLayer_ = layers().add(activeLayer_ + 1);
+}
+
+void Editor::removeLayer() {
+    if (layers().count() <= 1) return;
+    // Undo entries for the removed layer are skipped from now on.
+    commitEdit();
+    log(record(JournalOp::RemoveLayer));
+    layers().remove(activeLayer_);
+    activeLayer_ = std::min(activeLayer_, layers().count() - 1);
 }
 
-void Editor::pushUndo() {
-    undoStack_.push_back(canvas_.snapshot());
-    if ((int)undoStack_.size() > MAX_UNDO)
-        undoStack_.erase(undoStack_.begin());
-    redoStack_.clear();
+void Editor::selectLayer(int index) {
+    commitEdit();
+    activeLayer_ = std::max(0, std::min(index, layers().count() - 1));
+}
+
+void Editor::moveLayer(int delta) {
+    commitEdit();
+    JournalRecord r = record(JournalOp::MoveLayer);
+    r.a = delta;
+    log(r);
+    int to = std::max(0, std::min(activeLayer_ + delta, layers().count() - 1));
+    layers().move(activeLayer_, to);
+    activeLayer_ = to;
+}
+
+void Editor::addFrame(bool duplicate) {
+    commitEdit();
+    JournalRecord r = record(JournalOp::AddFrame);
+    r.a = duplicate;
+    log(r);
+    anim_.stop();
+    anim_.add(duplicate);
+    activeLayer_ = std::min(activeLayer_, layers().count() - 1);
+}
+
+void Editor::removeFrame() {
+    if (anim_.count() <= 1) return;
+    // Undo entries for the removed frame are skipped from now on.
+    commitEdit();
+    log(record(JournalOp::RemoveFrame));
+    anim_.remove(anim_.current());
+    activeLayer_ = std::min(activeLayer_, layers().count() - 1);
+}
+
+void Editor::selectFrame(int index) {
+    commitEdit();
+    anim_.stop();
+    anim_.select(index);
+    activeLayer_ = std::min(activeLayer_, layers().count() - 1);
+}
+
+void Editor::moveFrame(int delta) {
+    commitEdit();
+    JournalRecord r = record(JournalOp::MoveFrame);
+    r.a = delta;
+    log(r);
+    anim_.move(anim_.current(), anim_.current() + delta);
+}
+
+void Editor::togglePlayback() {
+    commitEdit();
+    if (anim_.playing()) anim_.stop(); else anim_.play();
+}
+
+void Editor::setLayerProps(bool visible, BlendMode blend, int opacity) {
+    opacity = std::max(0, std::min(opacity, 255));
+    JournalRecord r = record(JournalOp::LayerProps);
+    r.a = visible;
+    r.b = (int)blend;
+    r.c = opacity;
+    log(r);
+    layers().setVisible(activeLayer_, visible);
+    layers().setBlend(activeLayer_, blend);
+    layers().setOpacity(activeLayer_, (uint8_t)opacity);
+}
+
+void Editor::setFps(int fps) {
+    JournalRecord r = record(JournalOp::SetFps);
+    r.a = fps;
+    log(r);
+    anim_.setFps(fps);
+}
+
+void Editor::setIndexed(bool indexed) {
+    if (canvas().indexed() == indexed) return;
+    beginEdit();
+    bool ok = true;
+    if (indexed) ok = canvas().toIndexed();
+    else canvas().toRGBA();
+    commitEdit();
+    if (!ok) {
+        showStatus("Too many colours for indexed mode, Shift+M reduces them");
+        return;
+    }
+    JournalRecord r = record(JournalOp::SetIndexed);
+    r.a = indexed;
+    log(r);
+    if (indexed) showStatus("Indexed: " + std::to_string(canvas().palette()->size()) + " colours");
+}
+
+void Editor::quantizeLayer(int colors, Dither dither) {
+    beginEdit();
+    QuantizeOptions opts;
+    opts.colors = colors;
+    opts.dither = dither;
+    quantize(canvas(), opts);
+    commitEdit();
+    JournalRecord r = record(JournalOp::Quantize);
+    r.a = colors;
+    r.b = (int)dither;
+    log(r);
+    showStatus("Indexed: " + std::to_string(canvas().palette()->size()) + " colours");
+}
+
+void Editor::filterLayer(const std::vector<Filter>& chain) {
+    if (chain.empty()) return;
+    beginEdit();
+    applyFilters(canvas(), chain);
+    commitEdit();
+    for (size_t i = 0; i < chain.size(); i++) {
+        const Filter& f = chain[i];
+        JournalRecord r = record(JournalOp::Filter);
+        r.a = f.a;
+        r.b = f.b;
+        r.c = f.c;
+        r.d = (int)((uint32_t)f.from.r | f.from.g << 8 | f.from.b << 16 | (uint32_t)f.from.a << 24);
+        r.color = f.to;
+        r.points = {Point((int)f.type, i + 1 < chain.size())};
+        log(r);
+    }
+    showStatus(filterName(chain.back().type));
+}
+
+void Editor::setPaletteEntry(int index, const Color& c) {
+    const PaletteRef& pal = canvas().palette();
+    if (!pal || index < 0 || index >= (int)pal->size() || (*pal)[index] == c) return;
+    auto edited = std::make_shared<Palette>(*pal);
+    (*edited)[index] = c;
+    beginEdit();
+    canvas().setPalette(std::move(edited));
+    commitEdit();
+    JournalRecord r = record(JournalOp::SetPaletteEntry);
+    r.a = index;
+    r.color = c;
+    log(r);
+}
+
+void Editor::beginEdit() {
+    commitEdit();
+    editFrame_ = anim_.frame(anim_.current()).id;
+    editLayer_ = layers().layer(activeLayer_).id;
+    canvas().beginCapture();
+}
+
+void Editor::commitEdit() {
+    int f = anim_.indexOf(editFrame_);
+    LayerStack* stack = f >= 0 ? &anim_.frame(f).layers : nullptr;
+    int i = stack ? stack->indexOf(editLayer_) : -1;
+    if (i >= 0 && stack->layer(i).canvas.capturing()) {
+        CanvasDelta d = stack->layer(i).canvas.endCapture();
+        d.frame = editFrame_;
+        d.layer = editLayer_;
+        history_.push(std::move(d));
+        // Strokes are logged whole once they end.
+        if (!stroke_.empty()) {
+            JournalRecord r;
+            r.op    = JournalOp::Stroke;
+            r.frame = f;
+            r.layer = i;
+            r.color = strokeColor_;
+            r.points.swap(stroke_);
+            log(r);
+        }
+    }
+    stroke_.clear();
+    editFrame_ = editLayer_ = -1;
 }
 
 void Editor::undo() {
-    if (undoStack_.empty()) return;
-    redoStack_.push_back(canvas_.snapshot());
-    canvas_.restore(undoStack_.back());
-    undoStack_.pop_back();
+    commitEdit();
+    log(record(JournalOp::Undo));
+    history_.undo(anim_);
+    activeLayer_ = std::min(activeLayer_, layers().count() - 1);
 }
 
 void Editor::redo() {
-    if (redoStack_.empty()) return;
-    undoStack_.push_back(canvas_.snapshot());
-    canvas_.restore(redoStack_.back());
-    redoStack_.pop_back();
+    commitEdit();
+    log(record(JournalOp::Redo));
+    history_.redo(anim_);
+    activeLayer_ = std::min(activeLayer_, layers().count() - 1);
 }
 
+// Encoding and writing happen on the saver's thread; the frame loop only
+// pays for copying the composite's tile pointers.
 void Editor::saveFile(const std::string& path) {
-    int w = canvas_.getWidth(), h = canvas_.getHeight();
-    SDL_Surface* s = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGBA32);
-    if (!s) return;
-
-    for (int y = 0; y < h; y++) {
-        uint8_t* row = (uint8_t*)s->pixels + y * s->pitch;
-        for (int x = 0; x < w; x++) {
-            Color c = canvas_.getPixel(x, y);
-            row[x * 4 + 0] = c.r;
-            row[x * 4 + 1] = c.g;
-            row[x * 4 + 2] = c.b;
-            row[x * 4 + 3] = c.a;
+    // A lone indexed layer is its own composite and is saved as is, so a
+    // PNG keeps its palette.
+    const Layer& l = layers().layer(0);
+    if (layers().count() == 1 && l.canvas.indexed() && l.visible && l.opacity == 255 &&
+        l.blend == BlendMode::Normal)
+        saver_.save(l.canvas, path);
+    else
+        saver_.save(layers().composite(), path);
+}
+
+void Editor::saveProject(const std::string& path) {
+    saver_.saveProject(anim_, projectInfo(), path);
+}
+
+ProjectInfo Editor::projectInfo() const {
+    ProjectInfo info;
+    info.activeLayer = activeLayer_;
+    info.fg = fgColor_;
+    info.bg = bgColor_;
+    return info;
+}
+
+// Only the tile tables are read here; pixels come in from the mapped file
+// as the view reaches them.
+void Editor::openProject(const std::string& path) {
+    Animation anim(1, 1);
+    ProjectInfo info;
+    if (!loadProject(path, anim, info)) {
+        printf("Failed to open: %s\n", path.c_str());
+        showStatus("Open failed: " + path);
+        return;
+    }
+    commitEdit();
+    anim_ = std::move(anim);
+    activeLayer_ = info.activeLayer;
+    fgColor_ = info.fg;
+    bgColor_ = info.bg;
+    // Deltas of the previous document cannot apply to this one.
+    history_.clear();
+    autosavedChange_ = history_.changeCount();
+    checkpoint(false);
+    fitCanvasInView();
+    printf("Opened: %s (%dx%d, %d frames)\n", path.c_str(), anim_.width(), anim_.height(), anim_.count());
+}
+
+void Editor::autosave() {
+    Uint32 now = SDL_GetTicks();
+    if (now - lastAutosave_ < AUTOSAVE_MS) return;
+    // Mid-stroke the canvas is half drawn; try again once it is committed.
+    if (lmbDown_ || saver_.busy()) return;
+    lastAutosave_ = now;
+    if (history_.changeCount() == autosavedChange_) return;
+    autosavedChange_ = history_.changeCount();
+    saveProject("artwork.autosave.tcp");
+}
+
+void Editor::pollSaves() {
+    for (auto& r : saver_.poll()) {
+        if (!checkpoints_.empty() && r.path == journal_->checkpointPath(checkpoints_.front())) {
+            if (r.ok) journal_->checkpointSaved(checkpoints_.front());
+            else printf("Failed to save checkpoint: %s\n", r.path.c_str());
+            checkpoints_.pop_front();
+            continue;
         }
+        printf("%s: %s\n", r.ok ? "Saved" : "Failed to save", r.path.c_str());
+        showStatus((r.ok ? "Saved " : "Save failed: ") + r.path);
     }
-    SDL_SaveBMP(s, path.c_str());
-    SDL_FreeSurface(s);
-    printf("Saved: %s\n", path.c_str());
+}
+
+void Editor::showStatus(const std::string& msg) {
+    statusMsg_   = msg;
+    statusUntil_ = SDL_GetTicks() + STATUS_MS;
 }
 
 void Editor::loadFile(const std::string& path) {
-    SDL_Surface* raw = SDL_LoadBMP(path.c_str());
-    if (!raw) { printf("Failed to load: %s\n", path.c_str()); return; }
-
-    SDL_Surface* s = SDL_ConvertSurfaceFormat(raw, SDL_PIXELFORMAT_RGBA32, 0);
-    SDL_FreeSurface(raw);
-    if (!s) return;
-
-    pushUndo();
-    canvas_ = Canvas(s->w, s->h);
-    for (int y = 0; y < s->h; y++) {
-        uint8_t* row = (uint8_t*)s->pixels + y * s->pitch;
-        for (int x = 0; x < s->w; x++) {
-            canvas_.setPixel(x, y, {row[x*4+0], row[x*4+1], row[x*4+2], row[x*4+3]});
+    Image img;
+    if (!loadImage(path, img)) { printf("Failed to load: %s\n", path.c_str()); return; }
+
+    // Every layer of every frame is resized, so the load is one undo step
+    // across all of them.
+    commitEdit();
+    anim_.stop();
+    for (int f = 0; f < anim_.count(); f++) {
+        LayerStack& stack = anim_.frame(f).layers;
+        for (int i = 0; i < stack.count(); i++) stack.layer(i).canvas.beginCapture();
+        stack.resize(img.width, img.height);
+    }
+    canvas().writeRegion(canvas().bounds(), img.pixels.data(), img.width);
+    canvas().compact(canvas().bounds());
+    bool first = true;
+    for (int f = 0; f < anim_.count(); f++) {
+        LayerStack& stack = anim_.frame(f).layers;
+        for (int i = 0; i < stack.count(); i++) {
+            CanvasDelta d = stack.layer(i).canvas.endCapture();
+            if (d.empty()) continue;
+            d.frame  = anim_.frame(f).id;
+            d.layer  = stack.layer(i).id;
+            d.joined = !first;
+            first = false;
+            history_.push(std::move(d));
         }
     }
-    SDL_FreeSurface(s);
 
+    checkpoint(false);
     fitCanvasInView();
-    printf("Loaded: %s (%dx%d)\n", path.c_str(), canvas_.getWidth(), canvas_.getHeight());
+    printf("Loaded: %s (%dx%d)\n", path.c_str(), layers().width(), layers().height());
+}
+
+JournalRecord Editor::record(JournalOp op) const {
+    JournalRecord r;
+    r.op    = op;
+    r.frame = anim_.current();
+    r.layer = activeLayer_;
+    return r;
+}
+
+void Editor::log(const JournalRecord& r) {
+    if (journal_ && !replaying_) journal_->append(r);
+}
+
+// Puts the editor back on the frame and layer the record was made on and
+// repeats it through the same code that made it.
+void Editor::replay(const JournalRecord& r) {
+    anim_.stop();
+    anim_.select(r.frame);
+    activeLayer_ = std::max(0, std::min(r.layer, layers().count() - 1));
+    switch (r.op) {
+    case JournalOp::Stroke:
+    case JournalOp::Line:
+    case JournalOp::Rect:
+    case JournalOp::Circle:
+    case JournalOp::Fill:
+    case JournalOp::Clear:       draw(r);              break;
+    case JournalOp::Undo:        undo();               break;
+    case JournalOp::Redo:        redo();               break;
+    case JournalOp::AddLayer:    addLayer();           break;
+    case JournalOp::RemoveLayer: removeLayer();        break;
+    case JournalOp::MoveLayer:   moveLayer(r.a);       break;
+    case JournalOp::LayerProps:
+        if (r.b >= 0 && r.b < (int)BlendMode::COUNT) setLayerProps(r.a != 0, (BlendMode)r.b, r.c);
+        break;
+    case JournalOp::AddFrame:    addFrame(r.a != 0);   break;
+    case JournalOp::RemoveFrame: removeFrame();        break;
+    case JournalOp::MoveFrame:   moveFrame(r.a);       break;
+    case JournalOp::SetFps:      setFps(r.a);          break;
+    case JournalOp::SetIndexed:  setIndexed(r.a != 0); break;
+    case JournalOp::SetPaletteEntry:
+        setPaletteEntry(r.a, r.color);
+        break;
+    case JournalOp::Quantize:
+        if (r.b >= 0 && r.b < (int)Dither::COUNT) quantizeLayer(r.a, (Dither)r.b);
+        break;
+    case JournalOp::Filter: {
+        if (r.points.size() != 1 || r.points[0].x < 0 || r.points[0].x >= (int)FilterType::COUNT) break;
+        Filter f;
+        f.type = (FilterType)r.points[0].x;
+        f.a = r.a;
+        f.b = r.b;
+        f.c = r.c;
+        uint32_t from = (uint32_t)r.d;
+        f.from = {(uint8_t)from, (uint8_t)(from >> 8), (uint8_t)(from >> 16), (uint8_t)(from >> 24)};
+        f.to = r.color;
+        replayFilters_.push_back(f);
+        if (!r.points[0].y) {
+            filterLayer(replayFilters_);
+            replayFilters_.clear();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Editor::recover() {
+    std::string path;
+    std::vector<JournalRecord> records;
+    int next = 0;
+    bool found = Journal::recover(RECOVERY_BASE, path, records, next);
+    if (found) {
+        Animation anim(1, 1);
+        ProjectInfo info;
+        if (loadProject(path, anim, info, &history_)) {
+            anim_ = std::move(anim);
+            activeLayer_ = info.activeLayer;
+            fgColor_ = info.fg;
+            bgColor_ = info.bg;
+            replaying_ = true;
+            for (const JournalRecord& r : records) replay(r);
+            replaying_ = false;
+            recovered_ = true;
+            printf("Recovered session: %d edits since the last checkpoint\n", (int)records.size());
+            showStatus("Recovered unsaved work");
+        } else {
+            printf("Failed to recover session: %s\n", path.c_str());
+        }
+    }
+    // Without a recovered state to follow on from, the first segment is
+    // only usable once its checkpoint is saved.
+    journal_.reset(new Journal(RECOVERY_BASE, next, recovered_));
+    saveCheckpoint(next);
+}
+
+void Editor::checkpoint(bool replayable) {
+    if (!journal_) return;
+    commitEdit();
+    saveCheckpoint(journal_->rotate(replayable));
+}
+
+void Editor::saveCheckpoint(int segment) {
+    saver_.saveProject(anim_, projectInfo(), journal_->checkpointPath(segment), &history_);
+    checkpoints_.push_back(segment);
 }
 
 void Editor::fillRect(int x, int y, int w, int h, const Color& c) {
-    SDL_SetRenderDrawColor(renderer_, c.r, c.g, c.b, c.a);
-    SDL_Rect r = {x, y, w, h};
-    SDL_RenderFillRect(renderer_, &r);
+    batch_.fillRect(x, y, w, h, c);
 }
 
 void Editor::outlineRect(int x, int y, int w, int h, const Color& c) {
-    SDL_SetRenderDrawColor(renderer_, c.r, c.g, c.b, c.a);
-    SDL_Rect r = {x, y, w, h};
-    SDL_RenderDrawRect(renderer_, &r);
+    batch_.outlineRect(x, y, w, h, c);
 }
 
 void Editor::drawText(int x, int y, const char* text, const Color& c, int scale) {
-    SDL_SetRenderDrawColor(renderer_, c.r, c.g, c.b, c.a);
-    for (const char* p = text; *p; p++) {
-        int ch = (int)(unsigned char)*p;
-        if (ch < 32 || ch > 126) ch = '?';
-        const uint8_t* glyph = FONT_5X7[ch - 32];
-        for (int row = 0; row < FONT_GLYPH_H; row++) {
-            uint8_t bits = glyph[row];
-            for (int col = 0; col < FONT_GLYPH_W; col++) {
-                if (bits & (1 << (4 - col))) {
-                    SDL_Rect pr = {x + col * scale, y + row * scale, scale, scale};
-                    SDL_RenderFillRect(renderer_, &pr);
-                }
-            }
-        }
-        x += FONT_CHAR_W * scale;
-    }
+    batch_.text(x, y, text, c, scale);
 }
 
 int Editor::textWidth(const char* text, int scale) const {
@@ -567,17 +1192,86 @@ void Editor::renderTooltip(int x, int y, const char* text) {
     drawText(tx + pad, ty + pad, text, {230, 230, 230, 255}, 1);
 }
 
-void Editor::render() {
+bool Editor::render() {
+    // Each panel is drawn again only when what it shows changed, and the
+    // frame is presented only when a panel or the overlay on top did.
+    int cur = anim_.current();
+    auto frameId = [&](int i) { return i >= 0 && i < anim_.count() ? anim_.frame(i).id : -1; };
+    float ox, oy;
+    canvasOrigin(ox, oy);
+    const Canvas& composite = layers().composite();
+    if (composite.isDirty()) {
+        canvasView_.invalidate();
+        navigatorPanel_.invalidate();
+    }
+    bool changed = redraw_;
+    changed |= canvasView_.update({0, canvasAreaTop(), winW_, canvasAreaHeight()},
+        panelKey(ox, oy, zoom_, composite.getWidth(), composite.getHeight(), showGrid_, onionSkin_,
+                 anim_.playing(), frameId(cur - 1), frameId(cur), frameId(cur + 1)));
+    changed |= toolbarPanel_.update({0, 0, winW_, TOOLBAR_H},
+        panelKey(currentTool_, hoverToolIdx_, hoverGrid_, showGrid_, hoverFgBg_, fgColor_, bgColor_));
+    changed |= timelinePanel_.update({0, canvasAreaBottom(), winW_, TIMELINE_H},
+        panelKey(cur, anim_.count(), anim_.playing(), anim_.fps(), onionSkin_));
+    std::string key = panelKey(fgColor_, bgColor_, hoverSwatchIdx_, hoverEntryIdx_);
+    if (const Palette* pal = canvas().palette().get())
+        key.append(reinterpret_cast<const char*>(pal->data()), pal->size() * sizeof(Color));
+    changed |= palettePanel_.update({0, winH_ - PALETTE_H - STATUS_H, winW_, PALETTE_H}, key);
+    changed |= statusPanel_.update({0, winH_ - STATUS_H, winW_, STATUS_H}, statusKey(composite));
+    SDL_Rect nav = {0, 0, 0, 0};
+    float navScale = 0;
+    bool navigator = navigatorRect(nav, navScale);
+    if (navigator) {
+        nav = {nav.x - NAV_BORDER, nav.y - NAV_BORDER, nav.w + NAV_BORDER * 2, nav.h + NAV_BORDER * 2};
+    }
+    changed |= navigatorPanel_.update(nav, panelKey(navigator, ox, oy, zoom_, winW_, canvasAreaHeight()));
+
+    Point end = dragging_ ? screenToCanvas(mouseX_, mouseY_) : Point{0, 0};
+    key = panelKey(cursorCX_, cursorCY_, currentTool_, fgColor_, dragging_, dragStart_, end,
+                   hoverToolIdx_, hoverGrid_, hoverFgBg_, hoverSwatchIdx_, hoverEntryIdx_);
+    changed |= key != overlayKey_;
+    if (!changed) return false;
+    overlayKey_.swap(key);
+    redraw_ = false;
+
     SDL_SetRenderDrawColor(renderer_, 42, 42, 46, 255);
     SDL_RenderClear(renderer_);
 
-    renderCanvas();
-    if (showGrid_ && zoom_ >= 4.0f) renderGrid();
+    if (canvasView_.begin()) {
+        renderCanvas();
+        if (showGrid_ && zoom_ >= 4.0f) renderGrid();
+        canvasView_.end();
+    }
+    layers().clearDirty();
+    canvasView_.draw();
     if (dragging_) renderShapePreview();
     renderCursor();
-    renderToolbar();
-    renderPalette();
-    renderStatusBar();
+    if (navigator) {
+        if (navigatorPanel_.begin()) {
+            renderNavigator();
+            navigatorPanel_.end();
+        }
+        navigatorPanel_.draw();
+    }
+    if (toolbarPanel_.begin()) {
+        renderToolbar();
+        toolbarPanel_.end();
+    }
+    toolbarPanel_.draw();
+    if (timelinePanel_.begin()) {
+        renderTimeline();
+        timelinePanel_.end();
+    }
+    timelinePanel_.draw();
+    if (palettePanel_.begin()) {
+        renderPalette();
+        palettePanel_.end();
+    }
+    palettePanel_.draw();
+    if (statusPanel_.begin()) {
+        renderStatusBar();
+        statusPanel_.end();
+    }
+    statusPanel_.draw();
     if (hoverToolIdx_ >= 0) {
         int bx = TOOL_BTN_PAD + hoverToolIdx_ * (TOOL_BTN_SIZE + TOOL_BTN_PAD);
         char tip[64];
@@ -597,48 +1291,67 @@ void Editor::render() {
         char tip[64];
         snprintf(tip, sizeof(tip), "L:FG R:BG  #%02X%02X%02X", sc.r, sc.g, sc.b);
         renderTooltip(sx, paletteY - 8, tip);
+    } else if (hoverEntryIdx_ >= 0) {
+        SDL_Rect r;
+        paletteEntryRect(hoverEntryIdx_, r);
+        Color sc = (*canvas().palette())[hoverEntryIdx_];
+        char tip[64];
+        snprintf(tip, sizeof(tip), "%d  L:FG R:BG Shift:set  #%02X%02X%02X", hoverEntryIdx_, sc.r, sc.g, sc.b);
+        renderTooltip(r.x, winH_ - PALETTE_H - STATUS_H - 8, tip);
     }
 
+    batch_.flush();
     SDL_RenderPresent(renderer_);
+    return true;
+}
+
+std::string Editor::statusKey(const Canvas& composite) const {
+    bool saving  = saver_.busy();
+    bool message = !saving && !statusMsg_.empty() && SDL_GetTicks() < statusUntil_;
+    bool cursor  = cursorCX_ >= 0 && cursorCY_ >= 0 && composite.inBounds(cursorCX_, cursorCY_);
+    const Layer& layer = layers().layer(activeLayer_);
+    std::string key = panelKey(currentTool_, fillOpts_.tolerance, fillOpts_.diagonal,
+        saving ? (int)(saver_.progress() * 100) : -1, cursor ? cursorCX_ : -1, cursorCY_,
+        cursor ? composite.getPixel(cursorCX_, cursorCY_) : Color(), anim_.current(), anim_.count(),
+        activeLayer_, layers().count(), layer.blend, layer.opacity, layer.visible,
+        layer.canvas.indexed(), layers().width(), layers().height(), zoom_,
+        history_.undoCount());
+    if (message) key += statusMsg_;
+    return key;
 }
 
 void Editor::renderCanvas() {
     float ox, oy;
     canvasOrigin(ox, oy);
-    int cw = canvas_.getWidth(), ch = canvas_.getHeight();
-    int izoom = std::max(1, (int)std::round(zoom_));
+    int cw = layers().width(), ch = layers().height();
     fillRect(0, canvasAreaTop(), winW_, canvasAreaHeight(), {56, 56, 60, 255});
     int shadowOff = 4;
     int bx = (int)ox, by = (int)oy;
     int bw = (int)(cw * zoom_), bh = (int)(ch * zoom_);
     fillRect(bx + shadowOff, by + shadowOff, bw, bh, {0, 0, 0, 60});
 
-    for (int cy = 0; cy < ch; cy++) {
-        for (int cx = 0; cx < cw; cx++) {
-            int sx = (int)(ox + cx * zoom_);
-            int sy = (int)(oy + cy * zoom_);
-            int snx = (int)(ox + (cx + 1) * zoom_);
-            int sny = (int)(oy + (cy + 1) * zoom_);
-            int pw = snx - sx;
-            int ph = sny - sy;
-            if (sx + pw < 0 || sx > winW_) continue;
-            if (sy + ph < canvasAreaTop() || sy > canvasAreaBottom()) continue;
-
-            Color pc = canvas_.getPixel(cx, cy);
-            if (pc.a < 255) {
-                int checker = ((cx + cy) % 2 == 0) ? 200 : 240;
-                fillRect(sx, sy, pw, ph, {(uint8_t)checker, (uint8_t)checker, (uint8_t)checker, 255});
-                if (pc.a > 0) {
-                    float a = pc.a / 255.0f;
-                    uint8_t br = (uint8_t)(pc.r * a + checker * (1 - a));
-                    uint8_t bg = (uint8_t)(pc.g * a + checker * (1 - a));
-                    uint8_t bb = (uint8_t)(pc.b * a + checker * (1 - a));
-                    fillRect(sx, sy, pw, ph, {br, bg, bb, 255});
-                }
-            } else {
-                fillRect(sx, sy, pw, ph, pc);
-            }
-        }
+    // The textures pick out changed tiles themselves; a frame that shares
+    // most tiles with the previous one uploads only the difference. They
+    // draw into the canvas view, whose top left is `to` in the window.
+    SDL_Point to = canvasView_.origin();
+    SDL_Rect area = {-to.x, canvasAreaTop() - to.y, winW_, canvasAreaHeight()};
+    float tx = ox - to.x, ty = oy - to.y;
+    batch_.flush();
+    // Zoomed out, the canvas is drawn from the level of its pyramid that
+    // is closest to the screen in size, so the cost follows the window
+    // rather than the canvas. Onion skins are left out there.
+    int level = MipPyramid::levelFor(zoom_);
+    if (level > 0) {
+        lodTex_.draw(pyramid_.level(layers().composite(), level), tx, ty, zoom_ * (1 << level), area);
+    } else {
+        canvasTex_.draw(layers().composite(), tx, ty, zoom_, area);
+    }
+    if (level == 0 && onionSkin_ && !anim_.playing()) {
+        int cur = anim_.current();
+        if (cur > 0)
+            onionPrev_.draw(anim_.frame(cur - 1).layers.composite(), tx, ty, zoom_, area, 72);
+        if (cur + 1 < anim_.count())
+            onionNext_.draw(anim_.frame(cur + 1).layers.composite(), tx, ty, zoom_, area, 40);
     }
     outlineRect(bx - 1, by - 1, bw + 2, bh + 2, {130, 130, 135, 255});
 }
@@ -646,22 +1359,25 @@ void Editor::renderCanvas() {
 void Editor::renderGrid() {
     float ox, oy;
     canvasOrigin(ox, oy);
-    int cw = canvas_.getWidth(), ch = canvas_.getHeight();
+    int cw = layers().width(), ch = layers().height();
 
-    uint8_t gridAlpha = (zoom_ < 8.0f) ? 20 : 35;
-    SDL_SetRenderDrawColor(renderer_, 0, 0, 0, gridAlpha);
+    Color gridColor(0, 0, 0, zoom_ < 8.0f ? 20 : 35);
 
-    for (int x = 0; x <= cw; x++) {
+    int x0 = std::max(0, (int)std::floor(-ox / zoom_));
+    int x1 = std::min(cw, (int)std::ceil((winW_ - ox) / zoom_));
+    int y0 = std::max(0, (int)std::floor((canvasAreaTop() - oy) / zoom_));
+    int y1 = std::min(ch, (int)std::ceil((canvasAreaBottom() - oy) / zoom_));
+    for (int x = x0; x <= x1; x++) {
         int sx = (int)(ox + x * zoom_);
         if (sx >= 0 && sx <= winW_)
-            SDL_RenderDrawLine(renderer_, sx, std::max((int)oy, canvasAreaTop()),
-                               sx, std::min((int)(oy + ch * zoom_), canvasAreaBottom()));
+            batch_.line(sx, std::max((int)oy, canvasAreaTop()),
+                        sx, std::min((int)(oy + ch * zoom_), canvasAreaBottom()), gridColor);
     }
-    for (int y = 0; y <= ch; y++) {
+    for (int y = y0; y <= y1; y++) {
         int sy = (int)(oy + y * zoom_);
         if (sy >= canvasAreaTop() && sy <= canvasAreaBottom())
-            SDL_RenderDrawLine(renderer_, std::max((int)ox, 0), sy,
-                               std::min((int)(ox + cw * zoom_), winW_), sy);
+            batch_.line(std::max((int)ox, 0), sy,
+                        std::min((int)(ox + cw * zoom_), winW_), sy, gridColor);
     }
 }
 
@@ -669,40 +1385,46 @@ void Editor::renderShapePreview() {
     if (!dragging_) return;
     Point end = screenToCanvas(mouseX_, mouseY_);
 
-    std::vector<Point> pts;
+    float ox, oy;
+    canvasOrigin(ox, oy);
+    Color c = {fgColor_.r, fgColor_.g, fgColor_.b, 160};
+    int cw = layers().width(), ch = layers().height();
+
+    // One screen rectangle per canvas run, clipped to the canvas.
+    auto span = [&](int x0, int x1, int y) {
+        if (y < 0 || y >= ch) return;
+        x0 = std::max(x0, 0);
+        x1 = std::min(x1, cw - 1);
+        if (x0 > x1) return;
+        int sx  = (int)(ox + x0 * zoom_);
+        int sy  = (int)(oy + y * zoom_);
+        int snx = (int)(ox + (x1 + 1) * zoom_);
+        int sny = (int)(oy + (y + 1) * zoom_);
+        fillRect(sx, sy, snx - sx, sny - sy, c);
+    };
+    auto point = [&](int x, int y) { span(x, x, y); };
+
     switch (currentTool_) {
     case Tool::Line:
-        pts = Canvas::linePoints(dragStart_.x, dragStart_.y, end.x, end.y);
+        Canvas::visitLine(dragStart_.x, dragStart_.y, end.x, end.y, point);
         break;
     case Tool::Rectangle:
-        pts = Canvas::rectPoints(dragStart_.x, dragStart_.y, end.x, end.y);
+        Canvas::visitRectSpans(dragStart_.x, dragStart_.y, end.x, end.y, span);
         break;
     case Tool::Circle: {
         int dx = end.x - dragStart_.x;
         int dy = end.y - dragStart_.y;
         int radius = (int)std::round(std::sqrt(dx * dx + dy * dy));
-        pts = Canvas::circlePoints(dragStart_.x, dragStart_.y, radius);
+        Canvas::visitCircle(dragStart_.x, dragStart_.y, radius, point);
         break;
     }
     default: break;
     }
-
-    float ox, oy;
-    canvasOrigin(ox, oy);
-
-    for (auto& p : pts) {
-        if (!canvas_.inBounds(p.x, p.y)) continue;
-        int sx = (int)(ox + p.x * zoom_);
-        int sy = (int)(oy + p.y * zoom_);
-        int snx = (int)(ox + (p.x + 1) * zoom_);
-        int sny = (int)(oy + (p.y + 1) * zoom_);
-        fillRect(sx, sy, snx - sx, sny - sy, {fgColor_.r, fgColor_.g, fgColor_.b, 160});
-    }
 }
 
 void Editor::renderCursor() {
     if (cursorCX_ < 0 || cursorCY_ < 0) return;
-    if (!canvas_.inBounds(cursorCX_, cursorCY_)) return;
+    if (!canvas().inBounds(cursorCX_, cursorCY_)) return;
 
     float ox, oy;
     canvasOrigin(ox, oy);
@@ -715,17 +1437,47 @@ void Editor::renderCursor() {
     outlineRect(sx - 1, sy - 1, pw + 2, ph + 2, {0, 0, 0, 160});
     if (currentTool_ == Tool::Eraser && zoom_ >= 8) {
         int cx = sx + pw / 2, cy = sy + ph / 2;
-        SDL_SetRenderDrawColor(renderer_, 255, 80, 80, 200);
-        SDL_RenderDrawLine(renderer_, cx - 2, cy - 2, cx + 2, cy + 2);
-        SDL_RenderDrawLine(renderer_, cx + 2, cy - 2, cx - 2, cy + 2);
+        batch_.line(cx - 2, cy - 2, cx + 2, cy + 2, {255, 80, 80, 200});
+        batch_.line(cx + 2, cy - 2, cx - 2, cy + 2, {255, 80, 80, 200});
     } else if (currentTool_ == Tool::ColorPicker && zoom_ >= 8) {
         int cx = sx + pw / 2, cy = sy + ph / 2;
-        SDL_SetRenderDrawColor(renderer_, 255, 255, 0, 200);
-        SDL_RenderDrawLine(renderer_, cx - 4, cy, cx + 4, cy);
-        SDL_RenderDrawLine(renderer_, cx, cy - 4, cx, cy + 4);
+        batch_.line(cx - 4, cy, cx + 4, cy, {255, 255, 0, 200});
+        batch_.line(cx, cy - 4, cx, cy + 4, {255, 255, 0, 200});
     }
 }
 
+void Editor::renderNavigator() {
+    SDL_Rect r;
+    float scale;
+    if (!navigatorRect(r, scale)) return;
+    int cw = layers().width(), ch = layers().height();
+    fillRect(r.x - NAV_BORDER, r.y - NAV_BORDER, r.w + NAV_BORDER * 2, r.h + NAV_BORDER * 2, {32, 32, 36, 255});
+    outlineRect(r.x - NAV_BORDER, r.y - NAV_BORDER, r.w + NAV_BORDER * 2, r.h + NAV_BORDER * 2, {100, 100, 110, 255});
+
+    // The whole canvas, from the same pyramid as the zoomed out view: while
+    // painting only the levels above the painted tiles change, and only
+    // those tiles are uploaded again.
+    SDL_Point to = navigatorPanel_.origin();
+    SDL_Rect clip = {r.x - to.x, r.y - to.y, r.w, r.h};
+    const Canvas& composite = layers().composite();
+    int level = MipPyramid::levelFor(scale);
+    batch_.flush();
+    navTex_.draw(level > 0 ? pyramid_.level(composite, level) : composite, (float)clip.x, (float)clip.y,
+                 scale * (1 << level), clip);
+
+    float ox, oy;
+    canvasOrigin(ox, oy);
+    float x0 = std::max(0.0f, -ox / zoom_);
+    float y0 = std::max(0.0f, (canvasAreaTop() - oy) / zoom_);
+    float x1 = std::min((float)cw, (winW_ - ox) / zoom_);
+    float y1 = std::min((float)ch, (canvasAreaBottom() - oy) / zoom_);
+    if (x1 <= x0 || y1 <= y0) return;
+    int vx = r.x + (int)(x0 * scale), vy = r.y + (int)(y0 * scale);
+    int vw = std::max(2, std::min((int)std::ceil(x1 * scale), r.w) - (int)(x0 * scale));
+    int vh = std::max(2, std::min((int)std::ceil(y1 * scale), r.h) - (int)(y0 * scale));
+    outlineRect(vx, vy, vw, vh, {255, 220, 80, 255});
+}
+
 void Editor::renderToolbar() {
     fillRect(0, 0, winW_, TOOLBAR_H, {32, 32, 36, 255});
     fillRect(0, TOOLBAR_H - 1, winW_, 1, {22, 22, 26, 255});
@@ -793,6 +1545,30 @@ void Editor::renderToolbar() {
     drawText(previewX + 7, previewY + 26, "X", {140, 140, 145, 255}, 1);
 }
 
+void Editor::renderTimeline() {
+    int timelineY = canvasAreaBottom();
+    fillRect(0, timelineY, winW_, TIMELINE_H, {28, 28, 32, 255});
+    fillRect(0, timelineY, winW_, 1, {22, 22, 26, 255});
+
+    // Keep the current frame in view when there are more cells than fit.
+    int visible = (winW_ - 120) / FRAME_CELL_W;
+    int first = std::max(0, anim_.current() - visible + 1);
+    int ty = timelineY + (TIMELINE_H - FONT_GLYPH_H) / 2;
+    char buf[32];
+    for (int i = first; i < std::min(anim_.count(), first + visible); i++) {
+        int cx = 4 + (i - first) * FRAME_CELL_W;
+        bool cur = i == anim_.current();
+        fillRect(cx, timelineY + 3, FRAME_CELL_W - 2, TIMELINE_H - 6,
+                 cur ? Color(70, 110, 170, 255) : Color(44, 44, 50, 255));
+        snprintf(buf, sizeof(buf), "%d", i + 1);
+        drawText(cx + (FRAME_CELL_W - 2 - textWidth(buf)) / 2, ty, buf,
+                 cur ? Color(240, 240, 245, 255) : Color(150, 150, 155, 255), 1);
+    }
+    snprintf(buf, sizeof(buf), "%s %dfps%s", anim_.playing() ? "Play" : "Stop", anim_.fps(),
+             onionSkin_ ? " Onion" : "");
+    drawText(winW_ - textWidth(buf) - 8, ty, buf, {140, 140, 145, 255}, 1);
+}
+
 void Editor::renderPalette() {
     int paletteY = winH_ - PALETTE_H - STATUS_H;
 
@@ -837,6 +1613,16 @@ void Editor::renderPalette() {
 
     int labelY3 = labelY2 + 14;
     drawText(labelX, labelY3, "L:fg R:bg", {100, 100, 105, 255}, 1);
+
+    const PaletteRef& pal = canvas().palette();
+    SDL_Rect r;
+    for (int i = 0; paletteEntryRect(i, r); i++) {
+        fillRect(r.x, r.y, r.w, r.h, (*pal)[i]);
+        if (i == hoverEntryIdx_)
+            outlineRect(r.x - 1, r.y - 1, r.w + 2, r.h + 2, {255, 255, 255, 255});
+        else if ((*pal)[i] == fgColor_)
+            outlineRect(r.x - 1, r.y - 1, r.w + 2, r.h + 2, {180, 180, 190, 200});
+    }
 }
 
 void Editor::renderStatusBar() {
@@ -851,11 +1637,24 @@ void Editor::renderStatusBar() {
     snprintf(buf, sizeof(buf), "%s", toolName(currentTool_));
     drawText(x, ty, buf, {130, 180, 240, 255}, 1);
     x += textWidth(buf) + 16;
-    if (cursorCX_ >= 0 && cursorCY_ >= 0 && canvas_.inBounds(cursorCX_, cursorCY_)) {
+    if (currentTool_ == Tool::Fill) {
+        snprintf(buf, sizeof(buf), "Tol:%d %s", fillOpts_.tolerance, fillOpts_.diagonal ? "8-way" : "4-way");
+        drawText(x, ty, buf, {140, 140, 145, 255}, 1);
+        x += textWidth(buf) + 16;
+    }
+    if (saver_.busy()) {
+        snprintf(buf, sizeof(buf), "Saving %d%%", (int)(saver_.progress() * 100));
+        drawText(x, ty, buf, {230, 200, 110, 255}, 1);
+        x += textWidth(buf) + 16;
+    } else if (!statusMsg_.empty() && SDL_GetTicks() < statusUntil_) {
+        drawText(x, ty, statusMsg_.c_str(), {180, 180, 185, 255}, 1);
+        x += textWidth(statusMsg_.c_str()) + 16;
+    }
+    if (cursorCX_ >= 0 && cursorCY_ >= 0 && canvas().inBounds(cursorCX_, cursorCY_)) {
         snprintf(buf, sizeof(buf), "(%d, %d)", cursorCX_, cursorCY_);
         drawText(x, ty, buf, {180, 180, 185, 255}, 1);
         x += textWidth(buf) + 16;
-        Color cc = canvas_.getPixel(cursorCX_, cursorCY_);
+        Color cc = layers().composite().getPixel(cursorCX_, cursorCY_);
         fillRect(x, ty - 1, 10, 9, cc);
         outlineRect(x, ty - 1, 10, 9, {120, 120, 125, 255});
         x += 14;
@@ -863,8 +1662,13 @@ void Editor::renderStatusBar() {
         drawText(x, ty, buf, {140, 140, 145, 255}, 1);
         x += textWidth(buf) + 16;
     }
-    snprintf(buf, sizeof(buf), "%dx%d  %.0fx  Undo:%d",
-             canvas_.getWidth(), canvas_.getHeight(), zoom_, (int)undoStack_.size());
+    const Layer& layer = layers().layer(activeLayer_);
+    snprintf(buf, sizeof(buf), "Frame %d/%d  Layer %d/%d %s %d%%%s%s  %dx%d  %.*fx  Undo:%d",
+             anim_.current() + 1, anim_.count(), activeLayer_ + 1, layers().count(),
+             blendModeName(layer.blend),
+             (layer.opacity * 100 + 127) / 255, layer.visible ? "" : " hidden",
+             layer.canvas.indexed() ? " indexed" : "",
+             layers().width(), layers().height(), zoom_ < 1.0f ? 2 : 0, zoom_, history_.undoCount());
     int rw = textWidth(buf);
     drawText(winW_ - rw - 8, ty, buf, {120, 120, 125, 255}, 1);
 }
@@ -1,7 +1,20 @@
 #pragma once
 #include "types.h"
 #include "canvas.h"
+#include "canvas_texture.h"
+#include "draw_batch.h"
+#include "animation.h"
+#include "filter.h"
+#include "history.h"
+#include "journal.h"
+#include "mip_pyramid.h"
+#include "panel_cache.h"
+#include "quantize.h"
+#include "saver.h"
 #include <SDL2/SDL.h>
+#include <array>
+#include <deque>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -12,23 +25,52 @@ public:
 
     bool init();
     void run();
+    void openProject(const std::string& path = "artwork.tcp");
+    // True if init() restored the session of a run that did not exit cleanly.
+    bool recovered() const { return recovered_; }
 
 private:
     SDL_Window*   window_   = nullptr;
     SDL_Renderer* renderer_ = nullptr;
-    SDL_Texture*  canvasTex_ = nullptr;
-
-    Canvas canvas_;
+    CanvasTexture canvasTex_;
+    CanvasTexture onionPrev_;
+    CanvasTexture onionNext_;
+    CanvasTexture lodTex_;    // the composite's pyramid level, zoomed below 1x
+    CanvasTexture navTex_;    // the pyramid level shown in the navigator
+    MipPyramid    pyramid_;
+    DrawBatch     batch_;     // rectangles, lines and text of the frame being drawn
+    // Parts of the window kept from frame to frame, see render().
+    PanelCache  canvasView_;
+    PanelCache  toolbarPanel_;
+    PanelCache  timelinePanel_;
+    PanelCache  palettePanel_;
+    PanelCache  statusPanel_;
+    PanelCache  navigatorPanel_;
+    std::array<PanelCache*, 6> panels() {
+        return {&canvasView_, &toolbarPanel_, &timelinePanel_, &palettePanel_, &statusPanel_,
+                &navigatorPanel_};
+    }
+    std::string overlayKey_;  // cursor, shape preview and tooltip last presented
+    bool        redraw_ = true; // present the next frame even if nothing changed
+
+    Animation anim_;
+    int  activeLayer_ = 0;
+    int  editFrame_   = -1; // ids of the frame and layer being captured for undo
+    int  editLayer_   = -1;
+    bool onionSkin_   = false;
 
     Tool  currentTool_ = Tool::Pencil;
     Color fgColor_     = {0, 0, 0, 255};
     Color bgColor_     = {255, 255, 255, 255};
+    FillOptions fillOpts_;
 
+    static constexpr float MIN_ZOOM = 1.0f / 64;
     float zoom_       = 12.0f;
     float targetZoom_ = 12.0f;
     float panX_       = 0;
     float panY_       = 0;
     bool  showGrid_   = true;
+    bool  showNavigator_ = true;
 
     int winW_ = 1280;
     int winH_ = 800;
@@ -47,26 +89,52 @@ private:
     Point lastDraw_     = {0, 0};
     bool  dragging_     = false;
     bool  strokeActive_ = false;
+    bool  navDrag_      = false;
 
     int   hoverToolIdx_    = -1;
     int   hoverSwatchIdx_  = -1;
+    int   hoverEntryIdx_   = -1; // of the active layer's palette
     bool  hoverGrid_       = false;
     bool  hoverFgBg_       = false;
 
     Uint64 lastFrameTime_ = 0;
     float  deltaTime_     = 0.016f;
 
-    std::vector<std::vector<Color>> undoStack_;
-    std::vector<std::vector<Color>> redoStack_;
-    static const int MAX_UNDO = 100;
+    static const size_t UNDO_BUDGET = 64 * 1024 * 1024;
+    History history_{UNDO_BUDGET};
+
+    ImageSaver  saver_;
+    uint64_t    autosavedChange_ = 0;  // history_.changeCount() at the last autosave
+    Uint32      lastAutosave_    = 0;
+    std::string statusMsg_;
+    Uint32      statusUntil_     = 0;
+    static const Uint32 AUTOSAVE_MS  = 60 * 1000;
+    static const Uint32 STATUS_MS    = 3000;
+
+    // Every edit is journaled next to RECOVERY_BASE so a crashed session can
+    // be replayed; the files are removed on a clean exit.
+    std::unique_ptr<Journal> journal_;
+    std::deque<int>    checkpoints_;   // segments whose checkpoint is being saved
+    std::vector<Point> stroke_;        // pixels of the current pencil or eraser stroke
+    Color strokeColor_;
+    bool  replaying_ = false;
+    std::vector<Filter> replayFilters_; // chain read so far from Filter records
+    bool  recovered_ = false;
+    static constexpr const char* RECOVERY_BASE = "tinycanvas.recovery";
+    static const size_t CHECKPOINT_BYTES = 1024 * 1024;
 
     static const int TOOLBAR_H      = 48;
     static const int PALETTE_H      = 68;
     static const int STATUS_H       = 26;
+    static const int TIMELINE_H     = 22;
+    static const int FRAME_CELL_W   = 26;
     static const int TOOL_BTN_SIZE  = 36;
     static const int TOOL_BTN_PAD   = 4;
     static const int SWATCH_SIZE    = 26;
     static const int SWATCH_PAD     = 3;
+    static const int NAV_SIZE       = 160;
+    static const int NAV_MARGIN     = 10;
+    static const int NAV_BORDER     = 3;
 
     void handleEvent(const SDL_Event& e);
     void handleKeyDown(const SDL_KeyboardEvent& key);
@@ -78,30 +146,89 @@ private:
 
     bool handleToolbarClick(int x, int y, uint8_t button);
     bool handlePaletteClick(int x, int y, uint8_t button);
+    bool handleTimelineClick(int x, int y, uint8_t button);
 
     void updateHover(int x, int y);
+    // Where swatch `i` of the active layer's palette is drawn; false if the
+    // layer is not indexed or the swatch does not fit.
+    bool paletteEntryRect(int i, SDL_Rect& r) const;
+    int  paletteEntryAt(int x, int y) const;
+    // Where the navigator shows the canvas, at `scale`; false if it is
+    // switched off or the whole canvas fits in view.
+    bool navigatorRect(SDL_Rect& r, float& scale) const;
+    bool overNavigator(int x, int y) const;
+    // Centre the view on the canvas point under (x, y) in the navigator.
+    void panToNavigator(int x, int y);
 
     void applyTool(int cx, int cy, bool newStroke);
     void finishShape(int cx, int cy);
+    // Runs a drawing record (Stroke to Clear) as one undo step.
+    void draw(const JournalRecord& r);
 
     void fitCanvasInView();
     void toggleFullscreen();
     void centerCanvas();
     void updateSmoothZoom();
-
-    void pushUndo();
+    // Zoom or playback in progress: frames are drawn back to back.
+    bool animating() const { return zoom_ != targetZoom_ || anim_.playing(); }
+    // Milliseconds run() may wait for events before a timer, the next
+    // playback frame or the next zoom step is due.
+    int  idleTimeout() const;
+
+    LayerStack&       layers()       { return anim_.layers(); }
+    const LayerStack& layers() const { return anim_.layers(); }
+    Canvas& canvas() { return layers().layer(activeLayer_).canvas; }
+    void addLayer();
+    void removeLayer();
+    void selectLayer(int index);
+    void moveLayer(int delta);
+    void addFrame(bool duplicate);
+    void removeFrame();
+    void selectFrame(int index);
+    void moveFrame(int delta);
+    void togglePlayback();
+    void setLayerProps(bool visible, BlendMode blend, int opacity);
+    void setFps(int fps);
+    // Indexed mode and palette edits of the active layer, one undo step each.
+    void setIndexed(bool indexed);
+    void setPaletteEntry(int index, const Color& c);
+    void quantizeLayer(int colors, Dither dither);
+    // The whole chain is one undo step.
+    void filterLayer(const std::vector<Filter>& chain);
+
+    void beginEdit();
+    void commitEdit();
     void undo();
     void redo();
 
-    void saveFile(const std::string& path = "artwork.bmp");
-    void loadFile(const std::string& path = "artwork.bmp");
-
-    void render();
+    void saveFile(const std::string& path = "artwork.png");
+    void loadFile(const std::string& path = "artwork.png");
+    void saveProject(const std::string& path = "artwork.tcp");
+    void autosave();
+    void pollSaves();
+    void showStatus(const std::string& msg);
+    ProjectInfo projectInfo() const;
+
+    JournalRecord record(JournalOp op) const; // on the current frame and layer
+    void log(const JournalRecord& r);
+    void replay(const JournalRecord& r);
+    void recover();
+    // Starts a new journal segment and saves its checkpoint. A segment that
+    // is not `replayable` follows an import or open.
+    void checkpoint(bool replayable);
+    void saveCheckpoint(int segment);
+
+
+    // False if nothing changed, in which case no frame is presented.
+    bool render();
+    std::string statusKey(const Canvas& composite) const; // what renderStatusBar() shows
     void renderCanvas();
     void renderGrid();
     void renderShapePreview();
     void renderCursor();
+    void renderNavigator();
     void renderToolbar();
+    void renderTimeline();
     void renderPalette();
     void renderStatusBar();
     void renderTooltip(int x, int y, const char* text);
@@ -114,7 +241,7 @@ private:
     void  canvasOrigin(float& ox, float& oy) const;
     Point screenToCanvas(int sx, int sy) const;
     int   canvasAreaTop()    const { return TOOLBAR_H; }
-    int   canvasAreaBottom() const { return winH_ - PALETTE_H - STATUS_H; }
+    int   canvasAreaBottom() const { return winH_ - PALETTE_H - STATUS_H - TIMELINE_H; }
     int   canvasAreaHeight() const { return canvasAreaBottom() - canvasAreaTop(); }
     bool  inCanvasArea(int y) const { return y > canvasAreaTop() && y < canvasAreaBottom(); }
 };
@@ -0,0 +1,319 @@
+#include "canvas.h"
+#include "parallel.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace {
+
+struct Run {
+    int x0, x1, y;
+};
+
+// One bit per pixel, one word per tile row. A tile's words are allocated
+// when the first of its pixels is set, so a small fill on a big canvas
+// costs the tile table rather than the pixels.
+class TileMask {
+public:
+    static_assert(Canvas::TILE_SIZE == 64, "one word per tile row");
+
+    TileMask(int w, int h)
+        : tilesX_((w + Canvas::TILE_MASK) >> Canvas::TILE_SHIFT),
+          tiles_((size_t)tilesX_ * ((h + Canvas::TILE_MASK) >> Canvas::TILE_SHIFT)) {}
+
+    // Bits of the tile row holding (x, y).
+    uint64_t row(int x, int y) const {
+        const auto& t = tiles_[tile(x, y)];
+        return t ? t[y & Canvas::TILE_MASK] : 0;
+    }
+    bool test(int x, int y) const { return (row(x, y) >> (x & Canvas::TILE_MASK)) & 1; }
+    void setRun(int x0, int x1, int y) {
+        for (int x = x0; x <= x1;) {
+            int end = std::min(x1, x | Canvas::TILE_MASK), n = end - x + 1;
+            auto& t = tiles_[tile(x, y)];
+            if (!t) t.reset(new uint64_t[Canvas::TILE_SIZE]());
+            uint64_t bits = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1) << (x & Canvas::TILE_MASK);
+            t[y & Canvas::TILE_MASK] |= bits;
+            x = end + 1;
+        }
+    }
+
+private:
+    int tilesX_;
+    std::vector<std::unique_ptr<uint64_t[]>> tiles_;
+
+    size_t tile(int x, int y) const {
+        return (size_t)(y >> Canvas::TILE_SHIFT) * tilesX_ + (x >> Canvas::TILE_SHIFT);
+    }
+};
+
+int findRoot(std::vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void unite(std::vector<int>& parent, int a, int b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a != b) parent[std::max(a, b)] = std::min(a, b);
+}
+
+} // namespace
+
+// Scanline flood fill shared by every fill mode. Pixels join the region when
+// every channel is within `tolerance` of the seed colour; `reach` is 1 for
+// 8-connected fills so spans also connect through their corners. On an
+// indexed canvas the test is made once per palette entry up front, and
+// pixels are matched and painted by index.
+class FloodFill {
+public:
+    FloodFill(Canvas& c, const Color& target, const Color& fill, uint8_t fillIndex,
+              const FillOptions& o)
+        : c_(c), target_(target), fill_(fill), fillIndex_(fillIndex), tol_(o.tolerance),
+          reach_(o.diagonal ? 1 : 0), indexed_(c.indexed()) {
+        if (indexed_) {
+            const Palette& pal = *c.palette();
+            for (size_t i = 0; i < pal.size(); i++) matchIndex_[i] = matches(pal[i]);
+        }
+    }
+
+    // False, having painted nothing, once the region passes `budget` pixels.
+    bool runSerial(int x, int y, long long budget, Rect& painted);
+    Rect runParallel(int x, int y);
+
+private:
+    Canvas& c_;
+    Color target_, fill_;
+    uint8_t fillIndex_;
+    int tol_, reach_;
+    bool indexed_;
+    bool matchIndex_[256] = {};
+
+    bool matches(const Color& p) const {
+        if (tol_ == 0) return p == target_;
+        return std::abs(p.r - target_.r) <= tol_ && std::abs(p.g - target_.g) <= tol_ &&
+               std::abs(p.b - target_.b) <= tol_ && std::abs(p.a - target_.a) <= tol_;
+    }
+    bool matchesTile(const Tile& t) const {
+        return indexed_ ? matchIndex_[t.index] : matches(t.fill);
+    }
+    bool fillable(int x, int y, const TileMask& seen) const {
+        if (seen.test(x, y)) return false;
+        return indexed_ ? matchIndex_[c_.indexAt(x, y)] : matches(c_.at(x, y));
+    }
+    int  extend(int x, int y, int dir, const TileMask& seen) const;
+    void collectRuns(int y, std::vector<Run>& out) const;
+};
+
+// Walk from a fillable pixel in direction `dir` to the last fillable one,
+// stepping over whole uniform tiles at a time where none of the row is
+// taken yet.
+int FloodFill::extend(int x, int y, int dir, const TileMask& seen) const {
+    const int S = Canvas::TILE_SHIFT, M = Canvas::TILE_MASK;
+    const TileRef* row = &c_.tiles_[(y >> S) * c_.tilesX_];
+    int last = dir > 0 ? c_.width_ - 1 : 0;
+    while (x != last) {
+        int nx = x + dir;
+        const Tile& t = *row[nx >> S];
+        if (t.uniform() && !seen.row(nx, y)) {
+            if (!matchesTile(t)) break;
+            x = dir > 0 ? std::min(last, nx | M) : (nx & ~M);
+            continue;
+        }
+        if (!fillable(nx, y, seen)) break;
+        x = nx;
+    }
+    return x;
+}
+
+// Spans are found first and painted once the whole region is known, so a
+// fill that runs over its budget leaves the canvas as it was.
+bool FloodFill::runSerial(int x, int y, long long budget, Rect& painted) {
+    int w = c_.width_, h = c_.height_;
+    int minX = x, maxX = x, minY = y, maxY = y;
+    TileMask seen(w, h);
+    std::vector<Run> spans;
+    long long area = 0;
+    std::vector<Run> stack;
+    stack.push_back({x, x, y});
+
+    while (!stack.empty()) {
+        Run r = stack.back();
+        stack.pop_back();
+        for (int px = r.x0; px <= r.x1; px++) {
+            if (!fillable(px, r.y, seen)) continue;
+            int lx = extend(px, r.y, -1, seen), rx = extend(px, r.y, 1, seen);
+            seen.setRun(lx, rx, r.y);
+            spans.push_back({lx, rx, r.y});
+            area += rx - lx + 1;
+            if (area > budget) return false;
+
+            minX = std::min(minX, lx); maxX = std::max(maxX, rx);
+            minY = std::min(minY, r.y); maxY = std::max(maxY, r.y);
+
+            int nx0 = std::max(lx - reach_, 0), nx1 = std::min(rx + reach_, w - 1);
+            if (r.y > 0)     stack.push_back({nx0, nx1, r.y - 1});
+            if (r.y < h - 1) stack.push_back({nx0, nx1, r.y + 1});
+            px = rx;
+        }
+    }
+    for (const Run& r : spans) c_.writeSpan(r.x0, r.x1, r.y, fill_, fillIndex_);
+    painted = Rect::fromCorners(minX, minY, maxX, maxY);
+    return true;
+}
+
+void FloodFill::collectRuns(int y, std::vector<Run>& out) const {
+    const int S = Canvas::TILE_SHIFT, M = Canvas::TILE_MASK;
+    int w = c_.width_;
+    int start = -1;
+    for (int x = 0; x < w;) {
+        int end = std::min(w, ((x >> S) + 1) << S);
+        const Tile& t = *c_.tiles_[(y >> S) * c_.tilesX_ + (x >> S)];
+        if (t.uniform()) {
+            // A uniform tile row either continues the current run or breaks it.
+            bool in = matchesTile(t);
+            if (in && start < 0) start = x;
+            if (!in && start >= 0) { out.push_back({start, x - 1, y}); start = -1; }
+        } else if (indexed_) {
+            const uint8_t* idx = &t.idx[(y & M) << S];
+            for (int i = x; i < end; i++) {
+                bool in = matchIndex_[idx[i & M]];
+                if (in && start < 0) start = i;
+                if (!in && start >= 0) { out.push_back({start, i - 1, y}); start = -1; }
+            }
+        } else {
+            const Color* px = &t.px[(y & M) << S];
+            for (int i = x; i < end; i++) {
+                bool in = matches(px[i & M]);
+                if (in && start < 0) start = i;
+                if (!in && start >= 0) { out.push_back({start, i - 1, y}); start = -1; }
+            }
+        }
+        x = end;
+    }
+    if (start >= 0) out.push_back({start, w - 1, y});
+}
+
+// Large fills label the matching spans of the whole canvas in parallel bands
+// (union-find within each band), join the bands along their shared rows,
+// then paint every span connected to the seed, again one band per task.
+// Bands are whole tile rows, so no two threads ever write the same tile.
+Rect FloodFill::runParallel(int sx, int sy) {
+    const int h = c_.height_;
+    int rowsPerBand = (h + workerCount() * 4 - 1) / (workerCount() * 4);
+    int bandH = std::max(1, (rowsPerBand + Canvas::TILE_MASK) >> Canvas::TILE_SHIFT) << Canvas::TILE_SHIFT;
+    int bands = (h + bandH - 1) / bandH;
+
+    struct Band {
+        std::vector<Run> runs;
+        std::vector<int> rowStart;
+        std::vector<int> parent;
+        Rect painted;
+    };
+    std::vector<Band> band(bands);
+
+    auto overlaps = [&](const Run& a, const Run& b) {
+        return a.x1 + reach_ >= b.x0 && a.x0 <= b.x1 + reach_;
+    };
+    // Union the runs of two consecutive rows, both sorted by x.
+    auto joinRows = [&](std::vector<int>& parent, const Run* up, int nUp, int upBase,
+                        const Run* down, int nDown, int downBase) {
+        int i = 0;
+        for (int j = 0; j < nDown; j++) {
+            while (i < nUp && up[i].x1 + reach_ < down[j].x0) i++;
+            for (int k = i; k < nUp && up[k].x0 <= down[j].x1 + reach_; k++)
+                if (overlaps(up[k], down[j])) unite(parent, upBase + k, downBase + j);
+        }
+    };
+
+    parallelFor(bands, [&](int b) {
+        Band& bd = band[b];
+        int y0 = b * bandH, y1 = std::min(h, y0 + bandH);
+        for (int y = y0; y < y1; y++) {
+            bd.rowStart.push_back((int)bd.runs.size());
+            collectRuns(y, bd.runs);
+        }
+        bd.rowStart.push_back((int)bd.runs.size());
+        bd.parent.resize(bd.runs.size());
+        for (size_t i = 0; i < bd.parent.size(); i++) bd.parent[i] = (int)i;
+        for (int r = 1; r < y1 - y0; r++) {
+            int a = bd.rowStart[r - 1], m = bd.rowStart[r], e = bd.rowStart[r + 1];
+            joinRows(bd.parent, bd.runs.data() + a, m - a, a, bd.runs.data() + m, e - m, m);
+        }
+    });
+
+    std::vector<int> offset(bands + 1, 0);
+    for (int b = 0; b < bands; b++) offset[b + 1] = offset[b] + (int)band[b].runs.size();
+    std::vector<int> parent(offset[bands]);
+    for (int b = 0; b < bands; b++)
+        for (size_t i = 0; i < band[b].parent.size(); i++)
+            parent[offset[b] + i] = offset[b] + band[b].parent[i];
+
+    for (int b = 1; b < bands; b++) {
+        Band& up = band[b - 1];
+        Band& down = band[b];
+        int ua = up.rowStart[up.rowStart.size() - 2], ue = up.rowStart.back();
+        int de = down.rowStart[1];
+        if (ue > ua && de > 0)
+            joinRows(parent, up.runs.data() + ua, ue - ua, offset[b - 1] + ua,
+                     down.runs.data(), de, offset[b]);
+    }
+
+    const Band& seedBand = band[sy / bandH];
+    int r = sy - (sy / bandH) * bandH;
+    int seed = -1;
+    for (int i = seedBand.rowStart[r]; i < seedBand.rowStart[r + 1]; i++) {
+        if (seedBand.runs[i].x0 <= sx && sx <= seedBand.runs[i].x1) {
+            seed = offset[sy / bandH] + i;
+            break;
+        }
+    }
+    if (seed < 0) return {};
+
+    int root = findRoot(parent, seed);
+    std::vector<char> inRegion(parent.size());
+    for (size_t i = 0; i < parent.size(); i++)
+        inRegion[i] = findRoot(parent, (int)i) == root;
+
+    parallelFor(bands, [&](int b) {
+        Band& bd = band[b];
+        for (size_t i = 0; i < bd.runs.size(); i++) {
+            if (!inRegion[offset[b] + i]) continue;
+            const Run& run = bd.runs[i];
+            c_.writeSpan(run.x0, run.x1, run.y, fill_, fillIndex_);
+            bd.painted = bd.painted.united({run.x0, run.y, run.x1 - run.x0 + 1, 1});
+        }
+        c_.compact(bd.painted);
+    });
+
+    Rect painted;
+    for (auto& bd : band) painted = painted.united(bd.painted);
+    return painted;
+}
+
+void Canvas::floodFill(int x, int y, const Color& newColor, const FillOptions& opts) {
+    if (!inBounds(x, y)) return;
+    Color target = at(x, y);
+    // With a tolerance, pixels near the seed colour change even if it does not.
+    if (opts.tolerance == 0 && target == newColor) return;
+    // Looked up before the fill reads the palette; it may add an entry.
+    uint8_t i = ink(newColor);
+    if (opts.tolerance == 0 && palette_ && indexAt(x, y) == i) return;
+
+    // Labelling costs the whole canvas, so it only takes over from the
+    // span fill once a region has turned out to be big.
+    FloodFill fill(*this, target, newColor, i, opts);
+    bool parallel = opts.parallel && workerCount() > 1 &&
+                    (long long)width_ * height_ >= PARALLEL_FILL_MIN_AREA;
+    Rect filled;
+    bool serial = fill.runSerial(x, y, parallel ? PARALLEL_FILL_MIN_PIXELS : LLONG_MAX, filled);
+    if (!serial) filled = fill.runParallel(x, y);
+    markDirty(filled);
+    if (serial) compact(filled);
+}
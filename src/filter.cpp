@@ -0,0 +1,442 @@
+#include "filter.h"
+#include "kernels.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+const int S           = Canvas::TILE_SIZE;
+const int TILE_PIXELS = S * S;
+
+uint8_t clamp8(int v) { return (uint8_t)std::max(0, std::min(255, v)); }
+
+Color adjustHsl(const Color& c, int hue, int sat, int light) {
+    double r = c.r / 255.0, g = c.g / 255.0, b = c.b / 255.0;
+    double mx = std::max({r, g, b}), mn = std::min({r, g, b});
+    double l = (mx + mn) / 2, d = mx - mn, h = 0, s = 0;
+    if (d > 0) {
+        s = std::min(1.0, d / (1 - std::fabs(2 * l - 1)));
+        if (mx == r)      h = (g - b) / d;
+        else if (mx == g) h = (b - r) / d + 2;
+        else              h = (r - g) / d + 4;
+    }
+    // In [0, 6) after at most two steps: h starts in [-1, 5).
+    h += (hue % 360) / 60.0;
+    while (h < 0) h += 6;
+    while (h >= 6) h -= 6;
+    s = std::min(1.0, s * (1 + sat / 100.0));
+    l = light < 0 ? l * (1 + light / 100.0) : l + (1 - l) * light / 100.0;
+
+    double chroma = (1 - std::fabs(2 * l - 1)) * s;
+    int segment = std::min((int)h, 5);
+    double x = chroma * (1 - std::fabs(h - (segment & ~1) - 1)), m = l - chroma / 2;
+    double out[3];
+    switch (segment) {
+    case 0:  out[0] = chroma; out[1] = x;      out[2] = 0;      break;
+    case 1:  out[0] = x;      out[1] = chroma; out[2] = 0;      break;
+    case 2:  out[0] = 0;      out[1] = chroma; out[2] = x;      break;
+    case 3:  out[0] = 0;      out[1] = x;      out[2] = chroma; break;
+    case 4:  out[0] = x;      out[1] = 0;      out[2] = chroma; break;
+    default: out[0] = chroma; out[1] = 0;      out[2] = x;      break;
+    }
+    auto u8 = [&](double v) { return clamp8((int)((v + m) * 255 + 0.5)); };
+    return {u8(out[0]), u8(out[1]), u8(out[2]), c.a};
+}
+
+// A per-pixel filter made ready to run, with a table for brightness and
+// contrast, which treat each colour channel alike.
+class PointFilter {
+public:
+    explicit PointFilter(const Filter& f) : f_(f) {
+        if (f.type != FilterType::BrightnessContrast) return;
+        int c = std::max(-100, std::min(f.b, 99));
+        double k = c >= 0 ? 100.0 / (100 - c) : (100 + c) / 100.0;
+        for (int v = 0; v < 256; v++) lut_[v] = clamp8((int)std::lround((v + f.a - 128) * k + 128));
+    }
+
+    Color operator()(const Color& c) const {
+        switch (f_.type) {
+        case FilterType::HueSaturation:
+            return adjustHsl(c, f_.a, f_.b, f_.c);
+        case FilterType::BrightnessContrast:
+            return {lut_[c.r], lut_[c.g], lut_[c.b], c.a};
+        case FilterType::ReplaceColor:
+            if (std::abs(c.r - f_.from.r) <= f_.a && std::abs(c.g - f_.from.g) <= f_.a &&
+                std::abs(c.b - f_.from.b) <= f_.a && std::abs(c.a - f_.from.a) <= f_.a)
+                return f_.to;
+            return c;
+        case FilterType::Channels:
+            return channels(c);
+        default:
+            return c;
+        }
+    }
+
+private:
+    Filter  f_;
+    uint8_t lut_[256];
+
+    Color channels(const Color& c) const {
+        switch ((ChannelOp)f_.a) {
+        case ChannelOp::Invert: {
+            int bits = f_.b ? f_.b : 7;
+            return {(uint8_t)(bits & 1 ? 255 - c.r : c.r), (uint8_t)(bits & 2 ? 255 - c.g : c.g),
+                    (uint8_t)(bits & 4 ? 255 - c.b : c.b), (uint8_t)(bits & 8 ? 255 - c.a : c.a)};
+        }
+        case ChannelOp::Grayscale: {
+            uint8_t y = (uint8_t)((77 * c.r + 150 * c.g + 29 * c.b + 128) >> 8);
+            return {y, y, y, c.a};
+        }
+        case ChannelOp::Extract: {
+            const uint8_t v[4] = {c.r, c.g, c.b, c.a};
+            uint8_t y = v[std::max(0, std::min(f_.b, 3))];
+            return {y, y, y, 255};
+        }
+        case ChannelOp::SwapRB:
+            return {c.b, c.g, c.r, c.a};
+        default:
+            return c;
+        }
+    }
+};
+
+using Points = std::vector<PointFilter>;
+
+Color runPoints(const Points& fs, Color c) {
+    for (const PointFilter& f : fs) c = f(c);
+    return c;
+}
+
+// Neighbouring pixels are often the same colour, so each result is reused
+// until the colour changes.
+void runPoints(const Points& fs, Color* px, int n) {
+    if (fs.empty() || n == 0) return;
+    Color in = px[0], out = runPoints(fs, in);
+    for (int i = 0; i < n; i++) {
+        if (px[i] != in) out = runPoints(fs, in = px[i]);
+        px[i] = out;
+    }
+}
+
+// One pass over the canvas: per-pixel filters, optionally a blur or outline
+// and more per-pixel filters after it.
+struct Stage {
+    Points before, after;
+    const Filter* area = nullptr;
+
+    int  reach() const { return area ? std::min(area->a, MAX_FILTER_RADIUS) : 0; }
+    bool empty() const { return before.empty() && after.empty() && !area; }
+};
+
+// Copy `r` out of the canvas, which it must overlap, extending the edge
+// pixels outwards.
+void readClamped(const Canvas& c, const Rect& r, Color* dst) {
+    int x0 = std::max(r.x, 0), x1 = std::min(r.right(), c.getWidth());
+    for (int y = 0; y < r.h; y++) {
+        int sy = std::max(0, std::min(r.y + y, c.getHeight() - 1));
+        Color* row = dst + (size_t)y * r.w;
+        c.readRegion({x0, sy, x1 - x0, 1}, row + (x0 - r.x), r.w);
+        std::fill(row, row + (x0 - r.x), row[x0 - r.x]);
+        std::fill(row + (x1 - r.x), row + r.w, row[x1 - 1 - r.x]);
+    }
+}
+
+// True, with their colour, if every tile within `reach` of tile tx, ty is
+// uniformly that colour. Neither blurs nor outlines change such a tile.
+bool uniformAround(const Canvas& c, int tx, int ty, int reach, Color& fill) {
+    int x0 = std::max(0, (tx * S - reach) >> Canvas::TILE_SHIFT);
+    int y0 = std::max(0, (ty * S - reach) >> Canvas::TILE_SHIFT);
+    int x1 = std::min(c.tilesX() - 1, (tx * S + S - 1 + reach) >> Canvas::TILE_SHIFT);
+    int y1 = std::min(c.tilesY() - 1, (ty * S + S - 1 + reach) >> Canvas::TILE_SHIFT);
+    const Tile& t = *c.tileAt(tx, ty);
+    if (!t.uniform()) return false;
+    fill = c.uniformColor(t);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            const Tile& n = *c.tileAt(x, y);
+            if (!n.uniform() || c.uniformColor(n) != fill) return false;
+        }
+    }
+    return true;
+}
+
+// Separable blur of `in` (the tile and `r` pixels around it, `aw` wide)
+// with premultiplied alpha, so transparent pixels add no colour. Box
+// blurs keep running sums; gaussian ones weigh 2r + 1 taps.
+void blur(const Color* in, int aw, int r, bool gaussian, Color* out) {
+    int taps = 2 * r + 1;
+    std::vector<int> k(taps, 1);
+    if (gaussian) {
+        double sigma = std::max(r / 3.0, 0.5);
+        for (int j = 0; j < taps; j++)
+            k[j] = std::max(1, (int)std::lround(256 * std::exp(-(j - r) * (j - r) / (2 * sigma * sigma))));
+    }
+    int weight = 0;
+    for (int w : k) weight += w;
+
+    // Horizontal sums for every row of `in`, four channels per pixel.
+    std::vector<int> h((size_t)aw * S * 4);
+    for (int y = 0; y < aw; y++) {
+        const Color* row = in + (size_t)y * aw;
+        int* dst = &h[(size_t)y * S * 4];
+        int s[4] = {0, 0, 0, 0};
+        for (int x = 0; x < S; x++) {
+            if (gaussian || x == 0) {
+                s[0] = s[1] = s[2] = s[3] = 0;
+                for (int j = 0; j < taps; j++) {
+                    const Color& p = row[x + j];
+                    s[0] += k[j] * p.r * p.a;
+                    s[1] += k[j] * p.g * p.a;
+                    s[2] += k[j] * p.b * p.a;
+                    s[3] += k[j] * p.a;
+                }
+            } else {
+                const Color& add = row[x + taps - 1];
+                const Color& sub = row[x - 1];
+                s[0] += add.r * add.a - sub.r * sub.a;
+                s[1] += add.g * add.a - sub.g * sub.a;
+                s[2] += add.b * add.a - sub.b * sub.a;
+                s[3] += add.a - sub.a;
+            }
+            std::copy(s, s + 4, dst + x * 4);
+        }
+    }
+
+    const int64_t total = (int64_t)weight * weight;
+    for (int x = 0; x < S; x++) {
+        int64_t s[4] = {0, 0, 0, 0};
+        for (int y = 0; y < S; y++) {
+            if (gaussian || y == 0) {
+                s[0] = s[1] = s[2] = s[3] = 0;
+                for (int j = 0; j < taps; j++) {
+                    const int* p = &h[((size_t)(y + j) * S + x) * 4];
+                    for (int ch = 0; ch < 4; ch++) s[ch] += (int64_t)k[j] * p[ch];
+                }
+            } else {
+                const int* add = &h[((size_t)(y + taps - 1) * S + x) * 4];
+                const int* sub = &h[((size_t)(y - 1) * S + x) * 4];
+                for (int ch = 0; ch < 4; ch++) s[ch] += add[ch] - sub[ch];
+            }
+            Color& o = out[y * S + x];
+            if (s[3] == 0) {
+                o = in[(size_t)(y + r) * aw + x + r];
+                o.a = 0;
+                continue;
+            }
+            o.r = (uint8_t)std::min<int64_t>(255, (s[0] + s[3] / 2) / s[3]);
+            o.g = (uint8_t)std::min<int64_t>(255, (s[1] + s[3] / 2) / s[3]);
+            o.b = (uint8_t)std::min<int64_t>(255, (s[2] + s[3] / 2) / s[3]);
+            o.a = (uint8_t)((s[3] + total / 2) / total);
+        }
+    }
+}
+
+// Transparent pixels within `r` of a visible one take `color`. Distances
+// to the nearest visible pixel come from a two-pass distance transform
+// over `in`, which is exact for both measures.
+void outline(const Color* in, int aw, int r, bool diagonal, const Color& color, Color* out) {
+    const int FAR = 1 << 20;
+    std::vector<int> d((size_t)aw * aw);
+    for (size_t i = 0; i < d.size(); i++) d[i] = in[i].a ? 0 : FAR;
+    for (int y = 0; y < aw; y++) {
+        for (int x = 0; x < aw; x++) {
+            int& v = d[(size_t)y * aw + x];
+            if (x > 0) v = std::min(v, d[(size_t)y * aw + x - 1] + 1);
+            if (y > 0) v = std::min(v, d[(size_t)(y - 1) * aw + x] + 1);
+            if (diagonal && y > 0 && x > 0)      v = std::min(v, d[(size_t)(y - 1) * aw + x - 1] + 1);
+            if (diagonal && y > 0 && x < aw - 1) v = std::min(v, d[(size_t)(y - 1) * aw + x + 1] + 1);
+        }
+    }
+    for (int y = aw - 1; y >= 0; y--) {
+        for (int x = aw - 1; x >= 0; x--) {
+            int& v = d[(size_t)y * aw + x];
+            if (x < aw - 1) v = std::min(v, d[(size_t)y * aw + x + 1] + 1);
+            if (y < aw - 1) v = std::min(v, d[(size_t)(y + 1) * aw + x] + 1);
+            if (diagonal && y < aw - 1 && x < aw - 1) v = std::min(v, d[(size_t)(y + 1) * aw + x + 1] + 1);
+            if (diagonal && y < aw - 1 && x > 0)      v = std::min(v, d[(size_t)(y + 1) * aw + x - 1] + 1);
+        }
+    }
+    for (int y = 0; y < S; y++) {
+        for (int x = 0; x < S; x++) {
+            size_t i = (size_t)(y + r) * aw + x + r;
+            out[y * S + x] = (!in[i].a && d[i] <= r) ? color : in[i];
+        }
+    }
+}
+
+// Palette entry for a colour a blur or outline made: an equal entry if
+// there is one, else the nearest by squared RGBA distance as Canvas picks
+// them, the lower on a tie. Recent answers are kept by colour.
+class Nearest {
+public:
+    explicit Nearest(const Palette& p) : pal_(p) {
+        // No colour packs into more than 32 bits, so this key is never met.
+        std::fill(keys_, keys_ + SLOTS, ~(uint64_t)0);
+    }
+
+    uint8_t operator()(const Color& c) {
+        uint64_t key = (uint64_t)c.r | c.g << 8 | c.b << 16 | (uint64_t)c.a << 24;
+        int slot = (int)((key * 0x9E3779B1u) >> 22) & (SLOTS - 1);
+        if (keys_[slot] == key) return values_[slot];
+        int best = 0, bestDist = 1 << 30;
+        for (int i = 0; i < (int)pal_.size() && bestDist; i++) {
+            const Color& p = pal_[i];
+            int dr = c.r - p.r, dg = c.g - p.g, db = c.b - p.b, da = c.a - p.a;
+            int dist = dr * dr + dg * dg + db * db + da * da;
+            if (dist < bestDist) {
+                best = i;
+                bestDist = dist;
+            }
+        }
+        keys_[slot]   = key;
+        values_[slot] = (uint8_t)best;
+        return (uint8_t)best;
+    }
+
+private:
+    static const int SLOTS = 256;
+    const Palette& pal_;
+    uint64_t keys_[SLOTS];
+    uint8_t  values_[SLOTS];
+};
+
+TileRef rgbaTile(const TileRef& orig, const Color* px) {
+    if (orig->uniform() ? pixelsEqual(px, TILE_PIXELS, orig->fill)
+                        : std::equal(px, px + TILE_PIXELS, orig->px.data()))
+        return orig;
+    if (pixelsEqual(px, TILE_PIXELS, px[0])) return std::make_shared<Tile>(px[0]);
+    auto t = std::make_shared<Tile>(px[0]);
+    t->px.assign(TILE_PIXELS, px[0]);
+    copyPixels(t->px.data(), px, TILE_PIXELS);
+    return t;
+}
+
+TileRef indexedTile(const TileRef& orig, const Palette& pal, const Color* px) {
+    std::vector<uint8_t> idx(TILE_PIXELS);
+    Nearest nearest(pal);
+    for (int i = 0; i < TILE_PIXELS; i++) idx[i] = nearest(px[i]);
+    bool same = orig->uniform() ? std::all_of(idx.begin(), idx.end(), [&](uint8_t i) { return i == orig->index; })
+                                : std::equal(idx.begin(), idx.end(), orig->idx.data());
+    if (same) return orig;
+    if (std::all_of(idx.begin(), idx.end(), [&](uint8_t i) { return i == idx[0]; }))
+        return std::make_shared<Tile>(idx[0]);
+    auto t = std::make_shared<Tile>(idx[0]);
+    t->idx.assign(TILE_PIXELS, 0);
+    std::copy(idx.begin(), idx.end(), t->idx.data());
+    return t;
+}
+
+// Pixels of an edge tile that lie outside the canvas keep what they had.
+void keepOutside(const Canvas& c, int tx, int ty, const Tile& orig, Color* px) {
+    int w = std::min(S, c.getWidth() - tx * S), h = std::min(S, c.getHeight() - ty * S);
+    if (w == S && h == S) return;
+    for (int y = 0; y < S; y++) {
+        for (int x = y < h ? w : 0; x < S; x++) {
+            int i = y * S + x;
+            if (orig.uniform())   px[i] = c.uniformColor(orig);
+            else if (c.indexed()) px[i] = (*c.palette())[orig.idx[i]];
+            else                  px[i] = orig.px[i];
+        }
+    }
+}
+
+TileRef filterTile(const Canvas& c, const Stage& st, int tx, int ty) {
+    const TileRef& orig = c.tileAt(tx, ty);
+    int r = st.reach();
+    Color fill;
+    if (uniformAround(c, tx, ty, r, fill)) {
+        // Indexed canvases only get here for a blur or outline.
+        if (c.indexed()) return orig;
+        Color out = runPoints(st.after, runPoints(st.before, fill));
+        return out == fill ? orig : std::make_shared<Tile>(out);
+    }
+
+    std::vector<Color> out(TILE_PIXELS);
+    if (!st.area) {
+        copyPixels(out.data(), orig->px.data(), TILE_PIXELS);
+        runPoints(st.before, out.data(), TILE_PIXELS);
+    } else {
+        int aw = S + 2 * r;
+        std::vector<Color> in((size_t)aw * aw);
+        readClamped(c, {tx * S - r, ty * S - r, aw, aw}, in.data());
+        runPoints(st.before, in.data(), aw * aw);
+        if (st.area->type == FilterType::Outline)
+            outline(in.data(), aw, r, st.area->b != 0, st.area->to, out.data());
+        else
+            blur(in.data(), aw, r, st.area->type == FilterType::GaussianBlur, out.data());
+        runPoints(st.after, out.data(), TILE_PIXELS);
+        keepOutside(c, tx, ty, *orig, out.data());
+    }
+    return c.indexed() ? indexedTile(orig, *c.palette(), out.data()) : rgbaTile(orig, out.data());
+}
+
+// Every tile is filtered from the canvas as it was, so the new tiles are
+// collected in a copy of the tile table and swapped in at the end.
+void runStage(Canvas& canvas, const Stage& st) {
+    if (st.empty()) return;
+    CanvasSnapshot snap = canvas.snapshot();
+    parallelFor(canvas.tilesX() * canvas.tilesY(), [&](int i) {
+        snap.tiles[i] = filterTile(canvas, st, i % canvas.tilesX(), i / canvas.tilesX());
+    });
+    canvas.restore(snap);
+}
+
+void filterPalette(Canvas& canvas, const Points& fs) {
+    if (fs.empty()) return;
+    auto pal = std::make_shared<Palette>(*canvas.palette());
+    for (Color& c : *pal) c = runPoints(fs, c);
+    canvas.setPalette(std::move(pal));
+}
+
+} // namespace
+
+const char* filterName(FilterType t) {
+    switch (t) {
+    case FilterType::HueSaturation:      return "Hue/Saturation";
+    case FilterType::BrightnessContrast: return "Brightness/Contrast";
+    case FilterType::ReplaceColor:       return "Replace Colour";
+    case FilterType::Channels:           return "Channels";
+    case FilterType::BoxBlur:            return "Box Blur";
+    case FilterType::GaussianBlur:       return "Gaussian Blur";
+    case FilterType::Outline:            return "Outline";
+    default:                             return "?";
+    }
+}
+
+void applyFilters(Canvas& canvas, const std::vector<Filter>& chain) {
+    // An indexed canvas runs its per-pixel filters on the palette.
+    if (canvas.indexed()) {
+        Points points;
+        for (const Filter& f : chain) {
+            if (f.pointwise()) {
+                points.emplace_back(f);
+                continue;
+            }
+            if (f.a <= 0) continue;
+            filterPalette(canvas, points);
+            points.clear();
+            Stage st;
+            st.area = &f;
+            runStage(canvas, st);
+        }
+        filterPalette(canvas, points);
+        return;
+    }
+
+    Stage st;
+    for (const Filter& f : chain) {
+        if (f.pointwise()) {
+            (st.area ? st.after : st.before).emplace_back(f);
+            continue;
+        }
+        if (f.a <= 0) continue;
+        if (st.area) {
+            runStage(canvas, st);
+            st = Stage();
+        }
+        st.area = &f;
+    }
+    runStage(canvas, st);
+}
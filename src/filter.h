@@ -0,0 +1,45 @@
+#pragma once
+#include "canvas.h"
+#include <vector>
+
+enum class FilterType : uint8_t {
+    HueSaturation,      // a: hue shift in degrees, b: saturation, c: lightness (-100 to 100)
+    BrightnessContrast, // a: brightness (-255 to 255), b: contrast (-100 to 100)
+    ReplaceColor,       // pixels within a of `from` in every channel become `to`
+    Channels,           // a: ChannelOp, b: its channel (Extract) or channel bits (Invert)
+    BoxBlur,            // a: radius
+    GaussianBlur,       // a: radius, three standard deviations
+    Outline,            // transparent pixels within a of an opaque one become `to`;
+                        // b: measured 8-connected
+    COUNT
+};
+
+enum class ChannelOp : uint8_t {
+    Invert,    // channels with their bit (r 1, g 2, b 4, a 8) set in b; 0 inverts r, g and b
+    Grayscale,
+    Extract,   // channel b (0 to 3) as an opaque grey
+    SwapRB,
+    COUNT
+};
+
+struct Filter {
+    FilterType type = FilterType::BrightnessContrast;
+    int   a = 0, b = 0, c = 0;
+    Color from, to;
+
+    // Each output pixel depends on the input pixel alone.
+    bool pointwise() const { return type < FilterType::BoxBlur; }
+};
+
+const char* filterName(FilterType t);
+
+// Blur radius and outline width at most.
+const int MAX_FILTER_RADIUS = 32;
+
+// Runs `chain` over the whole canvas, with the same result as running its
+// filters one after another. Tiles are processed in parallel; consecutive
+// per-pixel filters, and those following a blur or outline, share one pass
+// over each tile, which reads the pixels around it that it needs. On an
+// indexed canvas per-pixel filters change only the palette, and blurs and
+// outlines take the nearest palette entries.
+void applyFilters(Canvas& canvas, const std::vector<Filter>& chain);
@@ -0,0 +1,125 @@
+#include "history.h"
+#include "animation.h"
+#include "layers.h"
+#include <algorithm>
+#include <utility>
+
+History::History(size_t budgetBytes) : ring_(64), budget_(budgetBytes) {}
+
+void History::push(CanvasDelta delta) {
+    if (delta.empty()) return;
+
+    // A new edit discards everything that could have been redone.
+    for (int i = cursor_; i < count_; i++) {
+        bytes_ -= at(i).bytes();
+        at(i) = CanvasDelta();
+    }
+    count_ = cursor_;
+
+    if (count_ == (int)ring_.size()) {
+        std::vector<CanvasDelta> grown(ring_.size() * 2);
+        for (int i = 0; i < count_; i++)
+            grown[i] = std::move(at(i));
+        ring_ = std::move(grown);
+        head_ = 0;
+    }
+
+    bytes_ += delta.bytes();
+    at(count_) = std::move(delta);
+    count_++;
+    cursor_ = count_;
+    changes_++;
+    trim();
+}
+
+template <class Apply>
+bool History::undoStep(Apply apply) {
+    if (!canUndo()) return false;
+    changes_++;
+    do {
+        cursor_--;
+        apply(at(cursor_), true);
+    } while (cursor_ > 0 && at(cursor_).joined);
+    return true;
+}
+
+template <class Apply>
+bool History::redoStep(Apply apply) {
+    if (!canRedo()) return false;
+    changes_++;
+    do {
+        apply(at(cursor_), false);
+        cursor_++;
+    } while (cursor_ < count_ && at(cursor_).joined);
+    return true;
+}
+
+bool History::undo(Canvas& canvas) {
+    return undoStep([&](const CanvasDelta& d, bool u) { canvas.applyDelta(d, u); });
+}
+
+bool History::redo(Canvas& canvas) {
+    return redoStep([&](const CanvasDelta& d, bool u) { canvas.applyDelta(d, u); });
+}
+
+bool History::undo(LayerStack& layers) {
+    return undoStep([&](const CanvasDelta& d, bool u) { layers.applyDelta(d, u); });
+}
+
+bool History::redo(LayerStack& layers) {
+    return redoStep([&](const CanvasDelta& d, bool u) { layers.applyDelta(d, u); });
+}
+
+bool History::undo(Animation& anim) {
+    return undoStep([&](const CanvasDelta& d, bool u) { anim.applyDelta(d, u); });
+}
+
+bool History::redo(Animation& anim) {
+    return redoStep([&](const CanvasDelta& d, bool u) { anim.applyDelta(d, u); });
+}
+
+void History::clear() {
+    for (auto& d : ring_) d = CanvasDelta();
+    head_ = count_ = cursor_ = 0;
+    bytes_ = 0;
+}
+
+void History::restore(std::vector<CanvasDelta> entries, int cursor) {
+    clear();
+    for (auto& d : entries) bytes_ += d.bytes();
+    count_  = (int)entries.size();
+    cursor_ = std::max(0, std::min(cursor, count_));
+    entries.resize(std::max(entries.size() * 2, ring_.size()));
+    ring_ = std::move(entries);
+    changes_++;
+}
+
+void History::setBudget(size_t budgetBytes) {
+    budget_ = budgetBytes;
+    trim();
+}
+
+void History::dropOldest() {
+    bytes_ -= at(0).bytes();
+    at(0) = CanvasDelta();
+    head_ = (head_ + 1) % ring_.size();
+    count_--;
+    cursor_--;
+}
+
+void History::trim() {
+    // Always keep the most recent edit, every delta of it, even if it alone
+    // is over budget; it may still be growing as a joined step is pushed.
+    // Joined deltas are dropped together with the one they belong to.
+    int last = cursor_ - 1;
+    while (last > 0 && at(last).joined) last--;
+    while (bytes_ > budget_ && last > 0) {
+        dropOldest();
+        last--;
+        while (last > 0 && at(0).joined) {
+            dropOldest();
+            last--;
+        }
+    }
+    if (count_ > 0) at(0).joined = false;
+}
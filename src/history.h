@@ -0,0 +1,59 @@
+#pragma once
+#include "canvas.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Animation;
+class LayerStack;
+
+// Undo/redo history of canvas deltas kept in a ring buffer. Old entries are
+// dropped once the stored deltas exceed the byte budget. A delta pushed with
+// `joined` set forms one step with the delta before it, e.g. one per layer
+// for a resize.
+class History {
+public:
+    explicit History(size_t budgetBytes = 64 * 1024 * 1024);
+
+    void push(CanvasDelta delta);
+    bool undo(Canvas& canvas);
+    bool redo(Canvas& canvas);
+    bool undo(LayerStack& layers);
+    bool redo(LayerStack& layers);
+    bool undo(Animation& anim);
+    bool redo(Animation& anim);
+    void clear();
+
+    // Entries oldest first; the first undoCount() of them are undoable.
+    int  count() const { return count_; }
+    const CanvasDelta& entry(int i) const { return ring_[(head_ + i) % ring_.size()]; }
+    // Replace the contents with `entries`, undone back to `cursor`, e.g.
+    // history saved with a project.
+    void restore(std::vector<CanvasDelta> entries, int cursor);
+
+    bool canUndo() const { return cursor_ > 0; }
+    bool canRedo() const { return cursor_ < count_; }
+    int  undoCount() const { return cursor_; }
+    int  redoCount() const { return count_ - cursor_; }
+    // Bumped by every push, undo and redo, to tell when the image changed.
+    uint64_t changeCount() const { return changes_; }
+
+    size_t bytesUsed() const { return bytes_; }
+    size_t budget() const { return budget_; }
+    void   setBudget(size_t budgetBytes);
+
+private:
+    std::vector<CanvasDelta> ring_;
+    int head_   = 0;
+    int count_  = 0;
+    int cursor_ = 0;
+    size_t bytes_  = 0;
+    size_t budget_ = 0;
+    uint64_t changes_ = 0;
+
+    CanvasDelta& at(int i) { return ring_[(head_ + i) % ring_.size()]; }
+    void dropOldest();
+    template <class Apply> bool undoStep(Apply apply);
+    template <class Apply> bool redoStep(Apply apply);
+    void trim();
+};
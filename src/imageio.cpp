@@ -0,0 +1,242 @@
+#include "imageio.h"
+#include "kernels.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint32_t BI_RGB       = 0;
+const uint32_t BI_BITFIELDS = 3;
+
+void put16(std::vector<uint8_t>& v, uint16_t x) {
+    v.push_back(x & 0xFF);
+    v.push_back(x >> 8);
+}
+
+void put32(std::vector<uint8_t>& v, uint32_t x) {
+    for (int i = 0; i < 4; i++) v.push_back((x >> (i * 8)) & 0xFF);
+}
+
+uint16_t get16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+uint32_t get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+// Extract the channel selected by `mask` and scale it to 8 bits.
+uint8_t maskChannel(uint32_t v, uint32_t mask, uint8_t fallback) {
+    if (!mask) return fallback;
+    int shift = 0;
+    while (!((mask >> shift) & 1)) shift++;
+    uint32_t max = mask >> shift;
+    return (uint8_t)(((v & mask) >> shift) * 255 / max);
+}
+
+std::string extension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return "";
+    std::string ext = path.substr(dot + 1);
+    for (auto& ch : ext) ch = (char)std::tolower((unsigned char)ch);
+    return ext;
+}
+
+} // namespace
+
+bool encodeBMP(const Canvas& canvas, std::vector<uint8_t>& out, const ProgressFn& progress) {
+    int w = canvas.getWidth(), h = canvas.getHeight();
+    const uint32_t headerSize = 14 + 108;
+    const uint32_t imageSize  = (uint32_t)w * h * 4;
+
+    out.clear();
+    out.reserve(headerSize + imageSize);
+    out.push_back('B');
+    out.push_back('M');
+    put32(out, headerSize + imageSize);
+    put32(out, 0);
+    put32(out, headerSize);
+
+    // BITMAPV4HEADER
+    put32(out, 108);
+    put32(out, (uint32_t)w);
+    put32(out, (uint32_t)h);
+    put16(out, 1);
+    put16(out, 32);
+    put32(out, BI_BITFIELDS);
+    put32(out, imageSize);
+    put32(out, 2835);
+    put32(out, 2835);
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, 0x00FF0000);
+    put32(out, 0x0000FF00);
+    put32(out, 0x000000FF);
+    put32(out, 0xFF000000);
+    put32(out, 0x73524742); // 'sRGB'
+    out.resize(headerSize, 0);
+
+    out.resize(headerSize + imageSize);
+    for (int y = 0; y < h; y++) {
+        Color* dst = (Color*)&out[headerSize + (size_t)y * w * 4];
+        canvas.readRegion({0, h - 1 - y, w, 1}, dst, w);
+        swapRedBlue(dst, dst, w);
+        if (progress && (y & Canvas::TILE_MASK) == Canvas::TILE_MASK) progress(y + 1, h);
+    }
+    return true;
+}
+
+bool decodeBMP(const uint8_t* data, size_t size, Image& out) {
+    if (size < 14 + 40 || data[0] != 'B' || data[1] != 'M') return false;
+    uint32_t pixelOffset = get32(data + 10);
+    uint32_t infoSize    = get32(data + 14);
+    if (infoSize < 40 || 14 + (size_t)infoSize > size) return false;
+
+    int32_t  w           = (int32_t)get32(data + 18);
+    int32_t  hRaw        = (int32_t)get32(data + 22);
+    uint16_t bpp         = get16(data + 28);
+    uint32_t compression = get32(data + 30);
+    uint32_t colorsUsed  = get32(data + 46);
+    bool topDown = hRaw < 0;
+    int32_t h = topDown ? -hRaw : hRaw;
+    if (w <= 0 || h <= 0 || w > Canvas::MAX_SIZE || h > Canvas::MAX_SIZE) return false;
+
+    uint32_t maskR = 0x00FF0000, maskG = 0x0000FF00, maskB = 0x000000FF, maskA = 0;
+    if (compression == BI_BITFIELDS) {
+        // Masks live in the V4/V5 header or, for a plain info header, right after it.
+        if (14 + 40 + 12 > size) return false;
+        maskR = get32(data + 54);
+        maskG = get32(data + 58);
+        maskB = get32(data + 62);
+        if (infoSize >= 56 && 14 + 56 <= size) maskA = get32(data + 66);
+    } else if (compression != BI_RGB) {
+        return false;
+    }
+    if (bpp == 32 && compression == BI_RGB) maskA = 0;
+
+    std::vector<Color> palette;
+    if (bpp <= 8) {
+        uint32_t n = colorsUsed ? colorsUsed : (1u << bpp);
+        const uint8_t* p = data + 14 + infoSize;
+        if (n > 256 || p + n * 4 > data + size) return false;
+        for (uint32_t i = 0; i < n; i++)
+            palette.push_back({p[i * 4 + 2], p[i * 4 + 1], p[i * 4 + 0], 255});
+    } else if (bpp != 24 && bpp != 32) {
+        return false;
+    }
+
+    size_t stride = (((size_t)w * bpp + 31) / 32) * 4;
+    if (pixelOffset + stride * h > size) return false;
+
+    // Plain 32-bit BGRA, the common case, is a straight swizzle.
+    bool bgra = bpp == 32 && maskR == 0x00FF0000 && maskG == 0x0000FF00 && maskB == 0x000000FF &&
+                (maskA == 0xFF000000 || maskA == 0);
+
+    out.width  = w;
+    out.height = h;
+    out.pixels.resize((size_t)w * h);
+    for (int y = 0; y < h; y++) {
+        const uint8_t* src = data + pixelOffset + stride * (topDown ? y : h - 1 - y);
+        Color* dst = &out.pixels[(size_t)y * w];
+        if (bgra) {
+            swapRedBlue(dst, (const Color*)src, w);
+            if (!maskA)
+                for (int x = 0; x < w; x++) dst[x].a = 255;
+            continue;
+        }
+        for (int x = 0; x < w; x++) {
+            if (bpp == 32) {
+                uint32_t v = get32(src + x * 4);
+                dst[x] = {maskChannel(v, maskR, 0), maskChannel(v, maskG, 0),
+                          maskChannel(v, maskB, 0), maskChannel(v, maskA, 255)};
+            } else if (bpp == 24) {
+                dst[x] = {src[x * 3 + 2], src[x * 3 + 1], src[x * 3 + 0], 255};
+            } else {
+                int perByte = 8 / bpp;
+                int shift = 8 - bpp * (x % perByte + 1);
+                uint32_t idx = (src[x / perByte] >> shift) & ((1 << bpp) - 1);
+                dst[x] = idx < palette.size() ? palette[idx] : Color(0, 0, 0, 255);
+            }
+        }
+    }
+    return true;
+}
+
+bool readFile(const std::string& path, std::vector<uint8_t>& out) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0) { fclose(f); return false; }
+    out.resize((size_t)len);
+    bool ok = len == 0 || fread(out.data(), 1, out.size(), f) == out.size();
+    fclose(f);
+    return ok;
+}
+
+bool writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    FILE* f = beginWrite(path);
+    if (!f) return false;
+    bool ok = data.empty() || fwrite(data.data(), 1, data.size(), f) == data.size();
+    return commitWrite(f, path, ok);
+}
+
+FILE* beginWrite(const std::string& path) {
+    return fopen((path + ".tmp").c_str(), "wb");
+}
+
+bool syncFile(FILE* f) {
+    if (fflush(f) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+bool commitWrite(FILE* f, const std::string& path, bool ok) {
+    std::string tmp = path + ".tmp";
+    // The data must be on disk before the rename makes it visible.
+    ok = syncFile(f) && ok;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+bool saveImage(const Canvas& canvas, const std::string& path, const PNGOptions& png,
+               const ProgressFn& progress) {
+    std::vector<uint8_t> data;
+    std::string ext = extension(path);
+    if (ext == "bmp") {
+        if (!encodeBMP(canvas, data, progress)) return false;
+    } else if (ext == "png") {
+        if (!encodePNG(canvas, data, png, progress)) return false;
+    } else {
+        return false;
+    }
+    return writeFile(path, data);
+}
+
+bool loadImage(const std::string& path, Image& out) {
+    std::vector<uint8_t> data;
+    if (!readFile(path, data)) return false;
+    if (data.size() >= 8 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G')
+        return decodePNG(data.data(), data.size(), out);
+    return decodeBMP(data.data(), data.size(), out);
+}
+
+void loadIntoCanvas(const Image& img, Canvas& canvas) {
+    canvas.resize(img.width, img.height);
+    canvas.writeRegion(canvas.bounds(), img.pixels.data(), img.width);
+    canvas.compact(canvas.bounds());
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "canvas.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A decoded image, row-major, top row first.
+struct Image {
+    int width = 0, height = 0;
+    std::vector<Color> pixels;
+};
+
+// Encoders report (rows done, total rows) now and then when given one.
+using ProgressFn = std::function<void(int, int)>;
+
+// Windows BMP. Writing always produces 32-bit BGRA with an alpha mask (the
+// layout SDL_SaveBMP uses for RGBA surfaces); reading accepts uncompressed
+// 1/4/8-bit palettised, 24-bit and 32-bit files, bottom-up or top-down.
+bool encodeBMP(const Canvas& canvas, std::vector<uint8_t>& out, const ProgressFn& progress = nullptr);
+bool decodeBMP(const uint8_t* data, size_t size, Image& out);
+
+struct PNGOptions {
+    int  level   = 6;    // deflate level, 0 (stored) to 9
+    bool palette = true; // write indexed colour when there are at most 256 colours
+};
+
+// PNG. Writing streams rows from the canvas through the compressor and
+// picks indexed (1/2/4/8-bit), RGB or RGBA, whichever is the smallest that
+// holds the image exactly; an indexed canvas keeps its own palette, in
+// order. Reading accepts every standard colour type and bit depth, with or
+// without interlacing; 16-bit samples are truncated.
+bool encodePNG(const Canvas& canvas, std::vector<uint8_t>& out, const PNGOptions& opts = {},
+               const ProgressFn& progress = nullptr);
+bool decodePNG(const uint8_t* data, size_t size, Image& out);
+
+// Saving picks the format from the file extension, loading from the
+// file's contents.
+bool saveImage(const Canvas& canvas, const std::string& path, const PNGOptions& png = {},
+               const ProgressFn& progress = nullptr);
+bool loadImage(const std::string& path, Image& out);
+
+// Replace the canvas contents (and size) with `img`.
+void loadIntoCanvas(const Image& img, Canvas& canvas);
+
+bool readFile(const std::string& path, std::vector<uint8_t>& out);
+// Writes to a temporary file next to `path` and renames it into place, so
+// `path` holds either the old or the new contents, never a partial file.
+bool writeFile(const std::string& path, const std::vector<uint8_t>& data);
+// The same, streamed: write to the file beginWrite() returns, then
+// commitWrite() syncs it and renames it into place, or removes it if `ok`
+// is false. Returns false if anything failed.
+FILE* beginWrite(const std::string& path);
+bool  commitWrite(FILE* f, const std::string& path, bool ok);
+// Flushes `f` and waits until its contents are on disk.
+bool  syncFile(FILE* f);
@@ -0,0 +1,315 @@
+#include "journal.h"
+#include "deflate.h"
+#include "imageio.h"
+#include <chrono>
+#include <cstring>
+
+// A segment starts with "TCJ1", a byte that is 1 if it continues from the
+// segment before, and three bytes of padding. Batches follow, each a u32
+// payload length and the payload's CRC-32, little endian, then the
+// records. A record is its op byte, then varints for frame, layer, a, b,
+// c and d (zigzag encoded), the colour as RGBA bytes, the point count and
+// the points as zigzag deltas from the previous one.
+//
+// The index file at `base` is "TCJI" and the u32 number of the newest
+// complete checkpoint.
+
+namespace {
+
+const char SEGMENT_MAGIC[4] = {'T', 'C', 'J', '1'};
+const char INDEX_MAGIC[4]   = {'T', 'C', 'J', 'I'};
+
+void putVarint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+void putInt(std::vector<uint8_t>& out, int v) {
+    putVarint(out, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+void putU32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (i * 8)));
+}
+
+uint32_t getU32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+struct Decoder {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    uint32_t varint() {
+        uint32_t v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (p == end) break;
+            uint8_t b = *p++;
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+    int integer() {
+        uint32_t v = varint();
+        return (int)(v >> 1) ^ -(int)(v & 1);
+    }
+    uint8_t byte() {
+        if (p == end) { ok = false; return 0; }
+        return *p++;
+    }
+};
+
+void encode(std::vector<uint8_t>& out, const JournalRecord& r) {
+    out.push_back((uint8_t)r.op);
+    putInt(out, r.frame);
+    putInt(out, r.layer);
+    putInt(out, r.a);
+    putInt(out, r.b);
+    putInt(out, r.c);
+    putInt(out, r.d);
+    out.push_back(r.color.r);
+    out.push_back(r.color.g);
+    out.push_back(r.color.b);
+    out.push_back(r.color.a);
+    putVarint(out, (uint32_t)r.points.size());
+    Point prev;
+    for (const Point& p : r.points) {
+        putInt(out, p.x - prev.x);
+        putInt(out, p.y - prev.y);
+        prev = p;
+    }
+}
+
+bool decode(Decoder& in, JournalRecord& r) {
+    uint8_t op = in.byte();
+    if (op >= (uint8_t)JournalOp::COUNT) return false;
+    r.op    = (JournalOp)op;
+    r.frame = in.integer();
+    r.layer = in.integer();
+    r.a = in.integer();
+    r.b = in.integer();
+    r.c = in.integer();
+    r.d = in.integer();
+    r.color.r = in.byte();
+    r.color.g = in.byte();
+    r.color.b = in.byte();
+    r.color.a = in.byte();
+    uint32_t n = in.varint();
+    // Each point takes at least two bytes.
+    if (!in.ok || n > (uint32_t)(in.end - in.p) / 2) return false;
+    r.points.resize(n);
+    Point prev;
+    for (Point& p : r.points) {
+        p.x = prev.x + in.integer();
+        p.y = prev.y + in.integer();
+        prev = p;
+    }
+    return in.ok;
+}
+
+bool readIndex(const std::string& base, int& segment) {
+    std::vector<uint8_t> data;
+    if (!readFile(base, data) || data.size() != 8 || memcmp(data.data(), INDEX_MAGIC, 4) != 0)
+        return false;
+    uint32_t n = getU32(&data[4]);
+    if (n > 0x7FFFFFFF) return false;
+    segment = (int)n;
+    return true;
+}
+
+bool exists(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f) fclose(f);
+    return f != nullptr;
+}
+
+} // namespace
+
+std::string Journal::checkpointPath(const std::string& base, int segment) {
+    return base + "." + std::to_string(segment) + ".tcp";
+}
+
+std::string Journal::segmentPath(const std::string& base, int segment) {
+    return base + "." + std::to_string(segment) + ".journal";
+}
+
+Journal::Journal(const std::string& base, int segment, bool replayable)
+    : base_(base), oldest_(segment), segment_(segment) {
+    // Files from an earlier run that went on past `segment` would
+    // otherwise be taken as following this one.
+    for (int s = segment; exists(segmentPath(base_, s)) || exists(checkpointPath(base_, s)); s++)
+        removeFiles(s, s + 1);
+    // The checkpoint recovery would load next, if any, and what follows it
+    // are removed once this run's first checkpoint is saved.
+    int n;
+    if (readIndex(base_, n) && n < segment) oldest_ = n;
+
+    batches_.push_back({segment, replayable, {}});
+    worker_ = std::thread([this] { run(); });
+}
+
+Journal::~Journal() {
+    stop();
+}
+
+void Journal::append(const JournalRecord& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint8_t>& out = batches_.back().bytes;
+    size_t before = out.size();
+    encode(out, r);
+    segmentBytes_ += out.size() - before;
+}
+
+int Journal::rotate(bool replayable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segment_++;
+    segmentBytes_ = 0;
+    batches_.push_back({segment_, replayable, {}});
+    return segment_;
+}
+
+int Journal::segment() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segment_;
+}
+
+size_t Journal::segmentBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segmentBytes_;
+}
+
+void Journal::checkpointSaved(int segment) {
+    if (discarded_ || segment < oldest_) return;
+    std::vector<uint8_t> index(INDEX_MAGIC, INDEX_MAGIC + 4);
+    putU32(index, (uint32_t)segment);
+    if (!writeFile(base_, index)) return;
+    removeFiles(oldest_, segment);
+    oldest_ = segment;
+}
+
+void Journal::discard() {
+    if (discarded_) return;
+    stop();
+    discarded_ = true;
+    remove(base_.c_str());
+    removeFiles(oldest_, segment_ + 1);
+}
+
+void Journal::stop() {
+    if (!worker_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    wake_.notify_one();
+    worker_.join();
+    if (file_) fclose(file_);
+    file_ = nullptr;
+}
+
+void Journal::removeFiles(int from, int to) {
+    for (int s = from; s < to; s++) {
+        remove(segmentPath(base_, s).c_str());
+        remove(checkpointPath(base_, s).c_str());
+    }
+}
+
+void Journal::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait_for(lock, std::chrono::milliseconds((int)FLUSH_MS), [this] { return quit_; });
+        std::deque<Batch> out;
+        out.swap(batches_);
+        batches_.push_back({out.back().segment, out.back().replayable, {}});
+        bool quit = quit_;
+        lock.unlock();
+
+        bool wrote = false;
+        for (const Batch& b : out) {
+            if (b.segment != fileSegment_ || !b.bytes.empty()) wrote = true;
+            write(b);
+        }
+        if (wrote && file_) syncFile(file_);
+
+        if (quit) return;
+        lock.lock();
+    }
+}
+
+void Journal::write(const Batch& b) {
+    if (b.segment != fileSegment_) {
+        if (file_) {
+            syncFile(file_);
+            fclose(file_);
+        }
+        fileSegment_ = b.segment;
+        file_ = fopen(segmentPath(base_, b.segment).c_str(), "wb");
+        if (!file_) {
+            fprintf(stderr, "Failed to open journal: %s\n", segmentPath(base_, b.segment).c_str());
+            return;
+        }
+        uint8_t header[8] = {0};
+        memcpy(header, SEGMENT_MAGIC, 4);
+        header[4] = b.replayable ? 1 : 0;
+        fwrite(header, 1, sizeof(header), file_);
+    }
+    if (!file_ || b.bytes.empty()) return;
+    std::vector<uint8_t> frame;
+    putU32(frame, (uint32_t)b.bytes.size());
+    putU32(frame, crc32(0, b.bytes.data(), b.bytes.size()));
+    fwrite(frame.data(), 1, frame.size(), file_);
+    fwrite(b.bytes.data(), 1, b.bytes.size(), file_);
+}
+
+bool Journal::recover(const std::string& base, std::string& checkpoint,
+                      std::vector<JournalRecord>& records, int& next) {
+    int n;
+    if (!readIndex(base, n)) return false;
+    checkpoint = checkpointPath(base, n);
+    if (!exists(checkpoint)) return false;
+
+    records.clear();
+    int s = n;
+    for (;; s++) {
+        std::vector<uint8_t> data;
+        if (!readFile(segmentPath(base, s), data)) break;
+        if (data.size() < 8 || memcmp(data.data(), SEGMENT_MAGIC, 4) != 0) break;
+        // Nothing before it leads to where this one starts.
+        if (s > n && !data[4]) break;
+
+        // A crash can leave the last batch half written; it and everything
+        // after it, in this segment or later ones, are dropped.
+        size_t pos = 8;
+        while (data.size() - pos >= 8) {
+            uint32_t len = getU32(&data[pos]);
+            uint32_t crc = getU32(&data[pos + 4]);
+            if (len > data.size() - pos - 8) break;
+            const uint8_t* payload = &data[pos + 8];
+            if (crc32(0, payload, len) != crc) break;
+            Decoder in{payload, payload + len};
+            std::vector<JournalRecord> batch;
+            bool ok = true;
+            while (ok && in.p != in.end) {
+                batch.emplace_back();
+                ok = decode(in, batch.back());
+            }
+            if (!ok) break;
+            for (JournalRecord& r : batch) records.push_back(std::move(r));
+            pos += 8 + len;
+        }
+        // Later segments build on the edits lost here. The new run goes on
+        // after this one, which stays until its first checkpoint is saved.
+        if (pos != data.size()) {
+            s++;
+            break;
+        }
+    }
+    next = s;
+    return true;
+}
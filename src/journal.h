@@ -0,0 +1,118 @@
+#pragma once
+#include "types.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One committed editor operation. `frame` and `layer` are the indices the
+// operation ran on; replaying it on the same state gives the same result.
+enum class JournalOp : uint8_t {
+    Stroke,      // color, points: pencil or eraser pixels in order
+    Line,        // color, a, b to c, d
+    Rect,        // color, corners a, b and c, d
+    Circle,      // color, centre a, b, radius c
+    Fill,        // color, seed a, b, tolerance c, diagonal d
+    Clear,       // color
+    Undo,
+    Redo,
+    AddLayer,
+    RemoveLayer,
+    MoveLayer,   // a: delta
+    LayerProps,  // a: visible, b: blend, c: opacity
+    AddFrame,    // a: duplicate
+    RemoveFrame,
+    MoveFrame,   // a: delta
+    SetFps,      // a: fps
+    SetIndexed,  // a: indexed
+    SetPaletteEntry, // a: index, color
+    Quantize,    // a: colours, b: dither
+    Filter,      // a, b, c, d: `from` as RGBA bits, color: `to`, points[0]: type and
+                 // whether the next record continues the chain
+    COUNT
+};
+
+struct JournalRecord {
+    JournalOp op = JournalOp::Undo;
+    int frame = 0;
+    int layer = 0;
+    int a = 0, b = 0, c = 0, d = 0;
+    Color color;
+    std::vector<Point> points;
+};
+
+// Append-only log of operations for crash recovery, split into numbered
+// segments next to `base`. Checkpoint n is a project file holding the
+// state at the start of segment n; recovery loads the newest complete one
+// and replays the segments from there on.
+//
+// append() only encodes into memory. A writer thread appends what has
+// built up to the segment file every FLUSH_MS as one checksummed batch and
+// syncs it, so at most that much work is lost and the caller never waits
+// on the disk.
+class Journal {
+public:
+    static const int FLUSH_MS = 250;
+
+    // Opens segment `segment` to log into, removing any stale files from
+    // it on. A segment that is not `replayable` follows something the log
+    // cannot reproduce, such as an import, and is only used once its own
+    // checkpoint is saved.
+    Journal(const std::string& base, int segment, bool replayable);
+    ~Journal(); // writes out everything appended
+
+    void append(const JournalRecord& r);
+    // Starts the next segment and returns its number; its checkpoint
+    // should be saved to checkpointPath() of it.
+    int  rotate(bool replayable);
+    // Records that checkpoint `segment` is on disk; the files before it are
+    // no longer needed and are removed.
+    void checkpointSaved(int segment);
+    // Stops logging and removes every file, e.g. on a clean exit.
+    void discard();
+
+    int    segment() const;
+    // Bytes appended to the current segment.
+    size_t segmentBytes() const;
+    std::string checkpointPath(int segment) const { return checkpointPath(base_, segment); }
+
+    // Finds the newest complete checkpoint of a log at `base` and the
+    // records after it, up to the first torn or corrupt batch in any
+    // segment. `next` is the segment number to continue at, past the
+    // segment of such a batch. False if there is nothing to recover.
+    static bool recover(const std::string& base, std::string& checkpoint,
+                        std::vector<JournalRecord>& records, int& next);
+    static std::string checkpointPath(const std::string& base, int segment);
+    static std::string segmentPath(const std::string& base, int segment);
+
+private:
+    struct Batch {
+        int  segment;
+        bool replayable;
+        std::vector<uint8_t> bytes;
+    };
+
+    std::string base_;
+    int  oldest_;          // first segment whose files may still exist
+    int  segment_;
+    size_t segmentBytes_ = 0;
+    bool discarded_ = false;
+
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Batch> batches_; // the last one is being appended to
+    bool quit_ = false;
+
+    FILE* file_ = nullptr;
+    int   fileSegment_ = -1;
+
+    void run();
+    void stop();
+    void write(const Batch& b);
+    void removeFiles(int from, int to);
+};
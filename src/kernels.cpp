@@ -0,0 +1,343 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if TC_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define TC_AVX2 1
+#include <immintrin.h>
+#define TC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+struct Kernels {
+    const char* name;
+    void (*fill)(Color*, size_t, const Color&);
+    bool (*equal)(const Color*, size_t, const Color&);
+    void (*swap)(Color*, const Color*, size_t);
+    void (*premul)(Color*, const Color*, size_t);
+    void (*unpremul)(Color*, const Color*, size_t);
+    void (*blend)(Color*, const Color*, size_t);
+};
+
+uint32_t pack(const Color& c) {
+    uint32_t v;
+    memcpy(&v, &c, 4);
+    return v;
+}
+
+// Round x / 255 for x in [0, 255 * 255].
+inline int div255(int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// 16.16 fixed-point 255 / a, for unpremultiplying.
+struct Reciprocals {
+    uint32_t v[256];
+    Reciprocals() {
+        v[0] = 0;
+        for (uint32_t a = 1; a < 256; a++) v[a] = (255u * 65536u + a / 2) / a;
+    }
+};
+const Reciprocals RECIP;
+
+// --- scalar -----------------------------------------------------------------
+
+void fillScalar(Color* dst, size_t n, const Color& c) {
+    std::fill(dst, dst + n, c);
+}
+
+bool equalScalar(const Color* p, size_t n, const Color& c) {
+    for (size_t i = 0; i < n; i++)
+        if (p[i] != c) return false;
+    return true;
+}
+
+void swapScalar(Color* dst, const Color* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Color c = src[i];
+        dst[i] = {c.b, c.g, c.r, c.a};
+    }
+}
+
+void premulScalar(Color* dst, const Color* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Color c = src[i];
+        dst[i] = {(uint8_t)div255(c.r * c.a), (uint8_t)div255(c.g * c.a),
+                  (uint8_t)div255(c.b * c.a), c.a};
+    }
+}
+
+void unpremulScalar(Color* dst, const Color* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Color c = src[i];
+        uint32_t r = RECIP.v[c.a];
+        auto un = [r](uint8_t v) { return (uint8_t)std::min<uint32_t>(255, (v * r + 32768) >> 16); };
+        dst[i] = {un(c.r), un(c.g), un(c.b), c.a};
+    }
+}
+
+void blendScalar(Color* dst, const Color* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Color s = src[i], d = dst[i];
+        int inv = 255 - s.a;
+        auto over = [inv](uint8_t sv, uint8_t dv) { return (uint8_t)std::min(255, sv + div255(dv * inv)); };
+        dst[i] = {over(s.r, d.r), over(s.g, d.g), over(s.b, d.b), over(s.a, d.a)};
+    }
+}
+
+const Kernels SCALAR = {"scalar", fillScalar, equalScalar, swapScalar,
+                        premulScalar, unpremulScalar, blendScalar};
+
+// --- SSE2 -------------------------------------------------------------------
+
+#if TC_SSE2
+
+inline __m128i div255x8(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Spread one 16-bit value per 32-bit lane across the four channel words of
+// each pixel, for the low and high pixel pairs of an unpacked register.
+inline void spread(__m128i v, __m128i& lo, __m128i& hi) {
+    __m128i w = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+    lo = _mm_unpacklo_epi32(w, w);
+    hi = _mm_unpackhi_epi32(w, w);
+}
+
+void fillSSE2(Color* dst, size_t n, const Color& c) {
+    __m128i v = _mm_set1_epi32((int)pack(c));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(dst + i), v);
+    fillScalar(dst + i, n - i, c);
+}
+
+bool equalSSE2(const Color* p, size_t n, const Color& c) {
+    __m128i v = _mm_set1_epi32((int)pack(c));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p + i)), v);
+        if (_mm_movemask_epi8(eq) != 0xFFFF) return false;
+    }
+    return equalScalar(p + i, n - i, c);
+}
+
+void swapSSE2(Color* dst, const Color* src, size_t n) {
+    const __m128i ag = _mm_set1_epi32((int)0xFF00FF00), low = _mm_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i r = _mm_slli_epi32(_mm_and_si128(x, low), 16);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(x, 16), low);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(x, ag), _mm_or_si128(r, b)));
+    }
+    swapScalar(dst + i, src + i, n - i);
+}
+
+void premulSSE2(Color* dst, const Color* src, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i keep = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i opaque = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i aLo, aHi;
+        spread(_mm_srli_epi32(x, 24), aLo, aHi);
+        // Alpha itself is multiplied by 255 so it comes back unchanged.
+        aLo = _mm_or_si128(_mm_and_si128(aLo, keep), opaque);
+        aHi = _mm_or_si128(_mm_and_si128(aHi, keep), opaque);
+        __m128i lo = div255x8(_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), aLo));
+        __m128i hi = div255x8(_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), aHi));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    premulScalar(dst + i, src + i, n - i);
+}
+
+void blendSSE2(Color* dst, const Color* src, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi32(255);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i invLo, invHi;
+        spread(_mm_sub_epi32(full, _mm_srli_epi32(s, 24)), invLo, invHi);
+        __m128i lo = div255x8(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), invLo));
+        __m128i hi = div255x8(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), invHi));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(s, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(s, zero));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    blendScalar(dst + i, src + i, n - i);
+}
+
+// Unpremultiplying needs a per-pixel divide; SSE2 has no 32-bit multiply or
+// gather to do it with, so it uses the scalar table.
+const Kernels SSE2 = {"sse2", fillSSE2, equalSSE2, swapSSE2,
+                      premulSSE2, unpremulScalar, blendSSE2};
+
+#endif
+
+// --- AVX2 -------------------------------------------------------------------
+
+#if TC_AVX2
+
+TC_TARGET_AVX2 inline __m256i div255x16(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+TC_TARGET_AVX2 inline void spread256(__m256i v, __m256i& lo, __m256i& hi) {
+    __m256i w = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+    lo = _mm256_unpacklo_epi32(w, w);
+    hi = _mm256_unpackhi_epi32(w, w);
+}
+
+TC_TARGET_AVX2 void fillAVX2(Color* dst, size_t n, const Color& c) {
+    __m256i v = _mm256_set1_epi32((int)pack(c));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*)(dst + i), v);
+    fillScalar(dst + i, n - i, c);
+}
+
+TC_TARGET_AVX2 bool equalAVX2(const Color* p, size_t n, const Color& c) {
+    __m256i v = _mm256_set1_epi32((int)pack(c));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(p + i)), v);
+        if (_mm256_movemask_epi8(eq) != -1) return false;
+    }
+    return equalScalar(p + i, n - i, c);
+}
+
+TC_TARGET_AVX2 void swapAVX2(Color* dst, const Color* src, size_t n) {
+    const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                           2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(x, order));
+    }
+    swapScalar(dst + i, src + i, n - i);
+}
+
+TC_TARGET_AVX2 void premulAVX2(Color* dst, const Color* src, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i keep = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+    const __m256i opaque = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i aLo, aHi;
+        spread256(_mm256_srli_epi32(x, 24), aLo, aHi);
+        aLo = _mm256_or_si256(_mm256_and_si256(aLo, keep), opaque);
+        aHi = _mm256_or_si256(_mm256_and_si256(aHi, keep), opaque);
+        __m256i lo = div255x16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(x, zero), aLo));
+        __m256i hi = div255x16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(x, zero), aHi));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    premulScalar(dst + i, src + i, n - i);
+}
+
+// One channel of eight pixels times its 16.16 reciprocal, back in place.
+TC_TARGET_AVX2 inline __m256i unpremulChannel(__m256i x, __m256i recip, int shift) {
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    __m256i c = _mm256_and_si256(_mm256_srl_epi32(x, _mm_cvtsi32_si128(shift)), low);
+    c = _mm256_mullo_epi32(c, recip);
+    c = _mm256_srli_epi32(_mm256_add_epi32(c, _mm256_set1_epi32(32768)), 16);
+    return _mm256_sll_epi32(_mm256_min_epu32(c, low), _mm_cvtsi32_si128(shift));
+}
+
+TC_TARGET_AVX2 void unpremulAVX2(Color* dst, const Color* src, size_t n) {
+    const int* table = (const int*)RECIP.v;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i a = _mm256_srli_epi32(x, 24);
+        __m256i r = _mm256_i32gather_epi32(table, a, 4);
+        __m256i out = _mm256_or_si256(_mm256_or_si256(unpremulChannel(x, r, 0), unpremulChannel(x, r, 8)),
+                                      _mm256_or_si256(unpremulChannel(x, r, 16), _mm256_slli_epi32(a, 24)));
+        _mm256_storeu_si256((__m256i*)(dst + i), out);
+    }
+    unpremulScalar(dst + i, src + i, n - i);
+}
+
+TC_TARGET_AVX2 void blendAVX2(Color* dst, const Color* src, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi32(255);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i invLo, invHi;
+        spread256(_mm256_sub_epi32(full, _mm256_srli_epi32(s, 24)), invLo, invHi);
+        __m256i lo = div255x16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), invLo));
+        __m256i hi = div255x16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), invHi));
+        lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(s, zero));
+        hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(s, zero));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    blendScalar(dst + i, src + i, n - i);
+}
+
+const Kernels AVX2 = {"avx2", fillAVX2, equalAVX2, swapAVX2,
+                      premulAVX2, unpremulAVX2, blendAVX2};
+
+bool hasAVX2() {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+const Kernels* find(const char* name) {
+    if (!strcmp(name, "scalar")) return &SCALAR;
+#if TC_SSE2
+    if (!strcmp(name, "sse2")) return &SSE2;
+#endif
+#if TC_AVX2
+    if (!strcmp(name, "avx2") && hasAVX2()) return &AVX2;
+#endif
+    return nullptr;
+}
+
+// Chosen on first use; TINYCANVAS_KERNELS=scalar|sse2|avx2 overrides.
+const Kernels*& active() {
+    static const Kernels* k = [] {
+        const char* env = getenv("TINYCANVAS_KERNELS");
+        if (const Kernels* forced = env ? find(env) : nullptr) return forced;
+        if (const Kernels* avx2 = find("avx2")) return avx2;
+        if (const Kernels* sse2 = find("sse2")) return sse2;
+        return &SCALAR;
+    }();
+    return k;
+}
+
+} // namespace
+
+void fillPixels(Color* dst, size_t n, const Color& c)       { active()->fill(dst, n, c); }
+void copyPixels(Color* dst, const Color* src, size_t n)     { if (n) memmove(dst, src, n * sizeof(Color)); }
+bool pixelsEqual(const Color* p, size_t n, const Color& c)  { return active()->equal(p, n, c); }
+void swapRedBlue(Color* dst, const Color* src, size_t n)    { active()->swap(dst, src, n); }
+void premultiply(Color* dst, const Color* src, size_t n)    { active()->premul(dst, src, n); }
+void unpremultiply(Color* dst, const Color* src, size_t n)  { active()->unpremul(dst, src, n); }
+void blendOver(Color* dst, const Color* src, size_t n)      { active()->blend(dst, src, n); }
+
+const char* pixelKernels() {
+    return active()->name;
+}
+
+bool usePixelKernels(const char* name) {
+    const Kernels* k = find(name);
+    if (!k) return false;
+    active() = k;
+    return true;
+}
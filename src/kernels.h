@@ -0,0 +1,26 @@
+#pragma once
+#include "types.h"
+#include <cstddef>
+
+// Pixel loops shared by Canvas and the image I/O. Each one has a scalar
+// version plus SSE2 and AVX2 versions on x86, chosen once at startup from
+// what the CPU supports. All versions produce identical results.
+
+void fillPixels(Color* dst, size_t n, const Color& c);
+void copyPixels(Color* dst, const Color* src, size_t n);
+bool pixelsEqual(const Color* p, size_t n, const Color& c);
+
+// RGBA <-> BGRA. `dst` may equal `src`.
+void swapRedBlue(Color* dst, const Color* src, size_t n);
+
+// Straight <-> premultiplied alpha. `dst` may equal `src`.
+void premultiply(Color* dst, const Color* src, size_t n);
+void unpremultiply(Color* dst, const Color* src, size_t n);
+
+// Source-over compositing of premultiplied pixels: dst = src + dst * (1 - src.a).
+void blendOver(Color* dst, const Color* src, size_t n);
+
+// Name of the active implementation ("scalar", "sse2" or "avx2"), and a way
+// to force one, e.g. for benchmarks. Returns false if the CPU lacks it.
+const char* pixelKernels();
+bool usePixelKernels(const char* name);
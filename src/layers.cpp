@@ -0,0 +1,219 @@
+#include "layers.h"
+#include "kernels.h"
+#include "parallel.h"
+#include <algorithm>
+
+namespace {
+
+const Color WHITE(255, 255, 255, 255);
+const Color CLEAR(0, 0, 0, 0);
+
+// Below this many stale pixels the tiles are blended on the calling thread.
+const long long PARALLEL_MIN_AREA = 256 * 256;
+
+inline int div255(int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Scale premultiplied pixels by opacity / 255.
+void fade(Color* p, size_t n, int opacity) {
+    for (size_t i = 0; i < n; i++) {
+        Color& c = p[i];
+        c = {(uint8_t)div255(c.r * opacity), (uint8_t)div255(c.g * opacity),
+             (uint8_t)div255(c.b * opacity), (uint8_t)div255(c.a * opacity)};
+    }
+}
+
+// The non-Normal modes, on premultiplied pixels. Alpha composites as
+// source-over in every mode.
+void blendSeparable(Color* dst, const Color* src, size_t n, BlendMode mode) {
+    for (size_t i = 0; i < n; i++) {
+        Color s = src[i], d = dst[i];
+        int sa = s.a, da = d.a;
+        auto mix = [&](int sc, int dc) {
+            int v;
+            switch (mode) {
+            case BlendMode::Multiply:
+                v = div255(sc * dc) + div255(sc * (255 - da)) + div255(dc * (255 - sa));
+                break;
+            case BlendMode::Screen:
+                v = sc + dc - div255(sc * dc);
+                break;
+            default:
+                v = sc + dc;
+                break;
+            }
+            return (uint8_t)std::min(v, 255);
+        };
+        dst[i] = {mix(s.r, d.r), mix(s.g, d.g), mix(s.b, d.b),
+                  (uint8_t)std::min(255, sa + div255(da * (255 - sa)))};
+    }
+}
+
+} // namespace
+
+const char* blendModeName(BlendMode m) {
+    switch (m) {
+    case BlendMode::Normal:   return "Normal";
+    case BlendMode::Multiply: return "Multiply";
+    case BlendMode::Screen:   return "Screen";
+    case BlendMode::Add:      return "Add";
+    default:                  return "?";
+    }
+}
+
+LayerStack::LayerStack(int width, int height)
+    : composite_(width, height), stale_(0, 0, width, height) {
+    Layer base;
+    base.id = nextId_++;
+    base.canvas = Canvas(width, height);
+    layers_.push_back(std::move(base));
+}
+
+int LayerStack::indexOf(int id) const {
+    for (int i = 0; i < count(); i++)
+        if (layers_[i].id == id) return i;
+    return -1;
+}
+
+int LayerStack::add(int index) {
+    index = std::max(0, std::min(index, count()));
+    Layer l;
+    l.id = nextId_++;
+    l.canvas = Canvas(width(), height());
+    l.canvas.clear(CLEAR);
+    l.canvas.clearDirty();
+    layers_.insert(layers_.begin() + index, std::move(l));
+    return index;
+}
+
+void LayerStack::remove(int index) {
+    if (count() <= 1 || index < 0 || index >= count()) return;
+    invalidate(layers_[index].canvas.bounds());
+    layers_.erase(layers_.begin() + index);
+}
+
+void LayerStack::move(int from, int to) {
+    to = std::max(0, std::min(to, count() - 1));
+    if (from == to || from < 0 || from >= count()) return;
+    Layer l = std::move(layers_[from]);
+    layers_.erase(layers_.begin() + from);
+    layers_.insert(layers_.begin() + to, std::move(l));
+    invalidate(layers_[to].canvas.bounds());
+}
+
+void LayerStack::setVisible(int i, bool visible) {
+    if (layers_[i].visible == visible) return;
+    layers_[i].visible = visible;
+    invalidate(layers_[i].canvas.bounds());
+}
+
+void LayerStack::setOpacity(int i, uint8_t opacity) {
+    if (layers_[i].opacity == opacity) return;
+    layers_[i].opacity = opacity;
+    invalidate(layers_[i].canvas.bounds());
+}
+
+void LayerStack::setBlend(int i, BlendMode mode) {
+    if (layers_[i].blend == mode) return;
+    layers_[i].blend = mode;
+    invalidate(layers_[i].canvas.bounds());
+}
+
+void LayerStack::resize(int w, int h) {
+    // Only the bottom layer is opaque; new area above it stays see-through.
+    for (int i = 0; i < count(); i++)
+        layers_[i].canvas.resize(w, h, i == 0 ? WHITE : CLEAR);
+}
+
+void LayerStack::applyDelta(const CanvasDelta& d, bool undo) {
+    int i = indexOf(d.layer);
+    if (i >= 0) layers_[i].canvas.applyDelta(d, undo);
+}
+
+void LayerStack::blendTile(int tx, int ty, const Rect& r, Color* out, int stride) const {
+    Color acc[Canvas::TILE_SIZE * Canvas::TILE_SIZE];
+    Color src[Canvas::TILE_SIZE * Canvas::TILE_SIZE];
+    size_t n = (size_t)r.w * r.h;
+
+    // Nothing below a solid, opaque, normal tile can show through it.
+    int start = 0;
+    for (int i = count() - 1; i >= 0; i--) {
+        const Layer& l = layers_[i];
+        const Tile& t = *l.canvas.tileAt(tx, ty);
+        if (l.visible && l.opacity == 255 && l.blend == BlendMode::Normal &&
+            t.uniform() && l.canvas.uniformColor(t).a == 255) {
+            start = i;
+            break;
+        }
+    }
+
+    fillPixels(acc, n, CLEAR);
+    for (int i = start; i < count(); i++) {
+        const Layer& l = layers_[i];
+        if (!l.visible || l.opacity == 0) continue;
+        const Tile& t = *l.canvas.tileAt(tx, ty);
+        if (t.uniform()) {
+            const Color& fill = l.canvas.uniformColor(t);
+            if (fill.a == 0) continue;
+            Color c;
+            premultiply(&c, &fill, 1);
+            if (l.opacity < 255) fade(&c, 1, l.opacity);
+            fillPixels(src, n, c);
+        } else {
+            l.canvas.readRegion(r, src, r.w);
+            premultiply(src, src, n);
+            if (l.opacity < 255) fade(src, n, l.opacity);
+        }
+        if (l.blend == BlendMode::Normal)
+            blendOver(acc, src, n);
+        else
+            blendSeparable(acc, src, n, l.blend);
+    }
+    unpremultiply(acc, acc, n);
+    for (int y = 0; y < r.h; y++)
+        copyPixels(out + (size_t)y * stride, acc + (size_t)y * r.w, r.w);
+}
+
+void LayerStack::setComposite(const CanvasSnapshot& snap) {
+    composite_.restore(snap);
+    for (auto& l : layers_) l.canvas.clearDirty();
+    stale_ = {};
+}
+
+const Canvas& LayerStack::composite() {
+    if (composite_.getWidth() != width() || composite_.getHeight() != height()) {
+        composite_.resize(width(), height());
+        stale_ = composite_.bounds();
+    }
+    for (auto& l : layers_) {
+        if (!l.canvas.isDirty()) continue;
+        stale_ = stale_.united(l.canvas.dirtyRect());
+        l.canvas.clearDirty();
+    }
+    Rect r = stale_.intersected(composite_.bounds());
+    stale_ = {};
+    if (r.empty()) return composite_;
+
+    // One row of tiles at a time, each tile blended independently.
+    const int S = Canvas::TILE_SHIFT;
+    int tx0 = r.x >> S, tx1 = (r.right() - 1) >> S;
+    bool parallel = workerCount() > 1 && (long long)r.w * r.h >= PARALLEL_MIN_AREA;
+    std::vector<Color> band((size_t)r.w * Canvas::TILE_SIZE);
+    for (int ty = r.y >> S; ty <= (r.bottom() - 1) >> S; ty++) {
+        Rect row = r.intersected(composite_.tileRect(0, ty).united(composite_.tileRect(tx1, ty)));
+        auto blendOne = [&](int i) {
+            Rect t = row.intersected(composite_.tileRect(tx0 + i, ty));
+            blendTile(tx0 + i, ty, t, band.data() + (t.x - row.x), row.w);
+        };
+        if (parallel) {
+            parallelFor(tx1 - tx0 + 1, blendOne);
+        } else {
+            for (int i = 0; i <= tx1 - tx0; i++) blendOne(i);
+        }
+        composite_.writeRegion(row, band.data(), row.w);
+        composite_.compact(row);
+    }
+    return composite_;
+}
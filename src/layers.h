@@ -0,0 +1,76 @@
+#pragma once
+#include "canvas.h"
+#include <cstdint>
+#include <vector>
+
+enum class BlendMode : uint8_t {
+    Normal,
+    Multiply,
+    Screen,
+    Add,
+    COUNT
+};
+
+const char* blendModeName(BlendMode m);
+
+struct Layer {
+    int       id = 0;
+    Canvas    canvas;
+    bool      visible = true;
+    uint8_t   opacity = 255;
+    BlendMode blend   = BlendMode::Normal;
+};
+
+// Layers ordered bottom to top, all the same size. The flattened image is
+// cached in composite(); only areas where a layer changed since the last
+// call are blended again, so a stroke costs its own footprint times the
+// layer count rather than the whole canvas.
+class LayerStack {
+public:
+    LayerStack(int width, int height);
+
+    int width()  const { return layers_[0].canvas.getWidth(); }
+    int height() const { return layers_[0].canvas.getHeight(); }
+    int count()  const { return (int)layers_.size(); }
+
+    Layer&       layer(int i)       { return layers_[i]; }
+    const Layer& layer(int i) const { return layers_[i]; }
+    int indexOf(int id) const;
+    // Id the next new layer gets; restored with saved layer ids.
+    int  nextId() const { return nextId_; }
+    void setNextId(int id) { nextId_ = id; }
+
+    // Insert a transparent layer at `index` and return its index.
+    int  add(int index);
+    void remove(int index);
+    void move(int from, int to);
+
+    void setVisible(int i, bool visible);
+    void setOpacity(int i, uint8_t opacity);
+    void setBlend(int i, BlendMode mode);
+
+    void resize(int w, int h);
+
+    // Route a history delta to the layer whose id it carries.
+    void applyDelta(const CanvasDelta& d, bool undo);
+
+    // Blend every changed area and return the result. The composite's own
+    // dirtyRect() then covers what the caller needs to redraw, until it is
+    // cleared with clearDirty().
+    const Canvas& composite();
+    void clearDirty() { composite_.clearDirty(); }
+
+    void invalidate(const Rect& r) { stale_ = stale_.united(r); }
+
+    // Adopt a composite saved along with the layers instead of blending
+    // them again; it must match their current contents.
+    void setComposite(const CanvasSnapshot& snap);
+
+private:
+    std::vector<Layer> layers_;
+    Canvas composite_;
+    Rect   stale_;
+    int    nextId_ = 0;
+
+    void blendTile(int tx, int ty, const Rect& r, Color* out, int stride) const;
+};
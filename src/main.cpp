@@ -5,30 +5,47 @@
 int main(int argc, char* argv[]) {
     int canvasW = 32, canvasH = 32;
 
-    if (argc >= 3) {
+    const char* project = nullptr;
+    if (argc == 2) {
+        project = argv[1];
+    } else if (argc >= 3) {
         canvasW = atoi(argv[1]);
         canvasH = atoi(argv[2]);
-        if (canvasW < 1 || canvasW > 512) canvasW = 32;
-        if (canvasH < 1 || canvasH > 512) canvasH = 32;
+        if (canvasW < 1 || canvasW > Canvas::MAX_SIZE) canvasW = 32;
+        if (canvasH < 1 || canvasH > Canvas::MAX_SIZE) canvasH = 32;
     }
 
     printf("TinyCanvas: %dx%d\n", canvasW, canvasH);
     printf("Controls:\n");
     printf("  P/E/L/R/C/F/I  - Select tool\n");
     printf("  G               - Toggle grid\n");
+    printf("  V               - Toggle navigator (click/drag to move the view)\n");
     printf("  X               - Swap FG/BG colors\n");
     printf("  +/-             - Zoom in/out\n");
     printf("  Scroll wheel    - Zoom\n");
     printf("  Right-drag      - Pan\n");
     printf("  Cmd+Z / Cmd+Shift+Z - Undo/Redo\n");
-    printf("  Cmd+S           - Save BMP\n");
-    printf("  Cmd+N           - New canvas\n");
+    printf("  Cmd+S / Cmd+O   - Save/open project (artwork.tcp)\n");
+    printf("  Cmd+E / Cmd+I   - Export/import PNG (Shift: BMP)\n");
+    printf("  Cmd+N           - Clear layer\n");
+    printf("  N / Delete      - Add/delete layer\n");
+    printf("  PgUp/PgDn       - Select layer (Shift: move)\n");
+    printf("  H , . B         - Layer visibility, opacity, blend mode\n");
+    printf("  M               - Indexed colour layer (Shift+click palette: set entry)\n");
+    printf("  Shift+M         - Quantize layer (again: halve the colours)\n");
+    printf("  Shift+I/G/H/B/O - Invert, greyscale, hue, blur, outline layer\n");
+    printf("  A / Shift+A     - Duplicate frame / blank frame\n");
+    printf("  Left/Right      - Select frame (Shift: move)\n");
+    printf("  Enter ; ' O     - Play/stop, FPS, onion skin\n");
 
     Editor editor(canvasW, canvasH);
     if (!editor.init()) {
         fprintf(stderr, "Failed to initialize editor\n");
         return 1;
     }
+    // Opening would replace the recovered work before it could be saved.
+    if (project && editor.recovered()) printf("Not opening %s: recovered the previous session\n", project);
+    else if (project) editor.openProject(project);
 
     editor.run();
     return 0;
@@ -0,0 +1,133 @@
+#include "mip_pyramid.h"
+#include "kernels.h"
+#include "parallel.h"
+
+namespace {
+
+const int S = Canvas::TILE_SIZE;
+const int H = S / 2;
+const int TILE_PIXELS = S * S;
+
+// Colour channels are weighted by alpha, so transparent pixels lend none
+// of their colour to an edge.
+Color average(const Color& a, const Color& b, const Color& c, const Color& d) {
+    if (a == b && a == c && a == d) return a;
+    int sum = a.a + b.a + c.a + d.a;
+    if (sum == 0) return {0, 0, 0, 0};
+    auto mix = [&](int ca, int cb, int cc, int cd) {
+        return (uint8_t)((ca * a.a + cb * b.a + cc * c.a + cd * d.a + sum / 2) / sum);
+    };
+    return {mix(a.r, b.r, c.r, d.r), mix(a.g, b.g, c.g, d.g), mix(a.b, b.b, c.b, d.b),
+            (uint8_t)((sum + 2) / 4)};
+}
+
+// Tile (tx, ty) of the level above `below`, from the up to four tiles of
+// `below` under it. Pixels past the edge of `below` repeat the last row or
+// column, so an odd size halves without darkening the border.
+TileRef reduceTile(const Canvas& below, int tx, int ty, const TileRef& old) {
+    const Tile* src[4] = {};
+    bool uniform = true;
+    Color fill = below.uniformColor(*below.tileAt(2 * tx, 2 * ty));
+    for (int q = 0; q < 4; q++) {
+        int sx = 2 * tx + (q & 1), sy = 2 * ty + (q >> 1);
+        if (sx >= below.tilesX() || sy >= below.tilesY()) continue;
+        src[q] = below.tileAt(sx, sy).get();
+        if (!src[q]->uniform() || below.uniformColor(*src[q]) != fill) uniform = false;
+    }
+    if (uniform) {
+        if (old->uniform() && old->fill == fill) return old;
+        return std::make_shared<Tile>(fill);
+    }
+
+    std::vector<Color> in(TILE_PIXELS), out(TILE_PIXELS);
+    bool first = true;
+    for (int q = 0; q < 4; q++) {
+        if (!src[q]) continue;
+        Rect r = below.tileRect(2 * tx + (q & 1), 2 * ty + (q >> 1));
+        Color* dst = &out[(q >> 1) * H * S + (q & 1) * H];
+        int w = (r.w + 1) / 2, h = (r.h + 1) / 2;
+        if (src[q]->uniform()) {
+            Color c = below.uniformColor(*src[q]);
+            for (int y = 0; y < h; y++) fillPixels(dst + y * S, w, c);
+        } else {
+            below.readRegion(r, in.data(), S);
+            for (int y = 0; y < h; y++) {
+                const Color* row0 = &in[2 * y * S];
+                const Color* row1 = &in[std::min(2 * y + 1, r.h - 1) * S];
+                for (int x = 0; x < w; x++) {
+                    int x1 = std::min(2 * x + 1, r.w - 1);
+                    dst[y * S + x] = average(row0[2 * x], row0[x1], row1[2 * x], row1[x1]);
+                }
+            }
+        }
+        // Pixels outside the level take a colour from inside, so they do
+        // not keep an otherwise uniform tile from collapsing.
+        if (first) {
+            fill = dst[0];
+            first = false;
+        }
+    }
+    Rect inside(0, 0, std::min(S, (below.getWidth() + 1) / 2 - tx * S),
+                std::min(S, (below.getHeight() + 1) / 2 - ty * S));
+    for (int y = 0; y < S; y++)
+        for (int x = y < inside.h ? inside.w : 0; x < S; x++) out[y * S + x] = fill;
+
+    if (pixelsEqual(out.data(), TILE_PIXELS, fill)) return std::make_shared<Tile>(fill);
+    auto t = std::make_shared<Tile>(fill);
+    t->px.assign(TILE_PIXELS, fill);
+    copyPixels(t->px.data(), out.data(), TILE_PIXELS);
+    return t;
+}
+
+} // namespace
+
+const Canvas& MipPyramid::level(const Canvas& canvas, int n) {
+    if (n > MAX_LEVELS) n = MAX_LEVELS;
+    if (n <= 0) return canvas;
+    if ((int)levels_.size() < n) levels_.resize(n);
+    for (int i = 0; i < n; i++) update(i == 0 ? canvas : levels_[i - 1].canvas, levels_[i]);
+    return levels_[n - 1].canvas;
+}
+
+int MipPyramid::levelFor(float zoom) {
+    int n = 0;
+    while (n < MAX_LEVELS && zoom * (2 << n) <= 1.0f) n++;
+    return n;
+}
+
+void MipPyramid::update(const Canvas& below, Level& level) {
+    int bw = below.getWidth(), bh = below.getHeight();
+    if (bw != level.belowW || bh != level.belowH) {
+        level.canvas = Canvas((bw + 1) / 2, (bh + 1) / 2);
+        level.belowW = bw;
+        level.belowH = bh;
+        level.sources.assign((size_t)below.tilesX() * below.tilesY(), nullptr);
+    }
+
+    // Tiles of this level over a tile of `below` that is not the one it
+    // was built from.
+    const Canvas& c = level.canvas;
+    std::vector<int> stale;
+    for (int ty = 0; ty < c.tilesY(); ty++) {
+        for (int tx = 0; tx < c.tilesX(); tx++) {
+            bool changed = false;
+            for (int sy = 2 * ty; sy < std::min(2 * ty + 2, below.tilesY()); sy++)
+                for (int sx = 2 * tx; sx < std::min(2 * tx + 2, below.tilesX()); sx++)
+                    changed |= below.tileAt(sx, sy) != level.sources[sy * below.tilesX() + sx];
+            if (changed) stale.push_back(ty * c.tilesX() + tx);
+        }
+    }
+    if (stale.empty()) return;
+
+    // Each task builds its own tile and notes the sources under it alone.
+    std::vector<TileRef> built(stale.size());
+    parallelFor((int)stale.size(), [&](int i) {
+        int tx = stale[i] % c.tilesX(), ty = stale[i] / c.tilesX();
+        built[i] = reduceTile(below, tx, ty, c.tileAt(tx, ty));
+        for (int sy = 2 * ty; sy < std::min(2 * ty + 2, below.tilesY()); sy++)
+            for (int sx = 2 * tx; sx < std::min(2 * tx + 2, below.tilesX()); sx++)
+                level.sources[sy * below.tilesX() + sx] = below.tileAt(sx, sy);
+    });
+    for (size_t i = 0; i < stale.size(); i++)
+        level.canvas.setTile(stale[i] % c.tilesX(), stale[i] / c.tilesX(), std::move(built[i]));
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "canvas.h"
+#include <vector>
+
+// Reduced copies of a canvas, each half the size of the one below, for
+// drawing it zoomed out at a cost set by the window rather than the
+// canvas. Level 0 is the canvas itself; a pixel of level n + 1 is the
+// alpha-weighted average of the 2x2 pixels of level n it covers.
+//
+// Every level keeps a reference to each tile of the level below it was
+// built from. Shared tiles are never written in place, so a source tile
+// that is still the same object is unchanged, and level() rebuilds only
+// the tiles above those that were replaced: keeping the pyramid current
+// while painting costs the tiles painted, not a downscale of the canvas.
+class MipPyramid {
+public:
+    // Level `n` (at most MAX_LEVELS) of `canvas`, brought up to date along
+    // with the levels below it.
+    const Canvas& level(const Canvas& canvas, int n);
+
+    // Level to draw from at `zoom` screen pixels per canvas pixel: the
+    // most reduced one that is still shrunk, if at all, by less than half
+    // on screen.
+    static int levelFor(float zoom);
+
+    // Drop every level and the tile references they hold.
+    void clear() { levels_.clear(); }
+
+    static const int MAX_LEVELS = 8;
+
+private:
+    struct Level {
+        Canvas canvas;
+        int    belowW = 0, belowH = 0;
+        std::vector<TileRef> sources; // tiles of the level below, as built from
+    };
+    std::vector<Level> levels_;
+
+    static void update(const Canvas& below, Level& level);
+};
@@ -0,0 +1,24 @@
+#include "ops.h"
+
+void applyOp(Canvas& canvas, const DrawOp& op) {
+    switch (op.type) {
+    case OpType::Pixel:
+        canvas.setPixel(op.x0, op.y0, op.color);
+        break;
+    case OpType::Line:
+        canvas.drawLine(op.x0, op.y0, op.x1, op.y1, op.color);
+        break;
+    case OpType::Rect:
+        canvas.drawRect(op.x0, op.y0, op.x1, op.y1, op.color);
+        break;
+    case OpType::Circle:
+        canvas.drawCircle(op.x0, op.y0, op.x1, op.color);
+        break;
+    case OpType::Fill:
+        canvas.floodFill(op.x0, op.y0, op.color, op.fill);
+        break;
+    case OpType::Clear:
+        canvas.clear(op.color);
+        break;
+    }
+}
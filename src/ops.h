@@ -0,0 +1,23 @@
+#pragma once
+#include "canvas.h"
+
+enum class OpType : uint8_t {
+    Pixel,
+    Line,
+    Rect,
+    Circle,
+    Fill,
+    Clear,
+};
+
+// A single drawing command against a Canvas, independent of any UI, so the
+// same operation can come from the editor, a script or a log. Circles use
+// (x0, y0) as the centre and x1 as the radius.
+struct DrawOp {
+    OpType type = OpType::Pixel;
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    Color color;
+    FillOptions fill;
+};
+
+void applyOp(Canvas& canvas, const DrawOp& op);
@@ -0,0 +1,69 @@
+#include "panel_cache.h"
+#include <cstdio>
+
+PanelCache::~PanelCache() {
+    release();
+}
+
+void PanelCache::init(SDL_Renderer* renderer, DrawBatch* batch) {
+    release();
+    renderer_  = renderer;
+    batch_     = batch;
+    supported_ = SDL_RenderTargetSupported(renderer) == SDL_TRUE;
+}
+
+void PanelCache::release() {
+    if (tex_) SDL_DestroyTexture(tex_);
+    tex_ = nullptr;
+    key_.clear();
+    stale_ = true;
+}
+
+bool PanelCache::update(const SDL_Rect& area, const std::string& key) {
+    bool resized = area.w != area_.w || area.h != area_.h;
+    if (tex_ && resized) {
+        SDL_DestroyTexture(tex_);
+        tex_ = nullptr;
+    }
+    if (resized || area.x != area_.x || area.y != area_.y || key != key_) stale_ = true;
+    area_ = area;
+    key_  = key;
+    return stale_;
+}
+
+bool PanelCache::begin() {
+    if (!stale_ && tex_) return false;
+    batch_->flush();
+    if (!supported_ || area_.w <= 0 || area_.h <= 0) return true;
+    if (!tex_) {
+        tex_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET,
+                                 area_.w, area_.h);
+        if (!tex_) {
+            fprintf(stderr, "Panel texture: %s\n", SDL_GetError());
+            supported_ = false;
+            return true;
+        }
+        SDL_SetTextureBlendMode(tex_, SDL_BLENDMODE_NONE);
+    }
+    SDL_SetRenderTarget(renderer_, tex_);
+    SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 0);
+    SDL_RenderClear(renderer_);
+    batch_->setOrigin(area_.x, area_.y);
+    drawing_ = true;
+    return true;
+}
+
+void PanelCache::end() {
+    stale_ = false;
+    if (!drawing_) return;
+    batch_->flush();
+    batch_->setOrigin(0, 0);
+    SDL_SetRenderTarget(renderer_, nullptr);
+    drawing_ = false;
+}
+
+void PanelCache::draw() {
+    if (!tex_) return;
+    batch_->flush();
+    SDL_RenderCopy(renderer_, tex_, nullptr, &area_);
+}
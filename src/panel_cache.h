@@ -0,0 +1,45 @@
+#pragma once
+#include "draw_batch.h"
+#include <SDL2/SDL.h>
+#include <string>
+
+// A part of the window (toolbar, palette, canvas view...) kept in a render
+// target texture of its own. Each frame the owner passes update() a key
+// made of everything the panel is drawn from; the panel is drawn again
+// only when that key or its area changed, and is otherwise copied to the
+// window as it is. Without render target support begin() always asks for
+// the panel to be drawn, straight to the window.
+class PanelCache {
+public:
+    PanelCache() = default;
+    ~PanelCache();
+    PanelCache(const PanelCache&) = delete;
+    PanelCache& operator=(const PanelCache&) = delete;
+
+    void init(SDL_Renderer* renderer, DrawBatch* batch);
+    void release();
+
+    // True if the panel has to be drawn again.
+    bool update(const SDL_Rect& area, const std::string& key);
+    // Its texture lost its contents, or it changed in a way no key covers.
+    void invalidate() { stale_ = true; }
+
+    // True if the panel is to be drawn now, in window coordinates, and
+    // then closed with end(). The batch moves what it draws into the
+    // texture; anything else has to be drawn origin() further up and left.
+    bool begin();
+    void end();
+    SDL_Point origin() const { return drawing_ ? SDL_Point{area_.x, area_.y} : SDL_Point{0, 0}; }
+    // Copy the panel to the window.
+    void draw();
+
+private:
+    SDL_Renderer* renderer_ = nullptr;
+    DrawBatch*    batch_    = nullptr;
+    SDL_Texture*  tex_      = nullptr;
+    SDL_Rect      area_     = {0, 0, 0, 0};
+    std::string   key_;
+    bool stale_     = true;
+    bool supported_ = false;
+    bool drawing_   = false;
+};
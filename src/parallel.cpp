@@ -0,0 +1,173 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// One parallelFor() call. Its indices start out split evenly into one range
+// per worker. Whoever joins the call takes a range and works from its
+// front; once that is empty it steals the back half of the fullest range
+// left, so a slow index only holds up the indices behind it in its range
+// until someone comes for them.
+class Job {
+public:
+    Job(int n, int ranges, const std::function<void(int)>& fn)
+        : fn_(fn), ranges_(ranges), left_(n) {
+        for (int r = 0; r < ranges; r++)
+            ranges_[r].store(pack((int)((int64_t)n * r / ranges), (int)((int64_t)n * (r + 1) / ranges)));
+    }
+
+    // A range nobody has joined with yet, or -1. The first is the caller's.
+    int join() {
+        int r = joined_++;
+        return r < (int)ranges_.size() ? r : -1;
+    }
+    bool open() const { return joined_ < (int)ranges_.size(); }
+
+    void work(int own) {
+        int done = 0;
+        for (int i; take(own, i) || steal(own, i); done++) fn_(i);
+        if (done && left_.fetch_sub(done) == done) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_.notify_all();
+        }
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this] { return left_ == 0; });
+    }
+
+private:
+    const std::function<void(int)>& fn_;
+    std::vector<std::atomic<uint64_t>> ranges_; // begin << 32 | end
+    std::atomic<int> joined_{1};
+    std::atomic<int> left_;                     // indices not finished yet
+    std::mutex mutex_;
+    std::condition_variable finished_;
+
+    static uint64_t pack(int begin, int end) { return (uint64_t)begin << 32 | (uint32_t)end; }
+    static int begin(uint64_t r) { return (int)(r >> 32); }
+    static int end(uint64_t r) { return (int)(uint32_t)r; }
+
+    bool take(int own, int& i) {
+        std::atomic<uint64_t>& range = ranges_[own];
+        uint64_t r = range.load();
+        while (begin(r) < end(r)) {
+            if (range.compare_exchange_weak(r, pack(begin(r) + 1, end(r)))) {
+                i = begin(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(int own, int& i) {
+        for (;;) {
+            int victim = -1, most = 0;
+            uint64_t r = 0;
+            for (int v = 0; v < (int)ranges_.size(); v++) {
+                uint64_t s = ranges_[v].load();
+                if (end(s) - begin(s) > most) {
+                    victim = v;
+                    most = end(s) - begin(s);
+                    r = s;
+                }
+            }
+            if (victim < 0) return false;
+            int mid = end(r) - (most + 1) / 2;
+            if (!ranges_[victim].compare_exchange_strong(r, pack(begin(r), mid))) continue;
+            // Only its owner refills a range, and only once it is empty.
+            ranges_[own].store(pack(mid + 1, end(r)));
+            i = mid;
+            return true;
+        }
+    }
+};
+
+// workerCount() - 1 threads that join whichever calls are open, newest
+// first. The calling thread always works on its own call too, so a call
+// made from inside another still finishes if every worker is busy.
+class Pool {
+public:
+    Pool() {
+        for (int t = 1; t < workerCount(); t++) threads_.emplace_back([this] { run(); });
+    }
+
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        wake_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    void post(const std::shared_ptr<Job>& job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(job);
+        }
+        wake_.notify_all();
+    }
+
+    void remove(const std::shared_ptr<Job>& job) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+    }
+
+private:
+    std::vector<std::thread> threads_;
+    std::vector<std::shared_ptr<Job>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool quit_ = false;
+
+    std::shared_ptr<Job> openJob() const {
+        for (auto it = jobs_.rbegin(); it != jobs_.rend(); ++it)
+            if ((*it)->open()) return *it;
+        return nullptr;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            std::shared_ptr<Job> job;
+            wake_.wait(lock, [&] { return quit_ || (job = openJob()); });
+            if (quit_) return;
+            lock.unlock();
+            int own = job->join();
+            if (own >= 0) job->work(own);
+            job.reset();
+            lock.lock();
+        }
+    }
+};
+
+} // namespace
+
+int workerCount() {
+    static const int n = std::max(1u, std::thread::hardware_concurrency());
+    return n;
+}
+
+void parallelFor(int n, const std::function<void(int)>& fn) {
+    int ranges = std::min(n, workerCount());
+    if (ranges <= 1) {
+        for (int i = 0; i < n; i++) fn(i);
+        return;
+    }
+
+    static Pool pool;
+    auto job = std::make_shared<Job>(n, ranges, fn);
+    pool.post(job);
+    job->work(0);
+    job->wait();
+    pool.remove(job);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <functional>
+
+// Number of threads parallelFor() spreads work across (at least 1).
+int workerCount();
+
+// Calls fn(i) for every i in [0, n) on a pool of threads that lives for the
+// whole run, the caller's among them. Each thread works through its own
+// share of the indices and steals from the others when it runs out, so
+// uneven work items balance out; returns once all of them have finished.
+// fn may call parallelFor() itself.
+void parallelFor(int n, const std::function<void(int)>& fn);
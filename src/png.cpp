@@ -0,0 +1,464 @@
+#include "imageio.h"
+#include "deflate.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+enum ColorType : uint8_t { GRAY = 0, RGB = 2, INDEXED = 3, GRAY_ALPHA = 4, RGBA = 6 };
+
+// Bytes written per IDAT chunk; the compressor output is drained at this size.
+const size_t IDAT_SIZE = 1 << 16;
+
+void put32be(std::vector<uint8_t>& v, uint32_t x) {
+    for (int i = 3; i >= 0; i--) v.push_back((x >> (i * 8)) & 0xFF);
+}
+
+uint32_t get32be(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+void putChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t n) {
+    put32be(out, (uint32_t)n);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (n) out.insert(out.end(), data, data + n);
+    put32be(out, crc32(0, &out[start], n + 4));
+}
+
+uint32_t pack(const Color& c) {
+    uint32_t v;
+    memcpy(&v, &c, 4);
+    return v;
+}
+
+Color unpack(uint32_t v) {
+    Color c;
+    memcpy(static_cast<void*>(&c), &v, 4);
+    return c;
+}
+
+// Colour -> palette index for up to 256 colours, open addressed.
+class PaletteMap {
+public:
+    PaletteMap() { std::fill(index_, index_ + SLOTS, -1); }
+
+    int find(uint32_t key) const {
+        for (uint32_t i = hash(key);; i = (i + 1) & (SLOTS - 1)) {
+            if (index_[i] < 0) return -1;
+            if (keys_[i] == key) return index_[i];
+        }
+    }
+    // Returns false once a 257th colour turns up.
+    bool add(uint32_t key) {
+        uint32_t i = hash(key);
+        for (; index_[i] >= 0; i = (i + 1) & (SLOTS - 1))
+            if (keys_[i] == key) return true;
+        if (colors.size() == 256) return false;
+        keys_[i]  = key;
+        index_[i] = (int16_t)colors.size();
+        colors.push_back(key);
+        return true;
+    }
+    void reindex(const std::vector<uint32_t>& order) {
+        for (size_t n = 0; n < order.size(); n++) {
+            uint32_t i = hash(order[n]);
+            while (keys_[i] != order[n]) i = (i + 1) & (SLOTS - 1);
+            index_[i] = (int16_t)n;
+        }
+        colors = order;
+    }
+
+    std::vector<uint32_t> colors;
+
+private:
+    static const uint32_t SLOTS = 1024;
+    uint32_t keys_[SLOTS];
+    int16_t  index_[SLOTS];
+
+    static uint32_t hash(uint32_t k) { return (k * 2654435761u) >> 22; }
+};
+
+// Gather the canvas colours, giving up past 256. Uniform tiles count once.
+bool collectPalette(const Canvas& canvas, PaletteMap& map) {
+    std::vector<Color> px(Canvas::TILE_SIZE * Canvas::TILE_SIZE);
+    for (int ty = 0; ty < canvas.tilesY(); ty++) {
+        for (int tx = 0; tx < canvas.tilesX(); tx++) {
+            const Tile& t = *canvas.tileAt(tx, ty);
+            if (t.uniform()) {
+                if (!map.add(pack(t.fill))) return false;
+                continue;
+            }
+            Rect r = canvas.tileRect(tx, ty);
+            canvas.readRegion(r, px.data(), r.w);
+            uint32_t last = pack(px[0]) ^ 1;
+            for (int i = 0; i < r.w * r.h; i++) {
+                uint32_t k = pack(px[i]);
+                if (k == last) continue;
+                if (!map.add(k)) return false;
+                last = k;
+            }
+        }
+    }
+    return true;
+}
+
+bool allOpaque(const Canvas& canvas) {
+    std::vector<Color> px(Canvas::TILE_SIZE * Canvas::TILE_SIZE);
+    for (int ty = 0; ty < canvas.tilesY(); ty++) {
+        for (int tx = 0; tx < canvas.tilesX(); tx++) {
+            const Tile& t = *canvas.tileAt(tx, ty);
+            if (t.uniform()) {
+                if (canvas.uniformColor(t).a != 255) return false;
+                continue;
+            }
+            Rect r = canvas.tileRect(tx, ty);
+            canvas.readRegion(r, px.data(), r.w);
+            for (int i = 0; i < r.w * r.h; i++)
+                if (px[i].a != 255) return false;
+        }
+    }
+    return true;
+}
+
+inline uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return (uint8_t)a;
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+// Apply filter `type` to `cur` into `out`; returns the sum of the
+// filtered bytes read as signed, the usual guess at how well it compresses.
+uint32_t filterRow(int type, const uint8_t* cur, const uint8_t* prev, size_t n, int bpp,
+                   uint8_t* out) {
+    uint32_t cost = 0;
+    for (size_t i = 0; i < n; i++) {
+        int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+        uint8_t v;
+        switch (type) {
+        case 1:  v = (uint8_t)(cur[i] - a); break;
+        case 2:  v = (uint8_t)(cur[i] - b); break;
+        case 3:  v = (uint8_t)(cur[i] - ((a + b) >> 1)); break;
+        case 4:  v = (uint8_t)(cur[i] - paeth(a, b, c)); break;
+        default: v = cur[i]; break;
+        }
+        out[i] = v;
+        cost += v < 128 ? v : 256 - v;
+    }
+    return cost;
+}
+
+bool unfilterRow(int type, uint8_t* cur, const uint8_t* prev, size_t n, int bpp) {
+    switch (type) {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = bpp; i < n; i++) cur[i] += cur[i - bpp];
+        break;
+    case 2:
+        for (size_t i = 0; i < n; i++) cur[i] += prev[i];
+        break;
+    case 3:
+        for (size_t i = 0; i < n; i++)
+            cur[i] += (uint8_t)(((i >= (size_t)bpp ? cur[i - bpp] : 0) + prev[i]) >> 1);
+        break;
+    case 4:
+        for (size_t i = 0; i < n; i++) {
+            int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+            int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+            cur[i] += paeth(a, prev[i], c);
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+struct Pass {
+    int x0, y0, dx, dy;
+};
+
+const Pass FULL_IMAGE = {0, 0, 1, 1};
+const Pass ADAM7[7] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+                       {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+
+} // namespace
+
+bool encodePNG(const Canvas& canvas, std::vector<uint8_t>& out, const PNGOptions& opts,
+               const ProgressFn& progress) {
+    int w = canvas.getWidth(), h = canvas.getHeight();
+    int level = std::max(0, std::min(opts.level, (int)Deflater::MAX_LEVEL));
+
+    // An indexed canvas is written with its own palette, in its order.
+    PaletteMap map;
+    bool own = opts.palette && canvas.indexed();
+    bool indexed = own || (opts.palette && collectPalette(canvas, map));
+    uint8_t type = indexed ? INDEXED : allOpaque(canvas) ? RGB : RGBA;
+    int depth = 8;
+    std::vector<Color> palette;
+    if (own) {
+        palette = *canvas.palette();
+    } else if (indexed) {
+        // Translucent entries first, so tRNS can stop at the last of them.
+        std::vector<uint32_t> order;
+        for (uint32_t c : map.colors)
+            if ((c >> 24) != 255) order.push_back(c);
+        for (uint32_t c : map.colors)
+            if ((c >> 24) == 255) order.push_back(c);
+        map.reindex(order);
+        palette.reserve(order.size());
+        for (uint32_t c : order) palette.push_back(unpack(c));
+    }
+    if (indexed) {
+        size_t n = palette.size();
+        depth = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+    }
+    int channels = type == RGBA ? 4 : type == RGB ? 3 : 1;
+    size_t rowBytes = ((size_t)w * channels * depth + 7) / 8;
+
+    out.clear();
+    out.insert(out.end(), SIGNATURE, SIGNATURE + 8);
+    uint8_t ihdr[13];
+    for (int i = 0; i < 4; i++) {
+        ihdr[i]     = (uint8_t)(w >> (24 - i * 8));
+        ihdr[4 + i] = (uint8_t)(h >> (24 - i * 8));
+    }
+    ihdr[8]  = (uint8_t)depth;
+    ihdr[9]  = type;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    putChunk(out, "IHDR", ihdr, 13);
+
+    if (indexed) {
+        std::vector<uint8_t> plte, trns;
+        size_t translucent = 0;
+        for (size_t i = 0; i < palette.size(); i++)
+            if (palette[i].a != 255) translucent = i + 1;
+        for (size_t i = 0; i < palette.size(); i++) {
+            plte.insert(plte.end(), {palette[i].r, palette[i].g, palette[i].b});
+            if (i < translucent) trns.push_back(palette[i].a);
+        }
+        putChunk(out, "PLTE", plte.data(), plte.size());
+        if (!trns.empty()) putChunk(out, "tRNS", trns.data(), trns.size());
+    }
+
+    // Rows go through the compressor one at a time, straight from the
+    // canvas; whole IDAT chunks are cut from its output as it grows.
+    std::vector<uint8_t> z;
+    Deflater deflater(z, level);
+    std::vector<Color> px(own ? 0 : w);
+    std::vector<uint8_t> indices(indexed ? w : 0);
+    std::vector<uint8_t> cur(rowBytes), prev(rowBytes, 0);
+    std::vector<uint8_t> line(rowBytes + 1), trial(rowBytes);
+    // Palette rows keep filter 0, as the PNG spec recommends.
+    bool adaptive = level > 0 && !indexed;
+    int bpp = std::max(1, channels * depth / 8);
+
+    for (int y = 0; y < h; y++) {
+        if (own) {
+            canvas.readIndices({0, y, w, 1}, indices.data(), w);
+        } else {
+            canvas.readRegion({0, y, w, 1}, px.data(), w);
+        }
+        if (type == RGBA) {
+            memcpy(cur.data(), px.data(), rowBytes);
+        } else if (type == RGB) {
+            for (int x = 0; x < w; x++) {
+                cur[x * 3 + 0] = px[x].r;
+                cur[x * 3 + 1] = px[x].g;
+                cur[x * 3 + 2] = px[x].b;
+            }
+        } else {
+            if (!own) {
+                uint32_t lastKey = pack(px[0]) ^ 1;
+                int idx = 0;
+                for (int x = 0; x < w; x++) {
+                    uint32_t k = pack(px[x]);
+                    if (k != lastKey) {
+                        idx = map.find(k);
+                        lastKey = k;
+                    }
+                    indices[x] = (uint8_t)idx;
+                }
+            }
+            std::fill(cur.begin(), cur.end(), 0);
+            for (int x = 0; x < w; x++) {
+                int bit = x * depth;
+                cur[bit >> 3] |= (uint8_t)(indices[x] << (8 - depth - (bit & 7)));
+            }
+        }
+
+        line[0] = 0;
+        uint32_t best = filterRow(0, cur.data(), prev.data(), rowBytes, bpp, line.data() + 1);
+        for (int f = 1; adaptive && f <= 4; f++) {
+            uint32_t cost = filterRow(f, cur.data(), prev.data(), rowBytes, bpp, trial.data());
+            if (cost < best) {
+                best = cost;
+                line[0] = (uint8_t)f;
+                std::copy(trial.begin(), trial.end(), line.begin() + 1);
+            }
+        }
+        deflater.write(line.data(), line.size());
+        std::swap(cur, prev);
+
+        if (z.size() >= IDAT_SIZE) {
+            putChunk(out, "IDAT", z.data(), z.size());
+            z.clear();
+        }
+        if (progress && (y & Canvas::TILE_MASK) == Canvas::TILE_MASK) progress(y + 1, h);
+    }
+    deflater.finish();
+    putChunk(out, "IDAT", z.data(), z.size());
+    putChunk(out, "IEND", nullptr, 0);
+    return true;
+}
+
+bool decodePNG(const uint8_t* data, size_t size, Image& out) {
+    if (size < 8 || memcmp(data, SIGNATURE, 8) != 0) return false;
+
+    int w = 0, h = 0, depth = 0, type = -1, interlace = 0;
+    std::vector<Color> palette;
+    std::vector<uint8_t> idat, trns;
+    bool sawEnd = false;
+    for (size_t p = 8; p + 12 <= size && !sawEnd;) {
+        uint32_t len = get32be(data + p);
+        if (len > size - p - 12) return false;
+        const uint8_t* type4 = data + p + 4;
+        const uint8_t* body  = data + p + 8;
+        if (get32be(body + len) != crc32(0, type4, len + 4)) return false;
+
+        if (!memcmp(type4, "IHDR", 4)) {
+            if (len != 13) return false;
+            w = (int)std::min<uint32_t>(get32be(body), 0x7FFFFFFF);
+            h = (int)std::min<uint32_t>(get32be(body + 4), 0x7FFFFFFF);
+            depth = body[8];
+            type  = body[9];
+            interlace = body[12];
+            if (body[10] != 0 || body[11] != 0 || interlace > 1) return false;
+        } else if (!memcmp(type4, "PLTE", 4)) {
+            if (len % 3 || len > 256 * 3) return false;
+            for (uint32_t i = 0; i < len; i += 3) palette.push_back({body[i], body[i + 1], body[i + 2], 255});
+        } else if (!memcmp(type4, "tRNS", 4)) {
+            trns.assign(body, body + len);
+        } else if (!memcmp(type4, "IDAT", 4)) {
+            idat.insert(idat.end(), body, body + len);
+        } else if (!memcmp(type4, "IEND", 4)) {
+            sawEnd = true;
+        }
+        p += 12 + len;
+    }
+    if (w <= 0 || h <= 0 || w > Canvas::MAX_SIZE || h > Canvas::MAX_SIZE) return false;
+
+    int channels;
+    switch (type) {
+    case GRAY:       channels = 1; if (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) return false; break;
+    case RGB:        channels = 3; if (depth != 8 && depth != 16) return false; break;
+    case INDEXED:    channels = 1; if (depth != 1 && depth != 2 && depth != 4 && depth != 8) return false; break;
+    case GRAY_ALPHA: channels = 2; if (depth != 8 && depth != 16) return false; break;
+    case RGBA:       channels = 4; if (depth != 8 && depth != 16) return false; break;
+    default:         return false;
+    }
+    if (type == INDEXED) {
+        if (palette.empty()) return false;
+        for (size_t i = 0; i < trns.size() && i < palette.size(); i++) palette[i].a = trns[i];
+    }
+    int bitsPerPixel = channels * depth;
+    int bpp = std::max(1, bitsPerPixel / 8);
+
+    const Pass* passes = interlace ? ADAM7 : &FULL_IMAGE;
+    int passCount = interlace ? 7 : 1;
+    size_t expected = 0;
+    for (int i = 0; i < passCount; i++) {
+        const Pass& ps = passes[i];
+        size_t pw = (w - ps.x0 + ps.dx - 1) / ps.dx, ph = (h - ps.y0 + ps.dy - 1) / ps.dy;
+        if (pw && ph) expected += ph * (1 + (pw * bitsPerPixel + 7) / 8);
+    }
+    std::vector<uint8_t> raw;
+    // A stream inflating to more than the image needs is refused before it
+    // takes more memory than the image would.
+    if (!inflateZlib(idat.data(), idat.size(), raw, expected, expected) || raw.size() < expected) return false;
+
+    // A colour with this raw value is fully transparent (grey and RGB tRNS).
+    int keyR = -1, keyG = -1, keyB = -1;
+    if (type == GRAY && trns.size() >= 2) keyR = keyG = keyB = (trns[0] << 8) | trns[1];
+    if (type == RGB && trns.size() >= 6) {
+        keyR = (trns[0] << 8) | trns[1];
+        keyG = (trns[2] << 8) | trns[3];
+        keyB = (trns[4] << 8) | trns[5];
+    }
+    int maxSample = (1 << depth) - 1;
+    auto sample = [&](const uint8_t* row, size_t i) -> int {
+        if (depth == 8) return row[i];
+        if (depth == 16) return (row[i * 2] << 8) | row[i * 2 + 1];
+        size_t bit = i * depth;
+        return (row[bit >> 3] >> (8 - depth - (bit & 7))) & maxSample;
+    };
+    auto to8 = [&](int v) -> uint8_t {
+        return depth == 16 ? (uint8_t)(v >> 8) : depth == 8 ? (uint8_t)v : (uint8_t)(v * 255 / maxSample);
+    };
+
+    out.width  = w;
+    out.height = h;
+    out.pixels.assign((size_t)w * h, Color(0, 0, 0, 0));
+    const uint8_t* src = raw.data();
+    for (int i = 0; i < passCount; i++) {
+        const Pass& ps = passes[i];
+        int pw = (w - ps.x0 + ps.dx - 1) / ps.dx, ph = (h - ps.y0 + ps.dy - 1) / ps.dy;
+        if (pw <= 0 || ph <= 0) continue;
+        size_t rowBytes = ((size_t)pw * bitsPerPixel + 7) / 8;
+        std::vector<uint8_t> prev(rowBytes, 0), cur(rowBytes);
+        for (int y = 0; y < ph; y++, src += rowBytes + 1) {
+            memcpy(cur.data(), src + 1, rowBytes);
+            if (!unfilterRow(src[0], cur.data(), prev.data(), rowBytes, bpp)) return false;
+            Color* dst = &out.pixels[(size_t)(ps.y0 + y * ps.dy) * w + ps.x0];
+            const uint8_t* row = cur.data();
+
+            // 8-bit RGBA rows of a plain image are already in Color layout.
+            if (type == RGBA && depth == 8 && ps.dx == 1) {
+                memcpy(dst, row, rowBytes);
+            } else if (type == RGB && depth == 8 && keyR < 0) {
+                for (int x = 0; x < pw; x++, dst += ps.dx, row += 3) *dst = {row[0], row[1], row[2], 255};
+            } else {
+                for (int x = 0; x < pw; x++, dst += ps.dx) {
+                    size_t s = (size_t)x * channels;
+                    switch (type) {
+                    case GRAY: {
+                        int v = sample(row, s);
+                        uint8_t g = to8(v);
+                        *dst = {g, g, g, (uint8_t)(v == keyR ? 0 : 255)};
+                        break;
+                    }
+                    case RGB: {
+                        int r = sample(row, s), g = sample(row, s + 1), b = sample(row, s + 2);
+                        bool key = r == keyR && g == keyG && b == keyB;
+                        *dst = {to8(r), to8(g), to8(b), (uint8_t)(key ? 0 : 255)};
+                        break;
+                    }
+                    case INDEXED: {
+                        size_t idx = (size_t)sample(row, s);
+                        *dst = idx < palette.size() ? palette[idx] : Color(0, 0, 0, 255);
+                        break;
+                    }
+                    case GRAY_ALPHA: {
+                        uint8_t g = to8(sample(row, s));
+                        *dst = {g, g, g, to8(sample(row, s + 1))};
+                        break;
+                    }
+                    default:
+                        *dst = {to8(sample(row, s)), to8(sample(row, s + 1)), to8(sample(row, s + 2)),
+                                to8(sample(row, s + 3))};
+                        break;
+                    }
+                }
+            }
+            std::swap(cur, prev);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,461 @@
+#include "project.h"
+#include "history.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Layout, all integers little endian:
+//
+//   header      MAGIC, then the u32 fields below and the u64 data offset
+//   palettes    per palette (the header has the count): u32 entry count
+//               and the entries as RGBA bytes
+//   frames      per frame: u32 id, next layer id and layer count; per
+//               layer: u32 id, u8 visible, opacity, blend, 0, u32 palette
+//               and a tile table; then the composite's tile table
+//   history     u32 cursor, then per entry (the header has the count):
+//               u32 frame id, layer id, joined, old and new size, old and
+//               new palette, and the before and after patches, each a u32
+//               count followed by u32 tx, ty and a tile entry per patch
+//   tile data   at the data offset (page aligned), TILE_BYTES per tile,
+//               then INDEX_TILE_BYTES per tile of an indexed canvas
+//
+// A tile entry is a u32 index into the tile data, or NO_TILE for a
+// uniform tile, then the tile's fill as RGBA bytes. In a canvas with a
+// palette (NO_TILE for none) the index is into the indexed tiles and a
+// uniform tile's fill is its palette index and three zeros. A tile table
+// has one entry per tile, row-major. Version 1 files have no ids or
+// history, and versions before 3 no palettes.
+
+namespace {
+
+const char     MAGIC[8]         = {'T', 'C', 'P', 'R', 'O', 'J', '\r', '\n'};
+const uint32_t VERSION          = 3;
+const size_t   HEADER_SIZE      = 72;
+const size_t   HEADER_SIZE_V2   = 64;
+const size_t   PAGE             = 4096;
+const size_t   TILE_PIXELS      = Canvas::TILE_SIZE * Canvas::TILE_SIZE;
+const size_t   TILE_BYTES       = TILE_PIXELS * sizeof(Color);
+const size_t   INDEX_TILE_BYTES = TILE_PIXELS;
+const uint32_t NO_TILE          = 0xFFFFFFFF;
+
+void put32(std::vector<uint8_t>& v, uint32_t x) {
+    for (int i = 0; i < 4; i++) v.push_back((x >> (i * 8)) & 0xFF);
+}
+
+void putColor(std::vector<uint8_t>& v, const Color& c) {
+    v.insert(v.end(), {c.r, c.g, c.b, c.a});
+}
+
+uint32_t get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+Color getColor(const uint8_t* p) { return {p[0], p[1], p[2], p[3]}; }
+
+// Read-only view of a whole file, unmapped with the last tile using it.
+class Mapping {
+public:
+    ~Mapping() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+#else
+        if (data_) munmap((void*)data_, size_);
+#endif
+    }
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (f == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER len;
+        HANDLE m = nullptr;
+        if (GetFileSizeEx(f, &len) && len.QuadPart > 0)
+            m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(f);
+        if (!m) return false;
+        data_ = (const uint8_t*)MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(m);
+        size_ = (size_t)len.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        // Tiles are read where the view goes, not front to back.
+        madvise(p, (size_t)st.st_size, MADV_RANDOM);
+        data_ = (const uint8_t*)p;
+        size_ = (size_t)st.st_size;
+#endif
+        return data_ != nullptr;
+    }
+
+    const uint8_t* data() const { return data_; }
+    size_t         size() const { return size_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t         size_ = 0;
+};
+
+// Numbers the distinct non-uniform tiles and the palettes in the order
+// they are met.
+struct TileIndex {
+    std::unordered_map<const Tile*, uint32_t> index;
+    std::vector<const Tile*> tiles;
+    std::vector<const Tile*> indexTiles;
+    std::unordered_map<const Palette*, uint32_t> paletteIndex;
+    std::vector<const Palette*> palettes;
+
+    void entry(const TileRef& t, bool indexed, std::vector<uint8_t>& out) {
+        uint32_t i = NO_TILE;
+        if (!t->uniform()) {
+            std::vector<const Tile*>& list = indexed ? indexTiles : tiles;
+            auto it = index.emplace(t.get(), (uint32_t)list.size());
+            if (it.second) list.push_back(t.get());
+            i = it.first->second;
+        }
+        put32(out, i);
+        if (indexed)
+            out.insert(out.end(), {t->index, 0, 0, 0});
+        else
+            putColor(out, t->fill);
+    }
+
+    void palette(const PaletteRef& p, std::vector<uint8_t>& out) {
+        uint32_t i = NO_TILE;
+        if (p) {
+            auto it = paletteIndex.emplace(p.get(), (uint32_t)palettes.size());
+            if (it.second) palettes.push_back(p.get());
+            i = it.first->second;
+        }
+        put32(out, i);
+    }
+
+    void table(const Canvas& c, std::vector<uint8_t>& out) {
+        for (int ty = 0; ty < c.tilesY(); ty++)
+            for (int tx = 0; tx < c.tilesX(); tx++) entry(c.tileAt(tx, ty), c.indexed(), out);
+    }
+
+    void patches(const std::vector<TilePatch>& ps, bool indexed, std::vector<uint8_t>& out) {
+        put32(out, (uint32_t)ps.size());
+        for (auto& p : ps) {
+            put32(out, (uint32_t)p.tx);
+            put32(out, (uint32_t)p.ty);
+            entry(p.tile, indexed, out);
+        }
+    }
+};
+
+class Reader {
+public:
+    Reader(const std::shared_ptr<Mapping>& file, size_t pos, uint32_t tileCount,
+           uint32_t indexTileCount, uint64_t dataOffset)
+        : file_(file), p_(file->data() + pos), end_(file->data() + file->size()),
+          shared_(tileCount), sharedIndexed_(indexTileCount), maxIndex_(indexTileCount, -1),
+          dataOffset_(dataOffset), indexOffset_(dataOffset + (uint64_t)tileCount * TILE_BYTES) {}
+
+    bool has(size_t n) const { return (size_t)(end_ - p_) >= n; }
+    uint8_t  u8()  { return *p_++; }
+    uint32_t u32() { uint32_t v = get32(p_); p_ += 4; return v; }
+
+    bool palettes(uint32_t n) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (!has(4)) return false;
+            uint32_t count = u32();
+            if (count == 0 || count > 256 || !has(count * 4)) return false;
+            auto p = std::make_shared<Palette>(count);
+            for (Color& c : *p) {
+                c = getColor(p_);
+                p_ += 4;
+            }
+            palettes_.push_back(std::move(p));
+        }
+        return true;
+    }
+
+    // Callers check has(4) first.
+    bool palette(PaletteRef& out) {
+        uint32_t i = u32();
+        if (i == NO_TILE) {
+            out.reset();
+            return true;
+        }
+        if (i >= palettes_.size()) return false;
+        out = palettes_[i];
+        return true;
+    }
+
+    // Callers check has(8) first. Every index must be in `palette`.
+    bool entry(TileRef& out, const PaletteRef& palette) {
+        uint32_t index = u32();
+        Color fill = getColor(p_);
+        p_ += 4;
+        if (palette) return indexedEntry(out, index, fill.r, (int)palette->size());
+        if (index == NO_TILE) {
+            out = std::make_shared<Tile>(fill);
+            return true;
+        }
+        if (index >= shared_.size()) return false;
+        TileRef& t = shared_[index];
+        if (!t) {
+            auto tile = std::make_shared<Tile>(fill);
+            const Color* px = (const Color*)(file_->data() + dataOffset_ + (size_t)index * TILE_BYTES);
+            tile->px = TilePixels(px, TILE_PIXELS, file_);
+            t = tile;
+        }
+        out = t;
+        return true;
+    }
+
+    bool table(int w, int h, CanvasSnapshot& snap) {
+        snap.width  = w;
+        snap.height = h;
+        int tx = (w + Canvas::TILE_SIZE - 1) >> Canvas::TILE_SHIFT;
+        int ty = (h + Canvas::TILE_SIZE - 1) >> Canvas::TILE_SHIFT;
+        size_t n = (size_t)tx * ty;
+        if (!has(n * 8)) return false;
+        snap.tiles.resize(n);
+        for (size_t i = 0; i < n; i++)
+            if (!entry(snap.tiles[i], snap.palette)) return false;
+        return true;
+    }
+
+    bool patches(std::vector<TilePatch>& ps, const PaletteRef& palette) {
+        if (!has(4)) return false;
+        uint32_t n = u32();
+        if (!has((size_t)n * 16)) return false;
+        ps.resize(n);
+        for (auto& p : ps) {
+            p.tx = (int)u32();
+            p.ty = (int)u32();
+            if (!entry(p.tile, palette)) return false;
+        }
+        return true;
+    }
+
+private:
+    std::shared_ptr<Mapping> file_;
+    const uint8_t* p_;
+    const uint8_t* end_;
+    std::vector<TileRef> shared_; // each stored tile becomes one shared Tile
+    std::vector<TileRef> sharedIndexed_;
+    std::vector<int> maxIndex_;   // of each indexed tile, once looked at
+    std::vector<PaletteRef> palettes_;
+    uint64_t dataOffset_;
+    uint64_t indexOffset_;
+
+    bool indexedEntry(TileRef& out, uint32_t index, uint8_t fill, int colors) {
+        if (index == NO_TILE) {
+            if (fill >= colors) return false;
+            out = std::make_shared<Tile>(fill);
+            return true;
+        }
+        if (index >= sharedIndexed_.size()) return false;
+        const uint8_t* idx = file_->data() + indexOffset_ + (size_t)index * INDEX_TILE_BYTES;
+        // With a full palette any byte is a valid index and the tile can
+        // stay unread until it is drawn.
+        if (colors < 256) {
+            if (maxIndex_[index] < 0) maxIndex_[index] = *std::max_element(idx, idx + INDEX_TILE_BYTES);
+            if (maxIndex_[index] >= colors) return false;
+        }
+        TileRef& t = sharedIndexed_[index];
+        if (!t) {
+            auto tile = std::make_shared<Tile>((uint8_t)0);
+            tile->idx = TileIndices(idx, INDEX_TILE_BYTES, file_);
+            t = tile;
+        }
+        out = t;
+        return true;
+    }
+};
+
+bool validSize(int w, int h) {
+    return w > 0 && h > 0 && w <= Canvas::MAX_SIZE && h <= Canvas::MAX_SIZE;
+}
+
+} // namespace
+
+bool saveProject(Animation& anim, const ProjectInfo& info, const std::string& path,
+                 const ProgressFn& progress, const History* history) {
+    std::vector<uint8_t> meta;
+    TileIndex index;
+    for (int f = 0; f < anim.count(); f++) {
+        LayerStack& stack = anim.frame(f).layers;
+        stack.composite();
+        put32(meta, (uint32_t)anim.frame(f).id);
+        put32(meta, (uint32_t)stack.nextId());
+        put32(meta, (uint32_t)stack.count());
+        for (int i = 0; i < stack.count(); i++) {
+            const Layer& l = stack.layer(i);
+            put32(meta, (uint32_t)l.id);
+            meta.insert(meta.end(), {(uint8_t)l.visible, l.opacity, (uint8_t)l.blend, 0});
+            index.palette(l.canvas.palette(), meta);
+            index.table(l.canvas, meta);
+        }
+        index.table(stack.composite(), meta);
+    }
+    int entries = history ? history->count() : 0;
+    if (history) {
+        put32(meta, (uint32_t)history->undoCount());
+        for (int i = 0; i < entries; i++) {
+            const CanvasDelta& d = history->entry(i);
+            for (int v : {d.frame, d.layer, (int)d.joined, d.oldW, d.oldH, d.newW, d.newH})
+                put32(meta, (uint32_t)v);
+            index.palette(d.oldPalette, meta);
+            index.palette(d.newPalette, meta);
+            index.patches(d.before, d.oldPalette != nullptr, meta);
+            index.patches(d.after, d.newPalette != nullptr, meta);
+        }
+    }
+    // The palettes are only all known now but are read first.
+    std::vector<uint8_t> palettes;
+    for (const Palette* p : index.palettes) {
+        put32(palettes, (uint32_t)p->size());
+        for (const Color& c : *p) putColor(palettes, c);
+    }
+
+    uint64_t dataOffset = (HEADER_SIZE + palettes.size() + meta.size() + PAGE - 1) / PAGE * PAGE;
+    std::vector<uint8_t> head(MAGIC, MAGIC + 8);
+    put32(head, VERSION);
+    put32(head, (uint32_t)anim.width());
+    put32(head, (uint32_t)anim.height());
+    put32(head, (uint32_t)anim.count());
+    put32(head, (uint32_t)anim.fps());
+    put32(head, (uint32_t)anim.current());
+    put32(head, (uint32_t)info.activeLayer);
+    putColor(head, info.fg);
+    putColor(head, info.bg);
+    put32(head, (uint32_t)index.tiles.size());
+    put32(head, (uint32_t)dataOffset);
+    put32(head, (uint32_t)(dataOffset >> 32));
+    put32(head, (uint32_t)anim.nextId());
+    put32(head, history ? (uint32_t)entries : NO_TILE);
+    put32(head, (uint32_t)index.indexTiles.size());
+    put32(head, (uint32_t)index.palettes.size());
+    head.insert(head.end(), palettes.begin(), palettes.end());
+    head.insert(head.end(), meta.begin(), meta.end());
+    head.resize(dataOffset, 0);
+
+    FILE* f = beginWrite(path);
+    if (!f) return false;
+    bool ok = fwrite(head.data(), 1, head.size(), f) == head.size();
+    int total = (int)(index.tiles.size() + index.indexTiles.size());
+    for (int i = 0; ok && i < total; i++) {
+        if (i < (int)index.tiles.size())
+            ok = fwrite(index.tiles[i]->px.data(), 1, TILE_BYTES, f) == TILE_BYTES;
+        else
+            ok = fwrite(index.indexTiles[i - index.tiles.size()]->idx.data(), 1, INDEX_TILE_BYTES, f) ==
+                 INDEX_TILE_BYTES;
+        if (progress && (i & 255) == 255) progress(i + 1, total);
+    }
+    return commitWrite(f, path, ok);
+}
+
+bool loadProject(const std::string& path, Animation& anim, ProjectInfo& info, History* history) {
+    auto file = std::make_shared<Mapping>();
+    if (!file->open(path) || file->size() < HEADER_SIZE_V2) return false;
+    const uint8_t* h = file->data();
+    uint32_t version = get32(h + 8);
+    if (memcmp(h, MAGIC, 8) != 0 || version < 1 || version > VERSION) return false;
+    bool palettes = version >= 3;
+    if (palettes && file->size() < HEADER_SIZE) return false;
+
+    int w = (int)get32(h + 12), hgt = (int)get32(h + 16);
+    uint32_t frames = get32(h + 20);
+    uint32_t tiles  = get32(h + 44);
+    uint64_t dataOffset = get32(h + 48) | ((uint64_t)get32(h + 52) << 32);
+    if (!validSize(w, hgt) || frames == 0) return false;
+    uint32_t indexTiles = palettes ? get32(h + 64) : 0;
+    if (dataOffset > file->size() || (file->size() - dataOffset) / TILE_BYTES < tiles) return false;
+    if ((file->size() - dataOffset - (uint64_t)tiles * TILE_BYTES) / INDEX_TILE_BYTES < indexTiles)
+        return false;
+    bool ids = version >= 2;
+
+    Reader in(file, palettes ? HEADER_SIZE : HEADER_SIZE_V2, tiles, indexTiles, dataOffset);
+    if (palettes && !in.palettes(get32(h + 68))) return false;
+    Animation result(w, hgt);
+    for (uint32_t f = 0; f < frames; f++) {
+        if (f > 0) result.add(false);
+        if (!in.has(12)) return false;
+        int id = ids ? (int)in.u32() : (int)f;
+        int nextLayerId = ids ? (int)in.u32() : 0;
+        uint32_t layers = in.u32();
+        if (layers == 0 || !in.has((size_t)layers * 8)) return false;
+        LayerStack stack(w, hgt);
+        for (uint32_t i = 0; i < layers; i++) {
+            if (i > 0) stack.add((int)i);
+            Layer& l = stack.layer((int)i);
+            if (!in.has(8)) return false;
+            if (ids) l.id = (int)in.u32();
+            l.visible = in.u8() != 0;
+            l.opacity = in.u8();
+            uint8_t blend = in.u8();
+            in.u8();
+            if (blend >= (uint8_t)BlendMode::COUNT) return false;
+            l.blend = (BlendMode)blend;
+            CanvasSnapshot snap;
+            if (palettes && (!in.has(4) || !in.palette(snap.palette))) return false;
+            if (!in.table(w, hgt, snap)) return false;
+            l.canvas.restore(snap);
+        }
+        if (ids) stack.setNextId(nextLayerId);
+        CanvasSnapshot comp;
+        if (!in.table(w, hgt, comp)) return false;
+        stack.setComposite(comp);
+        result.frame((int)f).id = id;
+        result.frame((int)f).layers = std::move(stack);
+    }
+    if (ids) result.setNextId((int)get32(h + 56));
+
+    uint32_t entries = ids ? get32(h + 60) : NO_TILE;
+    std::vector<CanvasDelta> deltas;
+    int cursor = 0;
+    if (entries != NO_TILE) {
+        size_t fields = palettes ? 36 : 28;
+        if (!in.has(4) || !in.has((size_t)entries * fields)) return false;
+        cursor = (int)in.u32();
+        deltas.resize(entries);
+        for (auto& d : deltas) {
+            if (!in.has(fields)) return false;
+            d.frame  = (int)in.u32();
+            d.layer  = (int)in.u32();
+            d.joined = in.u32() != 0;
+            d.oldW = (int)in.u32();
+            d.oldH = (int)in.u32();
+            d.newW = (int)in.u32();
+            d.newH = (int)in.u32();
+            if (!validSize(d.oldW, d.oldH) || !validSize(d.newW, d.newH)) return false;
+            if (palettes && (!in.palette(d.oldPalette) || !in.palette(d.newPalette))) return false;
+            if (!in.patches(d.before, d.oldPalette) || !in.patches(d.after, d.newPalette)) return false;
+            int tx = (std::max(d.oldW, d.newW) + Canvas::TILE_SIZE - 1) >> Canvas::TILE_SHIFT;
+            int ty = (std::max(d.oldH, d.newH) + Canvas::TILE_SIZE - 1) >> Canvas::TILE_SHIFT;
+            for (auto* ps : {&d.before, &d.after})
+                for (auto& p : *ps)
+                    if (p.tx < 0 || p.ty < 0 || p.tx >= tx || p.ty >= ty) return false;
+        }
+    }
+
+    result.setFps((int)get32(h + 24));
+    result.select((int)get32(h + 28));
+    info.activeLayer = std::max(0, std::min((int)get32(h + 32), result.layers().count() - 1));
+    info.fg = getColor(h + 36);
+    info.bg = getColor(h + 40);
+    anim = std::move(result);
+    if (history) {
+        if (entries != NO_TILE) history->restore(std::move(deltas), cursor);
+        else history->clear();
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "animation.h"
+#include "imageio.h"
+#include <string>
+
+class History;
+
+// Editor state stored alongside the artwork.
+struct ProjectInfo {
+    int   activeLayer = 0;
+    Color fg{0, 0, 0, 255};
+    Color bg{255, 255, 255, 255};
+};
+
+// TinyCanvas project (.tcp): every frame and layer with its settings, plus
+// each frame's composite so nothing has to be blended on open. Tiles are
+// stored raw and page aligned, once however many layers or frames share
+// them. Loading maps the file and reads only the tile tables; a tile's
+// pixels are paged in by the OS the first time something reads them, so
+// opening costs about the same whatever the file size. Frame and layer ids
+// are kept, so undo history saved along (when `history` is given) still
+// applies after loading.
+//
+// Saving composites every frame first, hence the non-const animation.
+bool saveProject(Animation& anim, const ProjectInfo& info, const std::string& path,
+                 const ProgressFn& progress = nullptr, const History* history = nullptr);
+// `history` is replaced with the saved one, or cleared if there is none.
+bool loadProject(const std::string& path, Animation& anim, ProjectInfo& info,
+                 History* history = nullptr);
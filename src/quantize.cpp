@@ -0,0 +1,461 @@
+#include "quantize.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+namespace {
+
+// Colours are binned at 5 bits per colour channel. Alpha has four bins so
+// fully transparent and fully opaque pixels never share one with
+// translucent ones.
+const int BINS           = 1 << 17;
+const int KMEANS_ROUNDS  = 4;
+const int KMEANS_CHUNK   = 4096; // bins per task, fixed so the sums add up the same way
+const int DIFFUSE_CHUNK  = 64;   // pixels a row gets ahead before the next may follow
+
+int alphaBin(uint8_t a) { return a == 0 ? 0 : a == 255 ? 3 : 1 + (a >> 7); }
+int alphaBase(int bin) { return bin == 0 ? 0 : bin == 1 ? 1 : bin == 2 ? 128 : 255; }
+
+int binOf(int r, int g, int b, uint8_t a) {
+    return (r >> 3) << 12 | (g >> 3) << 7 | (b >> 3) << 2 | alphaBin(a);
+}
+int binOf(const Color& c) { return binOf(c.r, c.g, c.b, c.a); }
+
+int channel(const Color& c, int axis) {
+    switch (axis) {
+    case 0:  return c.r;
+    case 1:  return c.g;
+    case 2:  return c.b;
+    default: return c.a;
+    }
+}
+
+// Pixel count of a bin and the sums of each channel's offset from the
+// bin's lowest value, which keeps the colour sums within 32 bits.
+struct Bin {
+    uint32_t n = 0, r = 0, g = 0, b = 0;
+    uint64_t a = 0;
+
+    void add(const Color& c, uint32_t count) {
+        n += count;
+        r += (c.r & 7) * count;
+        g += (c.g & 7) * count;
+        b += (c.b & 7) * count;
+        a += (uint64_t)(c.a - alphaBase(alphaBin(c.a))) * count;
+    }
+};
+
+// Mean colour of the pixels in bin `i`, or its middle if there are none.
+void binColor(const Bin& bin, int i, double out[4]) {
+    static const double MIDDLE_ALPHA[4] = {0, 64, 191, 255};
+    double n = bin.n;
+    out[0] = ((i >> 12) << 3) + (n ? bin.r / n : 3.5);
+    out[1] = (((i >> 7) & 31) << 3) + (n ? bin.g / n : 3.5);
+    out[2] = (((i >> 2) & 31) << 3) + (n ? bin.b / n : 3.5);
+    out[3] = n ? alphaBase(i & 3) + bin.a / n : MIDDLE_ALPHA[i & 3];
+}
+
+Color toColor(const double c[4]) {
+    auto u8 = [](double v) { return (uint8_t)std::max(0.0, std::min(255.0, std::round(v))); };
+    return {u8(c[0]), u8(c[1]), u8(c[2]), u8(c[3])};
+}
+
+// Each worker bins the tiles it takes into its own histogram; the
+// histograms are then summed a range of bins per task.
+std::vector<Bin> histogram(const Canvas& canvas) {
+    int workers = workerCount();
+    int tiles = canvas.tilesX() * canvas.tilesY();
+    std::vector<std::vector<Bin>> part(workers);
+    std::atomic<int> next{0};
+    parallelFor(workers, [&](int w) {
+        std::vector<Bin>& h = part[w];
+        h.resize(BINS);
+        std::vector<Color> px(Canvas::TILE_SIZE * Canvas::TILE_SIZE);
+        for (int i; (i = next++) < tiles;) {
+            int tx = i % canvas.tilesX(), ty = i / canvas.tilesX();
+            Rect r = canvas.tileRect(tx, ty);
+            const Tile& t = *canvas.tileAt(tx, ty);
+            if (t.uniform()) {
+                const Color& c = canvas.uniformColor(t);
+                h[binOf(c)].add(c, (uint32_t)(r.w * r.h));
+                continue;
+            }
+            canvas.readRegion(r, px.data(), r.w);
+            for (int k = 0; k < r.w * r.h; k++) h[binOf(px[k])].add(px[k], 1);
+        }
+    });
+
+    const int RANGES = 64;
+    parallelFor(RANGES, [&](int k) {
+        for (int i = k * (BINS / RANGES); i < (k + 1) * (BINS / RANGES); i++) {
+            Bin& sum = part[0][i];
+            for (int w = 1; w < workers; w++) {
+                const Bin& b = part[w][i];
+                sum.n += b.n;
+                sum.r += b.r;
+                sum.g += b.g;
+                sum.b += b.b;
+                sum.a += b.a;
+            }
+        }
+    });
+    return std::move(part[0]);
+}
+
+// k-d tree over palette entries for nearest-colour queries by squared
+// RGBA distance, the measure Canvas uses for colours not in its palette.
+// Ties go to the lower entry.
+class PaletteTree {
+public:
+    explicit PaletteTree(const Palette& p) : pal_(p) {
+        std::vector<int> order(p.size());
+        std::iota(order.begin(), order.end(), 0);
+        nodes_.reserve(p.size());
+        build(order.data(), (int)order.size());
+    }
+
+    uint8_t nearest(const int c[4]) const {
+        int best = 0, bestDist = INT_MAX;
+        search(nodes_.empty() ? -1 : 0, c, best, bestDist);
+        return (uint8_t)best;
+    }
+
+private:
+    struct Node {
+        int entry, axis;
+        int left = -1, right = -1;
+    };
+    const Palette& pal_;
+    std::vector<Node> nodes_;
+
+    // Splits on the channel with the widest spread.
+    int build(int* idx, int n) {
+        if (n == 0) return -1;
+        int axis = 0, widest = -1;
+        for (int a = 0; a < 4; a++) {
+            auto mm = std::minmax_element(idx, idx + n, [&](int x, int y) {
+                return channel(pal_[x], a) < channel(pal_[y], a);
+            });
+            int spread = channel(pal_[*mm.second], a) - channel(pal_[*mm.first], a);
+            if (spread > widest) {
+                widest = spread;
+                axis = a;
+            }
+        }
+        int mid = n / 2;
+        std::nth_element(idx, idx + mid, idx + n, [&](int x, int y) {
+            int cx = channel(pal_[x], axis), cy = channel(pal_[y], axis);
+            return cx != cy ? cx < cy : x < y;
+        });
+        int node = (int)nodes_.size();
+        nodes_.push_back({idx[mid], axis});
+        int left = build(idx, mid);
+        int right = build(idx + mid + 1, n - mid - 1);
+        nodes_[node].left = left;
+        nodes_[node].right = right;
+        return node;
+    }
+
+    void search(int node, const int c[4], int& best, int& bestDist) const {
+        if (node < 0) return;
+        const Node& nd = nodes_[node];
+        const Color& p = pal_[nd.entry];
+        int dr = c[0] - p.r, dg = c[1] - p.g, db = c[2] - p.b, da = c[3] - p.a;
+        int d = dr * dr + dg * dg + db * db + da * da;
+        if (d < bestDist || (d == bestDist && nd.entry < best)) {
+            bestDist = d;
+            best = nd.entry;
+        }
+        int diff = c[nd.axis] - channel(p, nd.axis);
+        search(diff < 0 ? nd.left : nd.right, c, best, bestDist);
+        if (diff * diff <= bestDist) search(diff < 0 ? nd.right : nd.left, c, best, bestDist);
+    }
+};
+
+struct Entry {
+    double c[4];
+    uint32_t n;
+};
+
+// A range of entries and how much splitting it would gain: its pixel
+// count times its widest channel spread.
+struct Box {
+    int begin, end;
+    int axis = 0;
+    double score = 0;
+};
+
+void measure(Box& box, const std::vector<Entry>& e) {
+    double lo[4] = {255, 255, 255, 255}, hi[4] = {0, 0, 0, 0};
+    double n = 0;
+    for (int i = box.begin; i < box.end; i++) {
+        for (int k = 0; k < 4; k++) {
+            lo[k] = std::min(lo[k], e[i].c[k]);
+            hi[k] = std::max(hi[k], e[i].c[k]);
+        }
+        n += e[i].n;
+    }
+    box.score = 0;
+    for (int k = 0; k < 4; k++) {
+        if (hi[k] - lo[k] > box.score) {
+            box.score = hi[k] - lo[k];
+            box.axis = k;
+        }
+    }
+    box.score *= box.end - box.begin > 1 ? n : 0;
+}
+
+Palette buildPalette(const std::vector<Bin>& hist, int colors) {
+    std::vector<Entry> entries;
+    for (int i = 0; i < BINS; i++) {
+        if (!hist[i].n) continue;
+        entries.push_back({{}, hist[i].n});
+        binColor(hist[i], i, entries.back().c);
+    }
+    Palette pal;
+    if ((int)entries.size() <= colors) {
+        for (const Entry& e : entries) pal.push_back(toColor(e.c));
+        return pal;
+    }
+
+    // Median cut: split the box that gains most at the pixel median of its
+    // widest channel until there are enough. Entries come in bin order and
+    // sorts break ties by position, so the cut is deterministic.
+    std::vector<Box> boxes(1, Box{0, (int)entries.size()});
+    measure(boxes[0], entries);
+    while ((int)boxes.size() < colors) {
+        auto it = std::max_element(boxes.begin(), boxes.end(),
+                                   [](const Box& a, const Box& b) { return a.score < b.score; });
+        if (it->score <= 0) break;
+        Box box = *it;
+        int axis = box.axis;
+        std::stable_sort(entries.begin() + box.begin, entries.begin() + box.end,
+                         [axis](const Entry& a, const Entry& b) { return a.c[axis] < b.c[axis]; });
+        uint64_t total = 0, half = 0;
+        for (int i = box.begin; i < box.end; i++) total += entries[i].n;
+        int split = box.begin + 1;
+        for (int i = box.begin; i < box.end - 1; i++) {
+            half += entries[i].n;
+            split = i + 1;
+            if (half * 2 >= total) break;
+        }
+        Box a{box.begin, split}, b{split, box.end};
+        measure(a, entries);
+        measure(b, entries);
+        *it = a;
+        boxes.push_back(b);
+    }
+    for (const Box& box : boxes) {
+        double sum[4] = {0, 0, 0, 0}, n = 0;
+        for (int i = box.begin; i < box.end; i++) {
+            for (int k = 0; k < 4; k++) sum[k] += entries[i].c[k] * entries[i].n;
+            n += entries[i].n;
+        }
+        for (double& s : sum) s /= n;
+        pal.push_back(toColor(sum));
+    }
+
+    // k-means: move each entry to the mean of the bins nearest it. A
+    // palette entry no bin is nearest to is left where it is.
+    int chunks = ((int)entries.size() + KMEANS_CHUNK - 1) / KMEANS_CHUNK;
+    std::vector<std::vector<double>> sums(chunks);
+    for (int round = 0; round < KMEANS_ROUNDS; round++) {
+        PaletteTree tree(pal);
+        parallelFor(chunks, [&](int k) {
+            std::vector<double>& s = sums[k];
+            s.assign(pal.size() * 5, 0);
+            int end = std::min((int)entries.size(), (k + 1) * KMEANS_CHUNK);
+            for (int i = k * KMEANS_CHUNK; i < end; i++) {
+                const Entry& e = entries[i];
+                int c[4];
+                for (int ch = 0; ch < 4; ch++) c[ch] = (int)std::lround(e.c[ch]);
+                double* t = &s[tree.nearest(c) * 5];
+                for (int ch = 0; ch < 4; ch++) t[ch] += e.c[ch] * e.n;
+                t[4] += e.n;
+            }
+        });
+        for (size_t j = 0; j < pal.size(); j++) {
+            double mean[5] = {0, 0, 0, 0, 0};
+            for (int k = 0; k < chunks; k++)
+                for (int ch = 0; ch < 5; ch++) mean[ch] += sums[k][j * 5 + ch];
+            if (mean[4] == 0) continue;
+            for (int ch = 0; ch < 4; ch++) mean[ch] /= mean[4];
+            pal[j] = toColor(mean);
+        }
+    }
+    return pal;
+}
+
+// Nearest entry for every bin: for the mean of its pixels where there is
+// a histogram, and for the bin's middle otherwise.
+std::vector<uint8_t> lookupTable(const Palette& pal, const std::vector<Bin>* hist) {
+    PaletteTree tree(pal);
+    std::vector<uint8_t> lut(BINS);
+    const int RANGES = 64;
+    parallelFor(RANGES, [&](int k) {
+        Bin none;
+        for (int i = k * (BINS / RANGES); i < (k + 1) * (BINS / RANGES); i++) {
+            double c[4];
+            binColor(hist ? (*hist)[i] : none, i, c);
+            int q[4];
+            for (int ch = 0; ch < 4; ch++) q[ch] = (int)std::lround(c[ch]);
+            lut[i] = tree.nearest(q);
+        }
+    });
+    return lut;
+}
+
+// 8x8 Bayer matrix, thresholds 0 to 63.
+const uint8_t BAYER[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+int clamp8(int v) { return v < 0 ? 0 : v > 255 ? 255 : v; }
+
+// No dithering, or ordered: every pixel is mapped on its own, a tile per
+// task. The threshold spread is about the gap between neighbouring
+// entries of an evenly spaced palette of the same size.
+void mapTiles(const Canvas& canvas, const Palette& pal, const std::vector<uint8_t>& lut, bool ordered,
+              uint8_t* out) {
+    int w = canvas.getWidth();
+    int spread = (int)(256 / std::cbrt((double)pal.size()));
+    parallelFor(canvas.tilesX() * canvas.tilesY(), [&](int i) {
+        int tx = i % canvas.tilesX(), ty = i / canvas.tilesX();
+        Rect r = canvas.tileRect(tx, ty);
+        const Tile& t = *canvas.tileAt(tx, ty);
+        if (t.uniform() && !ordered) {
+            uint8_t v = lut[binOf(canvas.uniformColor(t))];
+            for (int y = r.y; y < r.bottom(); y++) std::fill_n(out + (size_t)y * w + r.x, r.w, v);
+            return;
+        }
+        std::vector<Color> px((size_t)r.w * r.h);
+        canvas.readRegion(r, px.data(), r.w);
+        for (int y = 0; y < r.h; y++) {
+            uint8_t* row = out + (size_t)(r.y + y) * w + r.x;
+            const Color* src = &px[(size_t)y * r.w];
+            if (!ordered) {
+                for (int x = 0; x < r.w; x++) row[x] = lut[binOf(src[x])];
+                continue;
+            }
+            const uint8_t* bayer = BAYER[(r.y + y) & 7];
+            for (int x = 0; x < r.w; x++) {
+                const Color& c = src[x];
+                int o = (bayer[(r.x + x) & 7] * 2 - 63) * spread / 128;
+                row[x] = lut[binOf(clamp8(c.r + o), clamp8(c.g + o), clamp8(c.b + o), c.a)];
+            }
+        }
+    });
+}
+
+// Floyd-Steinberg error diffusion. Each row needs the errors of the one
+// above, so rows run as a wavefront: a worker takes the next row and
+// follows the row above, DIFFUSE_CHUNK pixels at a time, once that row is
+// far enough ahead. Errors are in sixteenths, three channels per pixel
+// with a pixel of padding either side, in a ring of rows that a row
+// reuses once the row that last read it has finished. Transparent pixels
+// neither take nor pass on error.
+void diffuse(const Canvas& canvas, const Palette& pal, const std::vector<uint8_t>& lut, uint8_t* out) {
+    int w = canvas.getWidth(), h = canvas.getHeight();
+    int workers = workerCount();
+    int ring = 2 * workers + 2;
+    std::vector<std::vector<int>> err(ring, std::vector<int>((size_t)(w + 2) * 3));
+    std::vector<std::atomic<int>> done(h); // pixels of each row finished
+    for (auto& d : done) d.store(0, std::memory_order_relaxed);
+    std::atomic<int> next{0};
+    auto waitFor = [&](int row, int pixels) {
+        while (done[row].load(std::memory_order_acquire) < pixels) std::this_thread::yield();
+    };
+
+    parallelFor(workers, [&](int) {
+        std::vector<Color> src(w);
+        for (int y; (y = next++) < h;) {
+            if (y + 1 - ring >= 0) waitFor(y + 1 - ring, w);
+            const int* cur = err[y % ring].data();
+            int* below = err[(y + 1) % ring].data();
+            std::fill(below, below + (size_t)(w + 2) * 3, 0);
+            canvas.readRegion({0, y, w, 1}, src.data(), w);
+            uint8_t* row = out + (size_t)y * w;
+            int right[3] = {0, 0, 0};
+            for (int x0 = 0; x0 < w; x0 += DIFFUSE_CHUNK) {
+                int x1 = std::min(w, x0 + DIFFUSE_CHUNK);
+                // The row above adds to pixel x as it passes x + 1.
+                if (y > 0) waitFor(y - 1, std::min(w, x1 + 1));
+                for (int x = x0; x < x1; x++) {
+                    const Color& s = src[x];
+                    if (s.a == 0) {
+                        row[x] = lut[binOf(s)];
+                        right[0] = right[1] = right[2] = 0;
+                        continue;
+                    }
+                    const int* e = cur + (x + 1) * 3;
+                    int v[3] = {clamp8(s.r + (e[0] + right[0]) / 16), clamp8(s.g + (e[1] + right[1]) / 16),
+                                clamp8(s.b + (e[2] + right[2]) / 16)};
+                    uint8_t i = lut[binOf(v[0], v[1], v[2], s.a)];
+                    row[x] = i;
+                    const Color& p = pal[i];
+                    int d[3] = {v[0] - p.r, v[1] - p.g, v[2] - p.b};
+                    int* b = below + x * 3;
+                    for (int ch = 0; ch < 3; ch++) {
+                        right[ch] = d[ch] * 7;
+                        b[ch]     += d[ch] * 3;
+                        b[ch + 3] += d[ch] * 5;
+                        b[ch + 6] += d[ch];
+                    }
+                }
+                done[y].store(x1, std::memory_order_release);
+            }
+        }
+    });
+}
+
+void remap(Canvas& canvas, PaletteRef palette, Dither dither, const std::vector<Bin>* hist) {
+    std::vector<uint8_t> lut = lookupTable(*palette, hist);
+    std::vector<uint8_t> indices((size_t)canvas.getWidth() * canvas.getHeight());
+    if (dither == Dither::Diffusion)
+        diffuse(canvas, *palette, lut, indices.data());
+    else
+        mapTiles(canvas, *palette, lut, dither == Dither::Ordered, indices.data());
+    canvas.toIndexed(std::move(palette), indices.data(), canvas.getWidth());
+}
+
+} // namespace
+
+const char* ditherName(Dither d) {
+    switch (d) {
+    case Dither::None:      return "None";
+    case Dither::Ordered:   return "Ordered";
+    case Dither::Diffusion: return "Diffusion";
+    default:                return "?";
+    }
+}
+
+Palette buildPalette(const Canvas& canvas, int colors) {
+    return buildPalette(histogram(canvas), std::max(1, std::min(colors, 256)));
+}
+
+void remap(Canvas& canvas, PaletteRef palette, Dither dither) {
+    if (!palette || palette->empty() || palette->size() > 256) return;
+    remap(canvas, std::move(palette), dither, nullptr);
+}
+
+void quantize(Canvas& canvas, const QuantizeOptions& opts) {
+    int colors = std::max(2, std::min(opts.colors, 256));
+    // toIndexed() gives up at the 257th colour, which a photo reaches in
+    // its first few rows.
+    if (!canvas.indexed()) canvas.toIndexed();
+    if (canvas.indexed() && (int)canvas.palette()->size() <= colors) return;
+    std::vector<Bin> hist = histogram(canvas);
+    auto palette = std::make_shared<Palette>(buildPalette(hist, colors));
+    remap(canvas, std::move(palette), opts.dither, &hist);
+}
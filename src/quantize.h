@@ -0,0 +1,33 @@
+#pragma once
+#include "canvas.h"
+
+enum class Dither : uint8_t {
+    None,
+    Ordered,   // 8x8 Bayer threshold
+    Diffusion, // Floyd-Steinberg
+    COUNT
+};
+
+const char* ditherName(Dither d);
+
+struct QuantizeOptions {
+    int    colors = 256; // palette entries at most, 2 to 256
+    Dither dither = Dither::None;
+};
+
+// Palette of at most `colors` entries for the canvas: median cut over a
+// histogram of its pixels, refined by a few rounds of k-means. The result
+// is the same however many threads build it.
+Palette buildPalette(const Canvas& canvas, int colors);
+
+// Switch the canvas to indexed mode with `palette`, each pixel taking the
+// nearest entry, dithered as asked. Nearest entries come from a lookup
+// table over colours at 5 bits per colour channel and 4 alpha levels,
+// filled from a k-d tree of the palette, so mapping costs a table read
+// per pixel.
+void remap(Canvas& canvas, PaletteRef palette, Dither dither = Dither::None);
+
+// Reduce the canvas to an indexed one of at most opts.colors colours. One
+// with few enough colours keeps them exactly; otherwise buildPalette() and
+// remap(). Every stage runs on all workers.
+void quantize(Canvas& canvas, const QuantizeOptions& opts = {});
@@ -0,0 +1,78 @@
+#include "canvas.h"
+#include "history.h"
+#include "imageio.h"
+#include "layers.h"
+#include <cstdio>
+#include <vector>
+
+// Checks for bugs that were fixed in the core library, run by ctest. Each
+// prints what went wrong and returns false.
+
+namespace {
+
+bool check(bool ok, const char* what) {
+    if (!ok) fprintf(stderr, "FAIL: %s\n", what);
+    return ok;
+}
+
+// An import resizes every layer as one undo step whose first delta alone
+// is over the budget; pushing the rest of the step must not drop it.
+bool undoOverBudgetImport() {
+    LayerStack stack(64, 64);
+    stack.add(1);
+    History history(1024 * 1024);
+
+    for (int i = 0; i < stack.count(); i++) stack.layer(i).canvas.beginCapture();
+    stack.resize(1024, 1024);
+    std::vector<Color> px(1024 * 1024);
+    for (size_t i = 0; i < px.size(); i++) px[i] = {(uint8_t)i, (uint8_t)(i >> 8), (uint8_t)(i >> 16), 255};
+    Canvas& top = stack.layer(1).canvas;
+    top.writeRegion(top.bounds(), px.data(), 1024);
+    for (int i = 0; i < stack.count(); i++) {
+        CanvasDelta d = stack.layer(i).canvas.endCapture();
+        d.layer  = stack.layer(i).id;
+        d.joined = i > 0;
+        history.push(std::move(d));
+    }
+
+    bool ok = check(history.count() == 2, "every delta of the import is kept");
+    history.undo(stack);
+    for (int i = 0; i < stack.count(); i++) {
+        const Canvas& c = stack.layer(i).canvas;
+        ok &= check(c.getWidth() == 64 && c.getHeight() == 64, "undo restores every layer's size");
+    }
+    if (ok) stack.composite();
+    return ok;
+}
+
+// A uniform indexed canvas keeps its colour in the palette; saved as
+// truecolor it must still come out with its alpha.
+bool truecolorIndexedAlpha() {
+    bool ok = true;
+    for (uint8_t alpha : {0, 128}) {
+        Canvas canvas(70, 70);
+        canvas.clear({10, 20, 30, alpha});
+        canvas.toIndexed();
+        PNGOptions opts;
+        opts.palette = false;
+        std::vector<uint8_t> png;
+        Image img;
+        bool loaded = encodePNG(canvas, png, opts) && decodePNG(png.data(), png.size(), img);
+        ok &= check(loaded, "truecolor PNG of an indexed canvas loads");
+        if (!loaded) continue;
+        bool kept = true;
+        for (const Color& c : img.pixels) kept &= c.a == alpha;
+        ok &= check(kept, "truecolor PNG of a translucent indexed canvas keeps its alpha");
+    }
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    int failed = 0;
+    failed += !undoOverBudgetImport();
+    failed += !truecolorIndexedAlpha();
+    if (failed) fprintf(stderr, "%d check(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
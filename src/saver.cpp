@@ -0,0 +1,84 @@
+#include "saver.h"
+
+ImageSaver::ImageSaver() : worker_([this] { run(); }) {}
+
+ImageSaver::~ImageSaver() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    wake_.notify_one();
+    worker_.join();
+}
+
+void ImageSaver::save(const Canvas& image, const std::string& path, const PNGOptions& png) {
+    push({path, [image, path, png](const ProgressFn& progress) {
+        return saveImage(image, path, png, progress);
+    }});
+}
+
+void ImageSaver::saveProject(const Animation& anim, const ProjectInfo& info, const std::string& path,
+                             const History* history) {
+    // Like the tiles, the deltas' patches are shared rather than copied.
+    std::shared_ptr<const History> hist;
+    if (history) hist = std::make_shared<History>(*history);
+    // Mutable: saving composites the copy's frames.
+    push({path, [copy = Animation(anim), info, path, hist](const ProgressFn& progress) mutable {
+        return ::saveProject(copy, info, path, progress, hist.get());
+    }});
+}
+
+void ImageSaver::push(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(job));
+    }
+    wake_.notify_one();
+}
+
+bool ImageSaver::busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_ || !queue_.empty();
+}
+
+bool ImageSaver::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_ || !queue_.empty() || !done_.empty();
+}
+
+void ImageSaver::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return !active_ && queue_.empty(); });
+}
+
+std::vector<ImageSaver::Result> ImageSaver::poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Result> r;
+    r.swap(done_);
+    return r;
+}
+
+void ImageSaver::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        active_ = true;
+        lock.unlock();
+
+        progress_ = 0;
+        bool ok = job.write([this](int done, int total) {
+            progress_ = (int)((int64_t)done * 1000 / total);
+        });
+        progress_ = 0;
+        // Drop the tiles here, off the lock; the UI may be waiting on it.
+        job.write = nullptr;
+
+        lock.lock();
+        active_ = false;
+        done_.push_back({job.path, ok});
+        if (queue_.empty()) idle_.notify_all();
+    }
+}
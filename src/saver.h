@@ -0,0 +1,63 @@
+#pragma once
+#include "canvas.h"
+#include "history.h"
+#include "imageio.h"
+#include "project.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes and writes images and projects on a worker thread. The save
+// calls take a copy of the canvas or animation, which only shares its
+// copy-on-write tiles, so it is cheap to make and later edits never reach
+// what is being written.
+class ImageSaver {
+public:
+    struct Result {
+        std::string path;
+        bool ok;
+    };
+
+    ImageSaver();
+    ~ImageSaver(); // finishes queued saves first
+
+    void save(const Canvas& image, const std::string& path, const PNGOptions& png = {});
+    // Undo history is saved along when `history` is given.
+    void saveProject(const Animation& anim, const ProjectInfo& info, const std::string& path,
+                     const History* history = nullptr);
+
+    bool busy() const;
+    // Busy, or with results poll() has not returned yet.
+    bool pending() const;
+    // Blocks until every queued save is finished.
+    void wait();
+    // Fraction of the current save done, 0 when idle.
+    float progress() const { return progress_.load() / 1000.0f; }
+    // Saves finished since the last call, oldest first.
+    std::vector<Result> poll();
+
+private:
+    struct Job {
+        std::string path;
+        std::function<bool(const ProgressFn&)> write;
+    };
+
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<Job> queue_;
+    std::vector<Result> done_;
+    bool active_ = false;
+    bool quit_   = false;
+    std::atomic<int> progress_{0}; // per mille
+
+    void push(Job job);
+    void run();
+};
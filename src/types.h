@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 
@@ -9,6 +10,7 @@ struct Color {
     bool operator==(const Color& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
     bool operator!=(const Color& o) const { return !(*this == o); }
 };
+static_assert(sizeof(Color) == 4, "Color must match the RGBA32 byte layout");
 
 struct Point {
     int x, y;
@@ -16,6 +18,41 @@ struct Point {
     Point(int x, int y) : x(x), y(y) {}
 };
 
+struct Rect {
+    int x, y, w, h;
+    Rect() : x(0), y(0), w(0), h(0) {}
+    Rect(int x, int y, int w, int h) : x(x), y(y), w(w), h(h) {}
+
+    // Inclusive corners, in any order.
+    static Rect fromCorners(int x0, int y0, int x1, int y1) {
+        if (x0 > x1) std::swap(x0, x1);
+        if (y0 > y1) std::swap(y0, y1);
+        return {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+    }
+
+    bool empty() const { return w <= 0 || h <= 0; }
+    int  right()  const { return x + w; }
+    int  bottom() const { return y + h; }
+    bool contains(int px, int py) const { return px >= x && px < x + w && py >= y && py < y + h; }
+    bool operator==(const Rect& o) const { return x == o.x && y == o.y && w == o.w && h == o.h; }
+    bool operator!=(const Rect& o) const { return !(*this == o); }
+
+    Rect united(const Rect& o) const {
+        if (empty()) return o;
+        if (o.empty()) return *this;
+        int x0 = std::min(x, o.x), y0 = std::min(y, o.y);
+        int x1 = std::max(right(), o.right()), y1 = std::max(bottom(), o.bottom());
+        return {x0, y0, x1 - x0, y1 - y0};
+    }
+
+    Rect intersected(const Rect& o) const {
+        int x0 = std::max(x, o.x), y0 = std::max(y, o.y);
+        int x1 = std::min(right(), o.right()), y1 = std::min(bottom(), o.bottom());
+        if (x1 <= x0 || y1 <= y0) return {};
+        return {x0, y0, x1 - x0, y1 - y0};
+    }
+};
+
 enum class Tool {
     Pencil,
     Eraser,